@@ -0,0 +1,721 @@
+/*
+ * discont-bench: sends synthetic MPEG-TS over loopback multicast to a discont it
+ * starts itself, then reports what that cost and whether everything it broke on
+ * purpose was found.
+ *
+ * Every channel carries PAT, PMT, video with PCR and audio, as RTP or plain UDP
+ * datagrams of 7 packets. Faults are injected per datagram: losses, swapped pairs,
+ * a video packet turned into a null packet (one CC error), and PMT version changes.
+ * The sender checks continuity in the order it really sent things, so the CC errors
+ * discont should see are known exactly. Results come from discont's stats segment,
+ * CPU from /proc/<pid>/stat and socket drops from /proc/net/udp.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "lmtstats.h"
+
+#define TS_SIZE 188
+#define TS_PER_DGRAM 7
+#define RTP_HDR 12
+#define DGRAM_MAX (RTP_HDR + TS_PER_DGRAM * TS_SIZE)
+#define SEND_BATCH 256
+#define TICK_NS 1000000LL
+#define PSI_PERIOD_MS 100
+#define PCR_PERIOD_MS 20
+#define COOLDOWN_MS 1500        /* clean traffic at the end so discont closes its last windows */
+#define PAT_PID 0x0000
+#define PMT_PID 0x1000
+#define VIDEO_PID 0x0100
+#define AUDIO_PID 0x0101
+#define NULL_PID 0x1fff
+#define SIM_PIDS 5
+
+typedef struct benchOpts
+    {
+    int channels;
+    double mbps;                /* per channel */
+    int seconds;
+    bool udp;
+    double lossPct;
+    double reorderPct;
+    double ccPct;
+    int pmtPeriod;              /* seconds, 0 for never */
+    int senders;
+    int workers;
+    const char *capture;
+    const char *discont;
+    const char *ifAddr;
+    struct in_addr group;       /* of the first channel, the next ones count up */
+    int port;
+    bool onePort;               /* every channel on port, told apart by group only */
+    } benchOpts;
+
+/* What the sender knows a correct discont must find on a channel */
+typedef struct benchTruth
+    {
+    unsigned long long lost;
+    unsigned long long reordered;
+    unsigned long long ccFaults;
+    unsigned long long ccExpected;
+    unsigned long long pmtChanges;
+    } benchTruth;
+
+typedef struct benchChan
+    {
+    struct sockaddr_in dst;
+    double credit;              /* bytes we may send */
+    unsigned long long dgrams;
+    uint16_t rtpSeq;
+    uint8_t cc[SIM_PIDS];       /* PAT, PMT, video and both audio PIDs as sent */
+    int pmtVersion;
+    uint16_t audioPid;
+    uint8_t pmt[TS_SIZE];       /* current PMT packet, CC patched per send */
+    bool holding;               /* a datagram waits to be sent after the next one */
+    int holdLen;
+    uint8_t hold[DGRAM_MAX];
+    int simCc[SIM_PIDS];        /* receiver's view: last CC per PID, -1 before the first */
+    bool simDup[SIM_PIDS];
+    benchTruth truth;
+    } benchChan;
+
+typedef struct benchSender
+    {
+    pthread_t thread;
+    benchChan *chans;
+    int chanCnt;
+    int sok;
+    uint64_t rnd;
+    unsigned long long sent;
+    unsigned long long bytes;
+    unsigned long long sendErrors;
+    } benchSender;
+
+static benchOpts g_opts =
+    {
+    .channels = 10, .mbps = 5, .seconds = 10, .senders = 1, .workers = 0, .capture = "socket",
+    .discont = "./discont", .ifAddr = "127.0.0.1", .port = 20000
+    };
+static volatile bool g_faults = true;
+static volatile bool g_stop;
+static uint32_t g_crcTable[256];
+
+void usage(const char *progname)
+{
+    printf("usage: %s [options]\n", progname);
+    printf("  -n channels       %d\n", g_opts.channels);
+    printf("  -r Mbit/s         per channel, %.1f\n", g_opts.mbps);
+    printf("  -t seconds        measured run, %d\n", g_opts.seconds);
+    printf("  -u                plain UDP instead of RTP\n");
+    printf("  -l percent        datagrams lost\n");
+    printf("  -o percent        datagrams swapped with the next one\n");
+    printf("  -e percent        datagrams with a video packet nulled (one CC error each)\n");
+    printf("  -p seconds        PMT version change period\n");
+    printf("  -j senders        sending threads, %d\n", g_opts.senders);
+    printf("  -w workers        discont's workers setting, %d\n", g_opts.workers);
+    printf("  -m capture        discont's capture setting, %s\n", g_opts.capture);
+    printf("  -d path           discont binary, %s\n", g_opts.discont);
+    printf("  -g group          first multicast group, 239.255.1.1\n");
+    printf("  -P port           of the first channel, the next ones count up, %d\n", g_opts.port);
+    printf("  -s                all channels on the same port\n");
+    printf("Exits 0 when everything injected was detected and nothing was dropped, 2 if not.\n");
+    exit(EXIT_FAILURE);
+}
+
+void crcInit(void)
+{
+    for (uint32_t i = 0; i < 256; ++i)
+    {
+        uint32_t c = i << 24;
+        for (int b = 0; b < 8; ++b)
+            c = (c & 0x80000000) ? (c << 1) ^ 0x04c11db7 : c << 1;
+        g_crcTable[i] = c;
+    }
+}
+
+uint32_t crc32(const uint8_t *p, int len)
+{
+    uint32_t c = 0xffffffff;
+    while (len--)
+        c = (c << 8) ^ g_crcTable[((c >> 24) ^ *p++) & 0xff];
+    return c;
+}
+
+static inline uint64_t xorshift(uint64_t *s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+static inline bool chance(uint64_t *s, double pct)
+{
+    return pct > 0 && (xorshift(s) % 1000000) < pct * 10000;
+}
+
+long long monoNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* A packet with one section starting in it, stuffed to the end */
+void psiPacket(uint8_t *p, uint16_t pid, const uint8_t *sec, int len)
+{
+    uint32_t crc = crc32(sec, len);
+    p[0] = 0x47;
+    p[1] = 0x40 | (pid >> 8);
+    p[2] = pid & 0xff;
+    p[3] = 0x10;
+    p[4] = 0;
+    memcpy(p + 5, sec, len);
+    p[5 + len] = crc >> 24;
+    p[6 + len] = crc >> 16;
+    p[7 + len] = crc >> 8;
+    p[8 + len] = crc;
+    memset(p + 9 + len, 0xff, TS_SIZE - 9 - len);
+}
+
+void makePmt(benchChan *ch)
+{
+    uint8_t sec[32] =
+        {
+        0x02, 0xb0, 23, 0x00, 0x01, 0xc1 | ((ch->pmtVersion & 0x1f) << 1), 0, 0,
+        0xe0 | (VIDEO_PID >> 8), VIDEO_PID & 0xff, 0xf0, 0,
+        0x1b, 0xe0 | (VIDEO_PID >> 8), VIDEO_PID & 0xff, 0xf0, 0,
+        0x03, 0xe0 | (ch->audioPid >> 8), ch->audioPid & 0xff, 0xf0, 0
+        };
+    psiPacket(ch->pmt, PMT_PID, sec, 22);
+}
+
+static inline int simIndex(uint16_t pid)
+{
+    if (pid == PAT_PID)
+        return 0;
+    if (pid == PMT_PID)
+        return 1;
+    if (pid == VIDEO_PID)
+        return 2;
+    if (pid == AUDIO_PID)
+        return 3;
+    if (pid == AUDIO_PID + 1)
+        return 4;
+    return -1;
+}
+
+/* ISO/IEC 13818-1 continuity as seen by a receiver getting exactly what we sent */
+void simDeliver(benchChan *ch, const uint8_t *ts, int cnt)
+{
+    for (int i = 0; i < cnt; ++i, ts += TS_SIZE)
+    {
+        int idx = simIndex(((ts[1] & 0x1f) << 8) | ts[2]);
+        int cc = ts[3] & 0x0f;
+        if (idx < 0)
+            continue;
+        if (ch->simCc[idx] >= 0)
+        {
+            if (cc == ch->simCc[idx] && !ch->simDup[idx])
+            {
+                ch->simDup[idx] = true;
+                continue;
+            }
+            if (cc != ((ch->simCc[idx] + 1) & 0x0f))
+                ch->truth.ccExpected++;
+        }
+        ch->simCc[idx] = cc;
+        ch->simDup[idx] = false;
+    }
+}
+
+/* Next datagram of a channel, faults included, returns its length */
+int buildDgram(benchSender *snd, benchChan *ch, uint8_t *out)
+{
+    const benchOpts *o = &g_opts;
+    double dgramMs = TS_PER_DGRAM * TS_SIZE * 8 / (o->mbps * 1000);
+    int psiEvery = PSI_PERIOD_MS / dgramMs > 1 ? PSI_PERIOD_MS / dgramMs : 1;
+    int pcrEvery = PCR_PERIOD_MS / dgramMs > 1 ? PCR_PERIOD_MS / dgramMs : 1;
+    uint8_t *ts = out + (o->udp ? 0 : RTP_HDR);
+    unsigned long long n = ch->dgrams++;
+    int nullAt = -1;
+
+    if (!o->udp)
+    {
+        uint32_t rtpTs = (uint32_t)(n * dgramMs * 90);
+        out[0] = 0x80;
+        out[1] = 33;
+        out[2] = ch->rtpSeq >> 8;
+        out[3] = ch->rtpSeq & 0xff;
+        out[4] = rtpTs >> 24;
+        out[5] = rtpTs >> 16;
+        out[6] = rtpTs >> 8;
+        out[7] = rtpTs;
+        memcpy(out + 8, "LMTB", 4);
+        ch->rtpSeq++;
+    }
+
+    if (g_faults && o->pmtPeriod > 0 && n > 0 && n % (unsigned long long)(o->pmtPeriod * 1000 / dgramMs) == 0)
+    {
+        ch->pmtVersion = (ch->pmtVersion + 1) & 0x1f;
+        ch->audioPid = ch->audioPid == AUDIO_PID ? AUDIO_PID + 1 : AUDIO_PID;
+        makePmt(ch);
+        ch->truth.pmtChanges++;
+    }
+    if (g_faults && chance(&snd->rnd, o->ccPct))
+    {
+        nullAt = TS_PER_DGRAM - 2;
+        ch->truth.ccFaults++;
+    }
+
+    for (int i = 0; i < TS_PER_DGRAM; ++i)
+    {
+        uint8_t *p = ts + i * TS_SIZE;
+        bool psi = n % psiEvery == 0;
+
+        if (psi && i == 0)
+        {
+            uint8_t pat[] = { 0x00, 0xb0, 13, 0x00, 0x01, 0xc1, 0, 0, 0x00, 0x01, 0xe0 | (PMT_PID >> 8), PMT_PID & 0xff };
+            psiPacket(p, PAT_PID, pat, sizeof(pat));
+            p[3] = 0x10 | ch->cc[0]++;
+            ch->cc[0] &= 0x0f;
+        }
+        else if (psi && i == 1)
+        {
+            memcpy(p, ch->pmt, TS_SIZE);
+            p[3] = 0x10 | ch->cc[1]++;
+            ch->cc[1] &= 0x0f;
+        }
+        else if (i == nullAt)
+        {
+            /* takes the last video packet's place, so the next video packet skips a counter */
+            p[0] = 0x47;
+            p[1] = NULL_PID >> 8;
+            p[2] = NULL_PID & 0xff;
+            p[3] = 0x10;
+            memset(p + 4, 0xff, TS_SIZE - 4);
+            ch->cc[2] = (ch->cc[2] + 1) & 0x0f;
+        }
+        else if (i < TS_PER_DGRAM - 1)
+        {
+            p[0] = 0x47;
+            p[1] = VIDEO_PID >> 8;
+            p[2] = VIDEO_PID & 0xff;
+            if (i == 2 && n % pcrEvery == 0)
+            {
+                uint64_t base = (uint64_t)(n * dgramMs * 90) & ((1ULL << 33) - 1);
+                p[3] = 0x30 | ch->cc[2];
+                p[4] = 7;
+                p[5] = 0x10;
+                p[6] = base >> 25;
+                p[7] = base >> 17;
+                p[8] = base >> 9;
+                p[9] = base >> 1;
+                p[10] = ((base & 1) << 7) | 0x7e;
+                p[11] = 0;
+                memset(p + 12, 0xff, TS_SIZE - 12);
+            }
+            else
+            {
+                p[3] = 0x10 | ch->cc[2];
+                memset(p + 4, 0xff, TS_SIZE - 4);
+            }
+            ch->cc[2] = (ch->cc[2] + 1) & 0x0f;
+        }
+        else
+        {
+            /* each audio PID keeps its own counter, so a PMT change alone is no CC error */
+            uint8_t *cc = &ch->cc[simIndex(ch->audioPid)];
+            p[0] = 0x47;
+            p[1] = ch->audioPid >> 8;
+            p[2] = ch->audioPid & 0xff;
+            p[3] = 0x10 | *cc;
+            memset(p + 4, 0xff, TS_SIZE - 4);
+            *cc = (*cc + 1) & 0x0f;
+        }
+    }
+    return (o->udp ? 0 : RTP_HDR) + TS_PER_DGRAM * TS_SIZE;
+}
+
+void flush(benchSender *snd, struct mmsghdr *msgs, int *cnt)
+{
+    int done = 0;
+
+    while (done < *cnt)
+    {
+        int n = sendmmsg(snd->sok, msgs + done, *cnt - done, 0);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            snd->sendErrors += *cnt - done;
+            break;
+        }
+        for (int i = done; i < done + n; ++i)
+            snd->bytes += msgs[i].msg_len;
+        snd->sent += n;
+        done += n;
+    }
+    *cnt = 0;
+}
+
+void *senderLoop(void *arg)
+{
+    benchSender *snd = (benchSender*)arg;
+    static __thread uint8_t bufs[SEND_BATCH][DGRAM_MAX];
+    struct mmsghdr msgs[SEND_BATCH];
+    struct iovec iov[SEND_BATCH];
+    double perTick = g_opts.mbps * 1e6 / 8 * TICK_NS / 1e9;
+    int dgramBytes = (g_opts.udp ? 0 : RTP_HDR) + TS_PER_DGRAM * TS_SIZE;
+    long long due = monoNs();
+    int cnt = 0;
+
+    memset(msgs, 0, sizeof(msgs));
+    while (!g_stop)
+    {
+        for (int c = 0; c < snd->chanCnt; ++c)
+        {
+            benchChan *ch = &snd->chans[c];
+            ch->credit += perTick;
+            if (ch->credit > 50.0 * dgramBytes)
+                ch->credit = 50.0 * dgramBytes;     /* don't burst after a stall */
+
+            for (; ch->credit >= dgramBytes; ch->credit -= dgramBytes)
+            {
+                uint8_t *buf = bufs[cnt];
+                int len = buildDgram(snd, ch, buf);
+                uint8_t *ts = buf + (g_opts.udp ? 0 : RTP_HDR);
+
+                if (g_faults && chance(&snd->rnd, g_opts.lossPct))
+                {
+                    ch->truth.lost++;
+                    continue;
+                }
+                if (!ch->holding && g_faults && chance(&snd->rnd, g_opts.reorderPct))
+                {
+                    memcpy(ch->hold, buf, len);
+                    ch->holdLen = len;
+                    ch->holding = true;
+                    ch->truth.reordered++;
+                    continue;
+                }
+                simDeliver(ch, ts, TS_PER_DGRAM);
+                iov[cnt].iov_base = buf;
+                iov[cnt].iov_len = len;
+                msgs[cnt].msg_hdr.msg_iov = &iov[cnt];
+                msgs[cnt].msg_hdr.msg_iovlen = 1;
+                msgs[cnt].msg_hdr.msg_name = &ch->dst;
+                msgs[cnt].msg_hdr.msg_namelen = sizeof(ch->dst);
+                if (++cnt == SEND_BATCH)
+                    flush(snd, msgs, &cnt);
+
+                if (ch->holding)
+                {
+                    memcpy(bufs[cnt], ch->hold, ch->holdLen);
+                    simDeliver(ch, bufs[cnt] + (g_opts.udp ? 0 : RTP_HDR), TS_PER_DGRAM);
+                    iov[cnt].iov_base = bufs[cnt];
+                    iov[cnt].iov_len = ch->holdLen;
+                    msgs[cnt].msg_hdr.msg_iov = &iov[cnt];
+                    msgs[cnt].msg_hdr.msg_iovlen = 1;
+                    msgs[cnt].msg_hdr.msg_name = &ch->dst;
+                    msgs[cnt].msg_hdr.msg_namelen = sizeof(ch->dst);
+                    ch->holding = false;
+                    if (++cnt == SEND_BATCH)
+                        flush(snd, msgs, &cnt);
+                }
+            }
+        }
+        flush(snd, msgs, &cnt);
+
+        due += TICK_NS;
+        struct timespec ts = { .tv_sec = due / 1000000000LL, .tv_nsec = due % 1000000000LL };
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+    return NULL;
+}
+
+int openSender(void)
+{
+    int sok = socket(AF_INET, SOCK_DGRAM, 0);
+    struct in_addr ifAddr = { .s_addr = inet_addr(g_opts.ifAddr) };
+    unsigned char loop = 1, ttl = 1;
+    int sndbuf = 4 * 1024 * 1024;
+
+    if (sok < 0)
+        return -1;
+    setsockopt(sok, IPPROTO_IP, IP_MULTICAST_IF, &ifAddr, sizeof(ifAddr));
+    setsockopt(sok, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+    setsockopt(sok, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    setsockopt(sok, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    return sok;
+}
+
+/* utime + stime of a process in seconds */
+double procCpu(pid_t pid)
+{
+    char path[64], buf[1024];
+    unsigned long utime, stime;
+    FILE *f;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    if (!(f = fopen(path, "r")))
+        return 0;
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+    char *p = strrchr(buf, ')');
+    if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+        return 0;
+    return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+/* Drops of all UDP sockets bound to the bench's ports */
+unsigned long long socketDrops(void)
+{
+    char line[512];
+    unsigned long long drops = 0;
+    FILE *f = fopen("/proc/net/udp", "r");
+
+    if (!f)
+        return 0;
+    while (fgets(line, sizeof(line), f))
+    {
+        unsigned int port;
+        unsigned long long d;
+        char *last = strrchr(line, ' ');
+        if (sscanf(line, " %*d: %*8s:%4x", &port) != 1 || !last)
+            continue;
+        if ((int)port >= g_opts.port && (int)port < g_opts.port + g_opts.channels && sscanf(last, "%llu", &d) == 1)
+            drops += d;
+    }
+    fclose(f);
+    return drops;
+}
+
+static inline int chanPort(int i)
+{
+    return g_opts.onePort ? g_opts.port : g_opts.port + i;
+}
+
+int writeConfig(const char *path, const char *stats)
+{
+    FILE *f = fopen(path, "w");
+    if (!f)
+        return -1;
+    fprintf(f, "outputFolder = \"/tmp\";\nlogToFile = false;\nlogToStdout = false;\n");
+    fprintf(f, "workers = %d;\ncapture = \"%s\";\nstats = \"%s\";\n", g_opts.workers, g_opts.capture, stats);
+    fprintf(f, "configs = (\n");
+    for (int i = 0; i < g_opts.channels; ++i)
+    {
+        struct in_addr a = { .s_addr = htonl(ntohl(g_opts.group.s_addr) + i) };
+        fprintf(f, "\t{id = %d; mcastip = \"%s\"; port = %d; sid = 0; interface = \"%s\";}%s\n", i + 1, inet_ntoa(a),
+            chanPort(i), g_opts.ifAddr, i + 1 < g_opts.channels ? "," : "");
+    }
+    fprintf(f, ");\n");
+    fclose(f);
+    return 0;
+}
+
+const lmtStatsHdr *attachStats(const char *name, pid_t child)
+{
+    for (int tries = 0; tries < 100; ++tries)
+    {
+        int fd = shm_open(name, O_RDONLY, 0);
+        struct stat st;
+        if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(lmtStatsHdr))
+        {
+            const lmtStatsHdr *hdr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            close(fd);
+            if (hdr != MAP_FAILED && __atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) == LMT_STATS_MAGIC
+                && hdr->writerPid == child && hdr->chanCount == (uint32_t)g_opts.channels)
+                return hdr;
+        }
+        else if (fd >= 0)
+            close(fd);
+        if (waitpid(child, NULL, WNOHANG) == child)
+            return NULL;
+        usleep(50000);
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    char cfgPath[64], stats[64];
+    int opt;
+
+    inet_aton("239.255.1.1", &g_opts.group);
+    while ((opt = getopt(argc, argv, "n:r:t:ul:o:e:p:j:w:m:d:g:P:sh")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n': g_opts.channels = atoi(optarg); break;
+            case 'r': g_opts.mbps = atof(optarg); break;
+            case 't': g_opts.seconds = atoi(optarg); break;
+            case 'u': g_opts.udp = true; break;
+            case 'l': g_opts.lossPct = atof(optarg); break;
+            case 'o': g_opts.reorderPct = atof(optarg); break;
+            case 'e': g_opts.ccPct = atof(optarg); break;
+            case 'p': g_opts.pmtPeriod = atoi(optarg); break;
+            case 'j': g_opts.senders = atoi(optarg); break;
+            case 'w': g_opts.workers = atoi(optarg); break;
+            case 'm': g_opts.capture = optarg; break;
+            case 'd': g_opts.discont = optarg; break;
+            case 'g':
+                if (!inet_aton(optarg, &g_opts.group))
+                    usage(argv[0]);
+                break;
+            case 'P': g_opts.port = atoi(optarg); break;
+            case 's': g_opts.onePort = true; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (g_opts.channels < 1 || g_opts.mbps <= 0 || g_opts.seconds < 1 || g_opts.senders < 1 || optind != argc)
+        usage(argv[0]);
+    if (g_opts.senders > g_opts.channels)
+        g_opts.senders = g_opts.channels;
+
+    crcInit();
+    snprintf(cfgPath, sizeof(cfgPath), "/tmp/discont-bench-%d.cfg", (int)getpid());
+    snprintf(stats, sizeof(stats), "/discont-bench-%d", (int)getpid());
+    if (writeConfig(cfgPath, stats) < 0)
+    {
+        fprintf(stderr, "%s: %s\n", cfgPath, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    pid_t child = fork();
+    if (child == 0)
+    {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        execl(g_opts.discont, g_opts.discont, "-c", cfgPath, (char*)NULL);
+        fprintf(stderr, "%s: %s\n", g_opts.discont, strerror(errno));
+        _exit(127);
+    }
+    const lmtStatsHdr *hdr = attachStats(stats, child);
+    if (!hdr)
+    {
+        fprintf(stderr, "discont didn't come up with its stats segment\n");
+        kill(child, SIGKILL);
+        unlink(cfgPath);
+        return EXIT_FAILURE;
+    }
+
+    benchChan *chans = calloc(g_opts.channels, sizeof(benchChan));
+    benchSender *snds = calloc(g_opts.senders, sizeof(benchSender));
+    for (int i = 0; i < g_opts.channels; ++i)
+    {
+        benchChan *ch = &chans[i];
+        ch->dst.sin_family = AF_INET;
+        ch->dst.sin_addr.s_addr = htonl(ntohl(g_opts.group.s_addr) + i);
+        ch->dst.sin_port = htons(chanPort(i));
+        ch->audioPid = AUDIO_PID;
+        ch->rtpSeq = i * 1000;
+        memset(ch->simCc, -1, sizeof(ch->simCc));
+        makePmt(ch);
+    }
+    for (int s = 0, first = 0; s < g_opts.senders; ++s)
+    {
+        int cnt = g_opts.channels / g_opts.senders + (s < g_opts.channels % g_opts.senders);
+        snds[s].chans = chans + first;
+        snds[s].chanCnt = cnt;
+        snds[s].rnd = 0x9e3779b97f4a7c15ULL * (s + 1);
+        snds[s].sok = openSender();
+        first += cnt;
+        pthread_create(&snds[s].thread, NULL, senderLoop, &snds[s]);
+    }
+
+    /* a second to settle, then the measured run, then the clean tail */
+    sleep(1);
+    double cpu0 = procCpu(child);
+    unsigned long long drops0 = socketDrops();
+    long long t0 = monoNs();
+    unsigned long long bytes0 = 0;
+    for (int s = 0; s < g_opts.senders; ++s)
+        bytes0 += snds[s].bytes;
+
+    sleep(g_opts.seconds);
+
+    double cpu1 = procCpu(child);
+    unsigned long long drops1 = socketDrops();
+    long long t1 = monoNs();
+    unsigned long long bytes1 = 0, sent = 0, sendErrors = 0;
+    for (int s = 0; s < g_opts.senders; ++s)
+        bytes1 += snds[s].bytes;
+
+    g_faults = false;
+    usleep(COOLDOWN_MS * 1000);
+    g_stop = true;
+    for (int s = 0; s < g_opts.senders; ++s)
+    {
+        pthread_join(snds[s].thread, NULL);
+        sent += snds[s].sent;
+        sendErrors += snds[s].sendErrors;
+    }
+
+    /* compare */
+    benchTruth want = { 0 };
+    unsigned long long seenCc = 0, seenLost = 0, seenPmt = 0, seenReordered = 0;
+    int badChans = 0, deadChans = 0;
+    for (int i = 0; i < g_opts.channels; ++i)
+    {
+        lmtStatRec rec;
+        lmtStatsRead(hdr, i, &rec);
+        benchTruth *t = &chans[i].truth;
+        want.lost += t->lost;
+        want.reordered += t->reordered;
+        want.ccFaults += t->ccFaults;
+        want.ccExpected += t->ccExpected;
+        want.pmtChanges += t->pmtChanges;
+        seenCc += rec.tr[TR_CC];
+        seenLost += rec.rtpLost;
+        seenReordered += rec.rtpReordered;
+        seenPmt += rec.pmtChanges;
+        if (!rec.isStream)
+            deadChans++;
+        if (rec.tr[TR_CC] != t->ccExpected || rec.pmtChanges != t->pmtChanges || (!g_opts.udp && (rec.rtpLost != t->lost || rec.rtpReordered != t->reordered)))
+            badChans++;
+    }
+    double secs = (t1 - t0) / 1e9;
+    double cores = (cpu1 - cpu0) / secs;
+    double mbps = (bytes1 - bytes0) * 8 / secs / 1e6;
+    unsigned long long drops = drops1 - drops0;
+
+    printf("channels:  %d x %.2f Mbit/s %s%s, %d sender thread%s, discont workers = %d, capture = %s\n", g_opts.channels, g_opts.mbps,
+        g_opts.udp ? "UDP" : "RTP", g_opts.onePort ? " on one port" : "", g_opts.senders, g_opts.senders > 1 ? "s" : "", g_opts.workers, g_opts.capture);
+    printf("sent:      %llu datagrams, %.1f Mbit/s over the measured %.1f s, %llu send errors\n", sent, mbps, secs, sendErrors);
+    printf("discont:   %.1f%% of a core, %.3f%% of a core per Mbit/s, ~%.0f channels per core at this rate%s\n", cores * 100,
+        mbps > 0 ? cores * 100 / mbps : 0, cores > 0 ? g_opts.channels / cores : 0, drops ? " (dropping, so saturated)" : "");
+    printf("drops:     %llu datagrams dropped by discont's sockets\n", drops);
+    printf("detection: CC errors %llu of %llu (%llu nulled packets, %llu lost and %llu swapped datagrams)\n", seenCc, want.ccExpected,
+        want.ccFaults, want.lost, want.reordered);
+    if (!g_opts.udp)
+    {
+        printf("           RTP lost %llu of %llu datagrams\n", seenLost, want.lost);
+        printf("           RTP reordered %llu of %llu datagrams\n", seenReordered, want.reordered);
+    }
+    printf("           PMT changes %llu of %llu\n", seenPmt, want.pmtChanges);
+    printf("           %d channels off, %d with no data\n", badChans, deadChans);
+
+    kill(child, SIGTERM);
+    waitpid(child, NULL, 0);
+    shm_unlink(stats);
+    unlink(cfgPath);
+    return (badChans || deadChans || drops) ? 2 : 0;
+}
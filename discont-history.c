@@ -0,0 +1,184 @@
+/*
+ * discont-history: prints a channel's history file, see lmthistory.h.
+ * The 1, 15 and 60 minute windows come from the file's running sums, a range
+ * of seconds is added up here. Reads the mapping only, discont keeps writing.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "lmthistory.h"
+
+void usage(const char *progname)
+{
+    printf("usage: %s [-n seconds] [-e end] [-s] file.hist...\n", progname);
+    printf("  file.hist: <outputFolder>/<id>.hist of discont.cfg\n");
+    printf("  -n: the seconds up to end, one line each, and their totals\n");
+    printf("  -e: unix second the range ends at, negative for that many seconds before the newest one\n");
+    printf("  -s: the totals of the range only, no line per second\n");
+}
+
+const lmtHistoryHdr *lmtHistoryAttach(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+
+    if (fd < 0)
+    {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(lmtHistoryHdr))
+    {
+        fprintf(stderr, "%s: not a history file\n", path);
+        close(fd);
+        return NULL;
+    }
+    const lmtHistoryHdr *hdr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (hdr == MAP_FAILED)
+    {
+        fprintf(stderr, "%s: mmap: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != LMT_HISTORY_MAGIC || hdr->version != LMT_HISTORY_VERSION || !hdr->slots
+        || (off_t)hdr->hdrSize + (off_t)hdr->slots * hdr->recSize > st.st_size)
+    {
+        fprintf(stderr, "%s: not a version %d history file\n", path, LMT_HISTORY_VERSION);
+        return NULL;
+    }
+    return hdr;
+}
+
+void lmtPrintSum(const char *what, const lmtHistorySum *sum)
+{
+    printf("%-8s %6u/%-6u %8.2f %8llu %8llu %7u %6u\n", what, sum->present, sum->window,
+        sum->present ? sum->kbps / 1e3 / sum->present : 0.0, (unsigned long long)sum->ccErrors,
+        (unsigned long long)sum->rtpLost, sum->errored, sum->pcrDisc);
+}
+
+void lmtPrintSec(const lmtHistoryRec *rec)
+{
+    time_t t = rec->sec;
+    char when[32];
+
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&t));
+    if (!(rec->flags & LMT_HIST_PRESENT))
+    {
+        printf("%s  -\n", when);
+        return;
+    }
+    printf("%s  %8.2f %6u %6u %8.0f %7.1f %7.1f %3s %3s %3s %3s %4u %#6x\n", when, rec->bitrateKbps / 1e3, rec->ccErrors, rec->rtpLost,
+        rec->pcrJitterP99Us, rec->mdiDf, rec->mdiMlr, rec->flags & LMT_HIST_RTP ? "RTP" : "UDP", rec->flags & LMT_HIST_PAT ? "PAT" : "-",
+        rec->flags & LMT_HIST_PMT ? "PMT" : "-", rec->flags & LMT_HIST_PCR ? "PCR" : "-", rec->pcrDisc, rec->trActive);
+}
+
+int lmtPrintHistory(const char *path, uint32_t cnt, long long end, bool summary)
+{
+    const lmtHistoryHdr *hdr = lmtHistoryAttach(path);
+    lmtHistorySum sums[LMT_HISTORY_WINDOWS];
+    lmtHistoryRec *recs = NULL;
+
+    if (!hdr)
+        return -1;
+    if (cnt > hdr->slots)
+        cnt = hdr->slots;
+    if (cnt && !(recs = calloc(cnt, sizeof(lmtHistoryRec))))
+    {
+        fprintf(stderr, "%s: out of memory\n", path);
+        return -1;
+    }
+
+    uint32_t lastSec = lmtHistoryRead(hdr, sums, 0, 0, NULL);
+    uint32_t last = end > 0 ? (uint32_t)end : lastSec + end;
+    if (cnt)
+        lmtHistoryRead(hdr, NULL, last, cnt, recs);
+
+    struct in_addr addr = {.s_addr = hdr->mcastAddr};
+    time_t t = lastSec;
+    char when[32];
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&t));
+    printf("id %d, %s:%hu, %u s kept, newest %s (%lld s ago)\n", hdr->id, inet_ntoa(addr), hdr->port, hdr->slots,
+        lastSec ? when : "-", lastSec ? (long long)time(NULL) - lastSec : 0);
+    printf("%-8s %13s %8s %8s %8s %7s %6s\n", "window", "present s", "Mbit/s", "CC err", "RTP lost", "err s", "PCR d");
+    for (int w = 0; w < LMT_HISTORY_WINDOWS; ++w)
+    {
+        char what[16];
+        snprintf(what, sizeof(what), "%u min", sums[w].window / 60);
+        lmtPrintSum(what, &sums[w]);
+    }
+
+    if (cnt)
+    {
+        lmtHistorySum range = {.window = cnt};
+        for (uint32_t i = 0; i < cnt; ++i)
+        {
+            range.present += recs[i].flags & LMT_HIST_PRESENT ? 1 : 0;
+            range.errored += recs[i].ccErrors || recs[i].rtpLost ? 1 : 0;
+            range.pcrDisc += recs[i].pcrDisc;
+            range.ccErrors += recs[i].ccErrors;
+            range.rtpLost += recs[i].rtpLost;
+            range.kbps += recs[i].bitrateKbps;
+        }
+        lmtPrintSum("range", &range);
+        if (!summary)
+        {
+            printf("\n%-19s  %8s %6s %6s %8s %7s %7s %3s %3s %3s %3s %4s %6s\n", "second", "Mbit/s", "CC", "lost", "PCR p99", "MDI DF",
+                "MLR", "", "", "", "", "PCRd", "TR");
+            for (uint32_t i = 0; i < cnt; ++i)
+                lmtPrintSec(&recs[i]);
+        }
+    }
+    free(recs);
+    munmap((void *)hdr, hdr->hdrSize + (size_t)hdr->slots * hdr->recSize);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    long long end = 0;
+    int cnt = 0, opt, ret = EXIT_SUCCESS;
+    bool summary = false;
+
+    while ((opt = getopt(argc, argv, "n:e:sh")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                cnt = atoi(optarg);
+                break;
+            case 'e':
+                end = atoll(optarg);
+                break;
+            case 's':
+                summary = true;
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind >= argc || cnt < 0)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    for (int i = optind; i < argc; ++i)
+    {
+        if (i > optind)
+            printf("\n");
+        if (lmtPrintHistory(argv[i], cnt, end, summary) < 0)
+            ret = EXIT_FAILURE;
+    }
+    return ret;
+}
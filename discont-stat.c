@@ -0,0 +1,180 @@
+/*
+ * discont-stat: prints the stats segment of a running discont, see lmtstats.h.
+ * Reads the mapping only, so it can poll as often as it likes.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "lmtstats.h"
+
+static const char *g_streamTypes[] = {"-", "UDP", "RTP", "Error"};
+
+static const char *g_alarmNames[ALARM_STATES] = {"no_data", "pat_missing", "pmt_missing", "cc_errors", "bitrate"};
+
+static const char *g_trNames[] =
+    {
+    "sync_loss", "sync_byte", "PAT", "CC", "PMT", "PID",
+    "transport", "CRC", "PCR_rep", "PCR_disc", "PTS"
+    };
+
+void usage(const char *progname)
+{
+    printf("usage: %s [-w seconds] [-i id] [-v] segment\n", progname);
+    printf("  segment: the \"stats\" setting of discont.cfg, /name for shared memory or a file path\n");
+    printf("  -w: print again every so many seconds\n");
+    printf("  -i: only this channel id\n");
+    printf("  -v: PIDs, audio tracks and TR 101 290 counters too\n");
+}
+
+const lmtStatsHdr *lmtStatsAttach(const char *name)
+{
+    bool isShm = name[0] == '/' && !strchr(name + 1, '/');
+    int fd = isShm ? shm_open(name, O_RDONLY, 0) : open(name, O_RDONLY);
+    struct stat st;
+
+    if (fd < 0)
+    {
+        fprintf(stderr, "%s: %s\n", name, strerror(errno));
+        return NULL;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(lmtStatsHdr))
+    {
+        fprintf(stderr, "%s: not a stats segment\n", name);
+        close(fd);
+        return NULL;
+    }
+    const lmtStatsHdr *hdr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (hdr == MAP_FAILED)
+    {
+        fprintf(stderr, "%s: mmap: %s\n", name, strerror(errno));
+        return NULL;
+    }
+    if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != LMT_STATS_MAGIC || hdr->version != LMT_STATS_VERSION
+        || (off_t)hdr->hdrSize + (off_t)hdr->chanCount * hdr->recSize > st.st_size)
+    {
+        fprintf(stderr, "%s: not a version %d stats segment\n", name, LMT_STATS_VERSION);
+        return NULL;
+    }
+    return hdr;
+}
+
+void lmtPrintRec(const lmtStatRec *rec, bool verbose, long long now)
+{
+    struct in_addr addr = {.s_addr = rec->mcastAddr};
+    char group[32];
+    double age = rec->updated ? (now - rec->updated) / 1e9 : -1;
+
+    snprintf(group, sizeof(group), "%s:%hu", inet_ntoa(addr), rec->port);
+    printf("%6d %-21s %-5s %3s %8.2f %7.1f:%-6.1f %6u %5hu %5hu %5hu %-12s %7.1f %s\n", rec->id, group, g_streamTypes[rec->streamType & 3],
+        rec->isStream ? "yes" : "no", rec->bitrate, rec->mdiDf, rec->mdiMlr, rec->oneMinuteCC, rec->sid, rec->pmtPid, rec->vPid,
+        rec->vFormat[0] ? rec->vFormat : "-", age, rec->trActive || rec->alarms ? "ALARM" : "");
+
+    if (!verbose)
+        return;
+
+    printf("       PAT v%d (%u changes) PMT v%d (%u changes) PCR %hu jitter p99 %.0f us drift %.1f ppm, TS %hu bytes\n",
+        rec->patVersion, rec->patChanges, rec->pmtVersion, rec->pmtChanges, rec->pcrPid, rec->pcrJitterP99Us, rec->pcrDriftPpm, rec->tsPacketSize);
+    for (int i = 0; i < rec->aPidCnt && i < LMT_STATS_MAX_APIDS; ++i)
+        printf("       audio %hu %s\n", rec->aPids[i], rec->aFormat[i]);
+    printf("       Mbit/s avg %.3f, null %.3f\n", rec->bitrateAvg, rec->nullBitrate);
+    printf("       PID Mbit/s/CC errors:");
+    for (int i = 0; i < rec->pidCnt && i < LMT_STATS_MAX_PIDS; ++i)
+        printf(" %hu:%.3f/%u", rec->pids[i].pid, rec->pidMbps[i], rec->pids[i].ccErrors);
+    printf("\n       probe: kernel drops %llu, truncated %llu, rcvbuf %d, parse p99 %u ns, queue p99 %u us, rx cpu/napi %d/%u, parse cpu %d",
+        (unsigned long long)rec->kernelDrops, (unsigned long long)rec->truncated, rec->rcvbuf, rec->parseP99Ns, rec->queueP99Us,
+        rec->rxCpu, rec->napiId, rec->parseCpu);
+    if (rec->streamType == LMT_STREAM_RTP)
+        printf("\n       RTP: lost %llu, reordered %llu, late %llu, duplicates %llu, jitter %.0f us, FEC recoverable/unrecoverable %llu/%llu",
+            (unsigned long long)rec->rtpLost, (unsigned long long)rec->rtpReordered, (unsigned long long)rec->rtpLate,
+            (unsigned long long)rec->rtpDuplicates, rec->rtpJitterUs, (unsigned long long)rec->fecRecoverable,
+            (unsigned long long)rec->fecUnrecoverable);
+    for (int i = 0; i < rec->serviceCnt && i < LMT_STATS_MAX_SERVICES; ++i)
+    {
+        const lmtStatService *svc = &rec->services[i];
+        printf("\n       program %hu: PMT %hu v%d (%u changes), PCR %hu, video %hu, %u streams, %.3f Mbit/s, %u CC errors%s", svc->sid,
+            svc->pmtPid, svc->pmtVersion, svc->pmtChanges, svc->pcrPid, svc->vPid, svc->esCnt, svc->mbps, svc->ccErrors,
+            svc->present ? "" : ", no data");
+    }
+    printf("\n       alarms:");
+    for (int i = 0; i < ALARM_STATES; ++i)
+    {
+        if (rec->alarms & (1u << i))
+            printf(" %s", g_alarmNames[i]);
+    }
+    printf("%s", rec->alarms ? "" : " -");
+    printf("\n       TR 101 290:");
+    for (unsigned int i = 0; i < sizeof(g_trNames) / sizeof(g_trNames[0]); ++i)
+        printf(" %s:%u%s", g_trNames[i], rec->tr[i], (rec->trActive & (1u << i)) ? "*" : "");
+    printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int wait = 0, onlyId = 0, opt;
+    bool verbose = false, filter = false;
+
+    while ((opt = getopt(argc, argv, "w:i:vh")) != -1)
+    {
+        switch (opt)
+        {
+            case 'w':
+                wait = atoi(optarg);
+                break;
+            case 'i':
+                onlyId = atoi(optarg);
+                filter = true;
+                break;
+            case 'v':
+                verbose = true;
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 1)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const lmtStatsHdr *hdr = lmtStatsAttach(argv[optind]);
+    if (!hdr)
+        return EXIT_FAILURE;
+
+    do
+    {
+        struct timespec ts;
+        lmtStatRec rec;
+
+        clock_gettime(CLOCK_REALTIME, &ts);
+        printf("%6s %-21s %-5s %3s %8s %14s %6s %5s %5s %5s %-12s %7s\n", "id", "group", "type", "on", "Mbit/s", "MDI DF:MLR", "CC/min",
+            "sid", "pmt", "vpid", "vformat", "age s");
+        for (uint32_t i = 0; i < hdr->chanCount; ++i)
+        {
+            lmtStatsRead(hdr, i, &rec);
+            if (!rec.mcastAddr || (filter && rec.id != onlyId))
+                continue;       /* a free slot, or not the one asked for */
+            lmtPrintRec(&rec, verbose, (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec);
+        }
+        if (wait > 0)
+        {
+            printf("\n");
+            fflush(stdout);
+            sleep(wait);
+        }
+    } while (wait > 0);
+
+    return EXIT_SUCCESS;
+}
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -14,6 +15,32 @@
 #include <time.h>
 #include <ctype.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <sys/file.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <spawn.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <signal.h>
+#include <poll.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <linux/filter.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "lmtstats.h"
+#include "lmthistory.h"
 
 #define BUF_SIZE (32 * 1024)
 #define DEFAULT_CONFIG_FILENAME "discont.cfg"
@@ -22,13 +49,94 @@
 #define DEFAULT_LOG_FILE "discont.err"
 #define MAX_APIDS 10
 #define VERSION 1.0
-
-static char g_buffer[512];
+#define DEFAULT_BATCH_SIZE 32
+#define MAX_BATCH_SIZE 1024
+#define DGRAM_SLOT_SIZE 2048
+#define TIMER_WHEEL_SLOTS 64 /* power of two */
+#define TIMER_TICK_MS 100
+#define READ_TIMEOUT_TICKS (READ_TIMEOUT * 1000 / TIMER_TICK_MS)
+#define WORKER_MAX_EVENTS 64
+#define WORKER_MAX_READS 8 /* batches per readiness event before yielding to other channels */
+#define CAPTURE_BLOCK_SIZE (1 << 20)
+#define CAPTURE_BLOCK_NR 64
+#define CAPTURE_FRAME_SIZE 2048
+#define CAPTURE_BLOCK_TOV_MS 10
+#define LOG_RING_SIZE 1024 /* records per thread, power of two */
+#define LOG_LINE_SIZE 512
+#define LOG_BATCH_SIZE (64 * 1024)
+#define LOG_FLUSH_MS 20
+#define LOG_FILE_NAME "discont.log"
+#define TS_PID_COUNT 8192
+#define TS_NULL_PID 0x1FFF
+#define PID_SEEN 0x80
+#define PID_DUP 0x40
+#define SNAP_MAX_PIDS 32
+#define PSI_MAX_SECTION 1024
+#define TS_SIZE 188
+#define TS_SIZE_FEC 204
+#define TS_MAX_PER_DGRAM 64
+#define TS_FLAG_SYNC_ERR 0x01
+#define TS_FLAG_TEI 0x80
+#define TS_FLAG_PUSI 0x40
+#define DGRAM_CTRL_SIZE 128 /* receive timestamp, drop counter and IP_PKTINFO */
+#define HIST_SUB_BITS 3
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS 512
+#define PCR_WRAP (((uint64_t)1 << 33) * 300)
+#define PCR_MAX_GAP (27000000LL / 10) /* 100 ms, anything longer is a discontinuity */
+#define MDI_MINUTE 60
+#define TS_PER_DGRAM 7
+#define REPORT_PERIOD_MS 2000
+#define PCAPNG_MAX_IFS 16
+#define LINKTYPE_NULL 0
+#define LINKTYPE_ETHERNET 1
+#define LINKTYPE_RAW 101
+#define LINKTYPE_LINUX_SLL 113
+#define LINKTYPE_IPV4 228
+#define LINKTYPE_LINUX_SLL2 276
+#define HTTP_MAX_CONNS 8
+#define HTTP_REQ_SIZE 2048
+#define HTTP_OUT_SIZE (64 * 1024)
+#define HTTP_HDR_ROOM 256
+#define HTTP_TIMEOUT_TICKS 50
+#define TR_SLOT_PAT 1
+#define TR_SLOT_PMT 2
+#define TR_MAX_WATCH (TR_SLOT_PMT + 2 + MAX_APIDS)
+#define TR_PSI_TIMEOUT_NS 500000000LL
+#define TR_PID_TIMEOUT_NS 5000000000LL
+#define TR_PTS_TIMEOUT_NS 700000000LL
+#define TR_PCR_REP_NS 40000000LL
+#define TR_RECHECK_NS 100000000LL
+#define PCR_DRIFT_MIN_NS 5000000000LL /* drift is not reported off less than 5 s of PCRs */
+#define PSI_MAX_SECTIONS 8 /* sections per table remembered for the repeat check */
+#define PAT_MAX_PROGRAMS ((PSI_MAX_SECTION - 12) / 4) /* program loop entries one PAT section has room for */
+#define CAPTURE_STATS_TICKS 10
+#define METER_WINDOW_US 1000000
+#define STATS_SPARE_SLOTS 64 /* records beyond the configured channels for ones a reload adds */
+#define ADDR_SIZE 64
+#define SHARED_COALESCE_US 500 /* a shared socket is read at most this often, the kernel timestamps keep the timing exact */
+#define SHARED_MAX_GROUPS 20 /* net.ipv4.igmp_max_memberships when it can't be read */
+#define NODE_MAX 1024 /* NUMA nodes the mbind() mask has room for */
+#define METER_SMOOTH 0.25 /* weight of the newest window in the smoothed rates, ~4 s time constant */
+#define EVIDENCE_SNAP DGRAM_SLOT_SIZE /* bytes kept of a datagram, all a receive slot holds, so every capture replays */
+#define RTP_WINDOW 1024 /* sequence numbers remembered, power of two */
+#define RTP_REORDER 32 /* a datagram this far behind the newest one is lost, closer it is only reordered */
+#define RTP_FEC_DEPTH 512 /* a lost datagram is found recoverable or not this far behind, room for a 2022-1 matrix and its FEC */
+#define RTP_MAX_DROPOUT 3000 /* RFC 3550 A.1 */
+#define RTP_MAX_MISORDER 100
+#define RTP_CLOCK 90000 /* MP2T, RFC 3551 */
+#define FEC_HDR_SIZE 16 /* SMPTE 2022-1 FEC header, behind the RTP header */
+#define FEC_PORT_COL 2 /* column FEC on the media port + 2, row FEC on + 4 */
+#define FEC_PORT_ROW 4
+#define SERVICE_PMT 0x8000 /* lmtPidTable.svc: the PID carries the service's PMT */
+#define SERVICE_ES_PER 8 /* ES entries the service arena has room for per service when it is sized */
+#define SNAP_MAX_SERVICES LMT_STATS_MAX_SERVICES
+#define CONF_MAX_SIDS 64
+#define HISTORY_RETRIES 10 /* seconds to wait for a restarted channel's old parser to let go of its file */
 
 typedef struct lmtPidInfo
     {
     uint16_t pid;
-    int cc;
     const char* pFormat;
     } lmtPidInfo;
 
@@ -55,12 +163,25 @@ typedef struct RTP_Packet
     int payloadSize;
     } RTP_Packet;
 
+/* TS headers of one datagram, structure of arrays */
+typedef struct lmtTsBatch
+    {
+    const uint8_t *first;
+    int count;
+    int size;                   /* 188 or 204 */
+    bool isRtp;
+    uint16_t pid[TS_MAX_PER_DGRAM];
+    uint8_t ccAfc[TS_MAX_PER_DGRAM];    /* header byte 3 without the scrambling bits */
+    uint8_t flags[TS_MAX_PER_DGRAM];
+    } lmtTsBatch;
+
 typedef struct lmtChanInfo
     {   
         int sId;
         uint16_t sSid;
         uint16_t sPmt;
         int sPmtVer;
+        int sPatVer;
         lmtPidInfo sApid[MAX_APIDS];
         lmtPidInfo sVpid;
         uint16_t sPcr;
@@ -68,11 +189,477 @@ typedef struct lmtChanInfo
         bool pmtParsed;
         bool sPatParsed;
         int aPidCnt;
-        double sBitrate;
-        int cCerrors;
-        int cCArray[60];
+        double sBitrate;            /* Mbit/s of TS packets, last window */
+        double sBitrateAvg;         /* smoothed */
+        double sNullBitrate;        /* smoothed, PID 0x1FFF */
+        int cCerrors;               /* CC and RTP sequence errors of the window, see lmtHistorySecond() */
+        int tr[TR_COUNT];           /* TR 101 290 indicators since the channel (re)started */
+        unsigned int trActive;      /* 1 << indicator while the condition holds */
+        int tsPacketSize;
+        int patChanges;
+        int pmtChanges;
+        unsigned long long rtpLost;  /* datagrams still missing RTP_REORDER behind the newest sequence number */
     } lmtChanInfo;
 
+enum lmtLogEvent
+    {
+    LMT_EV_RTP_SEQ,
+    LMT_EV_CC,
+    LMT_EV_NOT_TS,
+    LMT_EV_RECV_ERR,
+    LMT_EV_CRC,
+    LMT_EV_COUNT
+    };
+
+typedef struct lmtLogRec
+    {
+    long long sec;
+    int chan;
+    int event;
+    int args[3];
+    } lmtLogRec;
+
+typedef struct lmtLogRing
+    {
+    unsigned int head;          /* written by the producing thread only */
+    unsigned int tail;          /* written by lmtLogLoop() only */
+    unsigned long long dropped;
+    unsigned long long reported;
+    struct lmtLogRing *next;
+    lmtLogRec recs[LOG_RING_SIZE];
+    } lmtLogRing;
+
+enum lmtAlarmState
+    {
+    ALARM_RAISED,
+    ALARM_CLEARED,
+    ALARM_EVENT
+    };
+
+/* The "alarms" settings and the sink, read once at start; the sink is the log thread's */
+typedef struct lmtAlarmConf
+    {
+    int raiseSecs;              /* a condition holds this long before it is raised */
+    int clearSecs;              /* and is gone this long before it clears */
+    int ccRaise;                /* CC errors in the last minute that raise ALARM_CC, 0 for never */
+    int ccClear;                /* at most this many clear it */
+    double hysteresis;          /* a raised bitrate alarm clears this fraction inside the range */
+    char *sink;                 /* the setting, for the warnings */
+    FILE *file;
+    int sock;
+    struct sockaddr_un addr;
+    char *hook;
+    bool failed;                /* the sink's last error was logged already */
+    } lmtAlarmConf;
+
+/* The "evidence" settings, the memory all the rings take and the writer's queue */
+typedef struct lmtEvidenceConf
+    {
+    bool all;                   /* every channel keeps a ring, not only the ones with evidence = true */
+    int pre;                    /* seconds before the trigger written */
+    int post;                   /* and after it */
+    int holdoff;                /* seconds after a trigger before the next one counts */
+    unsigned int triggers;      /* 1 << lmtEvidenceReason */
+    size_t channelBytes;
+    size_t totalBytes;
+    size_t used;                /* main thread only */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct thread_params *queue;
+    bool started;
+    } lmtEvidenceConf;
+
+typedef struct lmtTimer
+    {
+    struct lmtTimer *next;
+    struct lmtTimer *prev;
+    long long expires;          /* in ticks */
+    } lmtTimer;
+
+typedef struct lmtTimerWheel
+    {
+    lmtTimer slots[TIMER_WHEEL_SLOTS];
+    long long tick;
+    } lmtTimerWheel;
+
+typedef struct lmtPidStat
+    {
+    uint16_t pid;
+    uint32_t ccErrors;
+    float mbps;                 /* smoothed */
+    } lmtPidStat;
+
+/* Per PID state of the whole mux, indexed directly by the 13 bit PID */
+typedef struct lmtPidTable
+    {
+    uint8_t cc[TS_PID_COUNT];           /* PID_SEEN | PID_DUP | 0x10 | next expected counter */
+    uint32_t errors[TS_PID_COUNT];
+    uint16_t active[TS_PID_COUNT];
+    int activeCnt;
+    uint8_t watch[TS_PID_COUNT];        /* TR 101 290 slot of the PID, 0 if not watched */
+    uint16_t svc[TS_PID_COUNT];         /* service index + 1 of the PID, | SERVICE_PMT on PMT PIDs, 0 for none */
+    } lmtPidTable;
+
+/*
+ * Bitrate accounting of a channel. Bytes are the TS packets actually received, by PID.
+ * The window is closed off a coarse monotonic clock and measured from the kernel receive
+ * timestamps, so it costs no syscall per datagram and no precision either.
+ */
+typedef struct lmtMeter
+    {
+    long long start;                    /* coarse monotonic us the window opened, 0 before data */
+    long long lastArr;                  /* arrival of the latest datagram */
+    long long prevArr;                  /* arrival of the last datagram of the previous window */
+    long long bytes;
+    bool smoothed;                      /* false until the first window set the averages */
+    uint32_t pkts[TS_PID_COUNT];
+    float rate[TS_PID_COUNT];           /* Mbit/s, smoothed */
+    } lmtMeter;
+
+typedef struct lmtTrTimer
+    {
+    long long last;             /* arrival it was last seen, 0 while not expected */
+    long long from;             /* when the current missing period was counted */
+    } lmtTrTimer;
+
+typedef struct lmtTr
+    {
+    long long now;              /* arrival of the datagram being parsed */
+    long long nextCheck;        /* earliest deadline of the timers */
+    unsigned long long pktSeq;  /* TS packets so far, for the sync runs */
+    unsigned long long lastSyncErr;
+    int syncRun;
+    bool syncLost;
+    int watchCnt;
+    uint16_t watchPid[TR_MAX_WATCH];
+    lmtTrTimer seen[TR_MAX_WATCH];
+    lmtTrTimer pts[TR_MAX_WATCH];
+    } lmtTr;
+
+typedef struct lmtSection
+    {
+    bool synced;                /* seen a payload_unit_start_indicator */
+    int cc;
+    int len;
+    int need;                   /* 3 + section_length once the header is in */
+    uint8_t buf[PSI_MAX_SECTION];
+    } lmtSection;
+
+typedef struct lmtPsiTable
+    {
+    int svc;                    /* service index + 1 for a service's PMT, 0 for the channel's own PAT and PMT */
+    bool valid;
+    int version;
+    int sectionLen[PSI_MAX_SECTIONS];
+    uint32_t crc[PSI_MAX_SECTIONS];     /* CRC_32 of the last good copy of each section */
+    } lmtPsiTable;
+
+/* The program loop of one PAT section */
+typedef struct lmtPatSection
+    {
+    int count;
+    uint16_t prog[PAT_MAX_PROGRAMS];
+    uint16_t pmtPid[PAT_MAX_PROGRAMS];
+    } lmtPatSection;
+
+typedef struct lmtPsi
+    {
+    lmtSection patSec;
+    lmtSection pmtSec;
+    lmtPsiTable pat;
+    lmtPsiTable pmt;
+    lmtPatSection patProgs[PSI_MAX_SECTIONS];   /* of the PAT version being collected */
+    uint32_t patHave;           /* bit per section of it in patProgs */
+    int patLast;                /* its last_section_number, capped to PSI_MAX_SECTIONS - 1 */
+    int patVersion;
+    } lmtPsi;
+
+typedef struct lmtServiceEs
+    {
+    uint16_t pid;
+    uint8_t type;               /* stream_type */
+    } lmtServiceEs;
+
+typedef struct lmtServiceSnap
+    {
+    uint16_t sid;
+    uint16_t pmtPid;
+    uint16_t pcrPid;
+    uint16_t vPid;              /* first video stream, 0 if none */
+    int esCnt;
+    int aPidCnt;
+    int pmtVersion;             /* -1 before the PMT */
+    int pmtChanges;
+    unsigned int ccErrors;      /* on the PIDs lmtPidTable.svc gives to the service */
+    bool present;               /* packets of it came in the last window */
+    double mbps;                /* smoothed */
+    } lmtServiceSnap;
+
+/* One program of the PAT, with its own PMT assembly */
+typedef struct lmtService
+    {
+    lmtSection pmtSec;
+    lmtPsiTable pmt;
+    int esAt;                   /* its ES list in lmtServices.es, esCnt of them as the PMT lists them */
+    int esCap;                  /* entries carved for it */
+    uint32_t pkts;              /* of the window */
+    lmtServiceSnap snap;
+    } lmtService;
+
+/*
+ * Every program of the PAT, or those of the channel's services list. The table and the
+ * arena its ES lists are carved from are on the channel's node and sized from the PAT;
+ * per packet lmtPidTable.svc says which service a PID belongs to.
+ */
+typedef struct lmtServices
+    {
+    int count;
+    lmtService *svc;            /* count of them, in PAT order */
+    lmtServiceEs *es;           /* esSize entries, esUsed of them carved */
+    int esSize;
+    int esUsed;                 /* lists a PMT outgrew are left behind until the arena is repacked */
+    } lmtServices;
+
+typedef struct lmtHist
+    {
+    unsigned long long total;
+    long long max;
+    uint32_t counts[HIST_BUCKETS];
+    } lmtHist;
+
+typedef struct lmtPcrSnap
+    {
+    uint16_t pid;
+    int count;                  /* PCRs in the last window */
+    int discontinuities;
+    double ivMinMs;
+    double ivAvgMs;
+    double ivMaxMs;
+    double ivP99Ms;
+    long long jitterP50Us;
+    long long jitterP99Us;
+    long long jitterMaxUs;
+    long long jitterP2pUs;      /* peak to peak in the last window */
+    double driftPpm;            /* PCR clock against ours, over the whole run since the last discontinuity */
+    } lmtPcrSnap;
+
+typedef struct lmtPcrStats
+    {
+    bool havePrev;
+    bool haveFloor;
+    uint64_t prevPcr;
+    long long prevArr;
+    long long anchorArr;        /* arrival of the PCR the window is measured from */
+    long long pcrSpan;          /* 27 MHz ticks since the anchor */
+    long long startArr;         /* arrival of the first PCR after the last discontinuity */
+    long long totalSpan;        /* 27 MHz ticks since startArr */
+    double drift;               /* arrival clock against PCR clock */
+    long long floor;            /* best offset of the previous window */
+    long long offMin;
+    long long offMax;
+    long long offLast;
+    int count;
+    long long ivMin;
+    long long ivMax;
+    long long ivSum;
+    int discontinuities;
+    lmtHist interval;
+    lmtHist jitter;
+    lmtPcrSnap snap;
+    } lmtPcrStats;
+
+typedef struct lmtMdiSnap
+    {
+    double df;                  /* ms, last 1 s window */
+    double mlr;                 /* lost packets per second, last 1 s window */
+    double dfMinute;            /* worst DF of the last minute */
+    double mlrMinute;           /* average MLR of the last minute */
+    } lmtMdiSnap;
+
+typedef struct lmtMdi
+    {
+    long long winStart;         /* arrival of the first datagram of the window, 0 before it */
+    long long lastArr;
+    long long bytes;
+    int firstBytes;
+    double rate;                /* bytes per second, measured over the previous window */
+    double vbMin;
+    double vbMax;
+    long long rtpLost;          /* TS packets in lost RTP datagrams */
+    long long ccLost;           /* TS packets missing by continuity_counter */
+    double dfHist[MDI_MINUTE];
+    double mlrHist[MDI_MINUTE];
+    int histIdx;
+    int histCnt;
+    lmtMdiSnap snap;
+    } lmtMdi;
+
+typedef struct lmtRtpSnap
+    {
+    uint32_t ssrc;
+    unsigned long long reordered;       /* datagrams that came in behind a later one, but in time */
+    unsigned long long late;            /* came in after they were counted lost */
+    unsigned long long duplicates;
+    unsigned long long restarts;        /* sequence or SSRC jumps the receiver restarted on */
+    double jitterUs;                    /* RFC 3550 interarrival jitter */
+    unsigned long long fecPackets;      /* SMPTE 2022-1 column and row FEC datagrams */
+    unsigned long long fecRecoverable;  /* lost datagrams the FEC that came in could rebuild */
+    unsigned long long fecUnrecoverable;
+    } lmtRtpSnap;
+
+/*
+ * RTP receive statistics. The sequence numbers of the last RTP_WINDOW datagrams are
+ * kept as bits; one that is still missing RTP_REORDER behind the newest is lost, see
+ * lmtRtpSlide(). Extended sequence numbers never wrap.
+ */
+typedef struct lmtRtp
+    {
+    bool started;
+    bool haveTransit;
+    bool fec;                   /* FEC datagrams came in, losses get classified */
+    uint32_t badSeq;            /* RFC 3550 A.1 probation after a jump, the sequence number expected + 1 */
+    long long firstExt;         /* nothing before it was expected */
+    long long maxExt;           /* newest extended sequence number */
+    long long runStart;         /* first of the loss run being counted, -1 if none */
+    int runLen;
+    int tsPerDgram;             /* TS packets a lost datagram is worth for MDI */
+    uint32_t transit;           /* arrival minus RTP timestamp of the previous datagram, RTP_CLOCK units */
+    double jitter;              /* RTP_CLOCK units */
+    uint64_t seen[RTP_WINDOW / 64];
+    uint64_t lost[RTP_WINDOW / 64];
+    uint64_t recov[RTP_WINDOW / 64];    /* a FEC datagram whose other protected datagrams are all here covers it */
+    lmtRtpSnap snap;
+    } lmtRtp;
+
+typedef struct lmtProbeSnap
+    {
+    int dgrams;                 /* datagrams parsed in the last window */
+    long long parseP50Ns;       /* parse time per datagram */
+    long long parseP99Ns;
+    long long parseMaxNs;
+    long long queueP50Us;       /* kernel receive timestamp to parse */
+    long long queueP99Us;
+    long long queueMaxUs;
+    unsigned long long drops;   /* SO_RXQ_OVFL, datagrams the kernel dropped on the socket */
+    unsigned long long dropsWindow;
+    unsigned long long truncated;
+    int rcvbuf;                 /* SO_RCVBUF as the kernel reports it */
+    int rxCpu;                  /* SO_INCOMING_CPU, where the kernel last handled the socket's packets, -1 if unknown */
+    unsigned int napiId;        /* SO_INCOMING_NAPI_ID, the NIC receive queue, 0 if unknown */
+    int parseCpu;               /* where the parser ran at the end of the window, -1 before that */
+    } lmtProbeSnap;
+
+/* The probe watching itself, so an overloaded probe can be told from a broken stream */
+typedef struct lmtProbe
+    {
+    uint32_t ovfl;              /* last SO_RXQ_OVFL counter, the kernel's is cumulative */
+    int fd;                     /* the socket it comes in on, -1 if there is none */
+    unsigned long long dropsPrev;
+    lmtHist parse;              /* ns */
+    lmtHist queue;              /* ns */
+    lmtProbeSnap snap;
+    } lmtProbe;
+
+/* What the parser publishes, readers only ever see a consistent copy of this */
+typedef struct lmtChanSnap
+    {
+    int id;
+    bool isStream;
+    lmtChanInfo chanInfo;
+    int oneMinuteCC;
+    unsigned int alarms;        /* 1 << lmtAlarm while raised */
+    int pidCnt;
+    lmtPidStat pids[SNAP_MAX_PIDS];     /* PIDs in order of appearance */
+    lmtPcrSnap pcr;
+    lmtMdiSnap mdi;
+    lmtRtpSnap rtp;
+    lmtProbeSnap probe;
+    int serviceCnt;             /* all of them, the first SNAP_MAX_SERVICES are in services */
+    lmtServiceSnap services[SNAP_MAX_SERVICES];
+    } lmtChanSnap;
+
+enum lmtEvidenceReason
+    {
+    EVIDENCE_CC,
+    EVIDENCE_RTP,
+    EVIDENCE_PAT,
+    EVIDENCE_PMT,
+    EVIDENCE_LOSS,
+    EVIDENCE_REASONS
+    };
+
+/* A datagram in the ring, packed by its length: the next one starts stride bytes on */
+typedef struct lmtEvidenceRec
+    {
+    long long arrival;
+    uint32_t len;
+    uint16_t caplen;
+    uint16_t stride;
+    uint8_t data[];
+    } lmtEvidenceRec;
+
+/*
+ * A channel's pre/post capture ring, see lmtEvidenceDgram(). The parser owns it until it
+ * freezes it, then the writer does until it clears frozen; job is only read by the writer.
+ */
+typedef struct lmtEvidence
+    {
+    uint8_t *buf;               /* size bytes preallocated on the channel's node, never grows */
+    size_t size;
+    size_t head;                /* where the next record goes */
+    size_t tail;                /* the oldest record */
+    size_t wrapAt;              /* end of the records before head went back to 0, 0 while it hasn't */
+    size_t records;
+    long long lastArr;          /* of the newest record */
+    long long evictedArr;       /* of the last record that made way, a window past it is short */
+    unsigned int pending;       /* 1 << lmtEvidenceReason seen since the last datagram */
+    int reason;
+    long long trigger;          /* arrival the window is around, 0 while recording freely */
+    long long until;            /* recording stops after this arrival */
+    long long holdoff;          /* no trigger before this arrival */
+    bool frozen;
+    struct
+        {
+        int reason;
+        long long trigger;
+        long long from;
+        long long until;
+        } job;
+    struct thread_params *next; /* in the writer's queue */
+    } lmtEvidence;
+
+/* A channel's alarms, the parser's only. Conditions are looked at as each 1 s window closes */
+typedef struct lmtAlarms
+    {
+    unsigned int active;        /* 1 << lmtAlarm while raised */
+    uint16_t held[ALARM_STATES];        /* seconds in a row the condition disagreed with active */
+    uint32_t since[ALARM_STATES];       /* second it was raised */
+    int patChanges;             /* chanInfo as the previous window closed, for the one-off events */
+    int pmtChanges;
+    int aPidCnt;
+    } lmtAlarms;
+
+/* Writer side of a channel's history, see lmthistory.h. Only the parser touches it */
+typedef struct lmtHistory
+    {
+    lmtHistoryHdr *hdr;         /* NULL until the parser first maps it */
+    size_t size;
+    int fd;                     /* holds the flock while the file is ours, -1 otherwise */
+    char *path;                 /* NULL with history off, it is kept in memory then */
+    uint32_t slots;
+    uint32_t retrySec;          /* the file is locked, try again from this second on */
+    int retries;
+    bool present;               /* the newest second written had data */
+    unsigned long long rtpLostPrev;     /* chanInfo counters as the previous second closed */
+    int pcrDiscPrev;
+    } lmtHistory;
+
+typedef struct lmtSnapSlot
+    {
+    unsigned int seq;           /* odd while the parser is writing */
+    lmtChanSnap snap;
+    } lmtSnapSlot;
+
 typedef struct thread_params
     {
     int id;
@@ -81,42 +668,241 @@ typedef struct thread_params
     const char* ifAddr;
     const char* outFolder;
     lmtChanInfo chanInfo;
-    bool firstRtp;
     bool isStream;
-    bool logToFile;
+    int batchSize;
+    int rcvbuf;                 /* bytes asked for, 0 for the system default */
+    /* placement, see lmtChanConf */
+    cpu_set_t cpus;
+    int node;
+    int busyPoll;
+    bool preferBusyPoll;
+    /* parser state, kept here so one datagram batch can be handed over at a time */
+    bool saidstreamtype;
+    bool saidNotTs;
+    bool fec;                   /* reads the SMPTE 2022-1 FEC ports too */
+    int sid;                    /* program to monitor, 0 for the first in the PAT */
+    bool services;              /* keeps a service table, see lmtServices */
+    uint16_t *serviceSids;      /* of only these programs, NULL for all */
+    int serviceSidCnt;
+    lmtServices svc;
+    int fecSok[2];              /* column and row FEC sockets in socket and worker mode, -1 if none */
+    lmtHistory hist;
+    lmtAlarms alarm;
+    lmtEvidence *evidence;      /* NULL unless the channel keeps one */
+    bool wantsEvidence;         /* its config asked for one, whether the budget had room or not */
+    double bitrateMin;          /* Mbit/s range of ALARM_BITRATE, 0 for no bound */
+    double bitrateMax;
+    /* reactor mode */
+    int sok;
+    lmtTimer rxTimer;
+    long long lastRxTick;
+    unsigned int captureGen;
+    lmtSnapSlot pub;            /* written by the parser only, see lmtPublish() */
+    lmtPidTable *pids;
+    lmtPsi *psi;
+    lmtPcrStats *pcr;
+    lmtTr *tr;
+    lmtMdi *mdi;
+    lmtRtp *rtp;
+    lmtProbe *probe;
+    lmtMeter *meter;
+    lmtStatRec *stat;           /* this channel's record in the stats segment, if there is one */
+    /* lifecycle, see lmtRegistry */
+    pthread_t thread;           /* thread per channel mode */
+    int worker;                 /* index of the worker it's on, -1 if none */
+    bool stop;                  /* main thread: let go of the channel */
+    bool exited;                /* parser: it has, the channel can be freed */
+    int nextBatch;              /* changed in place by a reload, taken over by the parser */
+    int nextRcvbuf;
+    double nextBitrateMin;
+    double nextBitrateMax;
+    unsigned int confGen;
+    unsigned int confApplied;
     } thread_params;
 
-void logWithTime(const char* tolog, ...){
-    time_t date;
-    time(&date);
-    struct tm *ltime = localtime(&date);
-    va_list args;
-    va_start (args, tolog);
-    vsprintf (g_buffer, tolog, args);
-    va_end (args);
-    printf("%4d-%02d-%2d %0.2d:%0.2d:%0.2d: %s\n", ltime->tm_year + 1900, ltime->tm_mon + 1, ltime->tm_mday, ltime->tm_hour, ltime->tm_min, ltime->tm_sec,  g_buffer);
-}
+enum lmtWorkerCmdType
+    {
+    LMT_CMD_ADD,
+    LMT_CMD_REMOVE
+    };
 
-void greating()
-{
-    logWithTime("===============================");
-    logWithTime("lmtDiscont Version %0.1f", VERSION);
-    // logWithTime(("lmtDiscont Version "));
-    logWithTime("MPEG-TS channel monitoring tool");
-    logWithTime("===============================");
-}
+typedef struct lmtWorkerCmd
+    {
+    int type;
+    thread_params *chan;
+    struct lmtWorkerCmd *next;
+    } lmtWorkerCmd;
 
-long long getUsecs(void) 
-{
-    struct timeval tm;
-    if (gettimeofday(&tm, NULL) < 0)
+/* One channel of the config file, copied out of libconfig so it outlives the parse */
+typedef struct lmtChanConf
     {
-        logWithTime("Usec: gettimeofday failed");
-        return -1;
-    }
-    long long timestamp = ((long long) tm.tv_sec) * 1000000 + tm.tv_usec;
-    return timestamp;
-}
+    int id;
+    char mcastAddr[ADDR_SIZE];
+    int port;
+    char ifAddr[ADDR_SIZE];
+    int batch;
+    int rcvbuf;
+    cpu_set_t cpus;             /* its thread runs there, empty for anywhere */
+    int node;                   /* NUMA node of its state and buffers, -1 for wherever malloc puts them */
+    int busyPoll;               /* us of SO_BUSY_POLL, 0 for none */
+    bool preferBusyPoll;        /* SO_PREFER_BUSY_POLL */
+    double bitrateMin;          /* Mbit/s, 0 for no bound */
+    double bitrateMax;
+    bool evidence;              /* keeps a capture ring for lmtEvidence */
+    bool fec;                   /* reads the SMPTE 2022-1 FEC of port + 2 and + 4 */
+    int sid;                    /* program to monitor, 0 for the first in the PAT */
+    bool services;              /* tracks every program of the PAT, or the serviceSids */
+    uint16_t serviceSids[CONF_MAX_SIDS];
+    int serviceSidCnt;
+    } lmtChanConf;
+
+typedef struct lmtDgramRing
+    {
+    int size;
+    int node;
+    uint8_t *slots;             /* size * DGRAM_SLOT_SIZE, reused for every batch */
+    uint8_t *ctrl;              /* size * DGRAM_CTRL_SIZE for the receive timestamps and drop counters */
+    struct iovec *iov;
+    struct mmsghdr *msgs;
+    } lmtDgramRing;
+
+typedef struct lmtWorker
+    {
+    int idx;
+    int epfd;
+    pthread_t thread;
+    lmtDgramRing ring;          /* shared by all channels of the worker */
+    lmtTimerWheel wheel;
+    int chanCnt;                /* channels given to it, kept by the main thread */
+    int evfd;                   /* wakes the worker up for commands */
+    pthread_mutex_t cmdLock;
+    lmtWorkerCmd *cmdHead;      /* channels to add or remove, in order */
+    lmtWorkerCmd *cmdTail;
+    cpu_set_t cpus;             /* workerCpus, empty for anywhere */
+    int node;
+    } lmtWorker;
+
+typedef struct lmtChanMap
+    {
+    unsigned int mask;
+    uint64_t *keys;
+    thread_params **vals;
+    } lmtChanMap;
+
+typedef struct lmtReplay
+    {
+    const char *path;
+    bool fast;                  /* don't pace by the capture timestamps */
+    double tsBitrate;           /* bit/s a plain TS file is timed to */
+    uint8_t *data;
+    size_t size;
+    thread_params **chans;
+    int chanCount;
+    lmtChanMap map;
+    pthread_t thread;
+    long long wallStart;
+    long long capStart;
+    long long firstArr;
+    long long lastArr;
+    unsigned long long dgrams;
+    unsigned long long tsPackets;
+    unsigned long long bytes;
+    unsigned long long unmatched;
+    bool done;
+    } lmtReplay;
+
+typedef struct lmtHttpConn
+    {
+    int fd;                     /* -1 for a free slot */
+    long long deadline;         /* in ticks */
+    int reqLen;
+    char req[HTTP_REQ_SIZE];
+    char *out;                  /* kept between requests, only ever grows */
+    size_t outCap;
+    size_t outLen;
+    size_t outOff;              /* where the response starts, then how far it's sent */
+    } lmtHttpConn;
+
+typedef struct lmtHttp
+    {
+    int lfd;
+    int epfd;
+    pthread_t thread;
+    thread_params **chans;      /* the registry's, only while its lock is held */
+    int chanCount;
+    lmtChanSnap *snaps;
+    int snapsSize;
+    lmtHttpConn conns[HTTP_MAX_CONNS];
+    } lmtHttp;
+
+typedef struct lmtCapture
+    {
+    const char *ifAddr;
+    int ifIndex;
+    int fd;
+    uint8_t *ring;
+    struct tpacket_req3 req;
+    pthread_t thread;
+    lmtTimerWheel wheel;
+    lmtChanMap map;
+    thread_params **chans;
+    int chanCnt;
+    thread_params **touched;    /* channels that got data in the current block */
+    int touchedCnt;
+    unsigned int gen;
+    long long statsTick;
+    unsigned long long drops;   /* frames the ring had no room for, all channels of the interface */
+    cpu_set_t cpus;             /* all its channels' */
+    } lmtCapture;
+
+/* Shared socket mode: one socket per (port, interface) joins the groups of up to igmp_max_memberships channels */
+typedef struct lmtShared
+    {
+    const char *ifAddr;
+    unsigned short port;
+    int fd;
+    int rcvbuf;                 /* the sum of its channels', 0 for the system default */
+    lmtDgramRing ring;          /* as many slots as its channels' batches add up to */
+    pthread_t thread;
+    lmtTimerWheel wheel;
+    lmtChanMap map;
+    thread_params **chans;
+    int chanCnt;
+    thread_params **touched;    /* channels that got data in the current batch */
+    int touchedCnt;
+    unsigned int gen;
+    uint32_t ovfl;              /* last SO_RXQ_OVFL, like lmtProbe's */
+    unsigned long long drops;   /* the socket's, all of its channels */
+    unsigned long long dropsLogged;
+    unsigned long long unmatched;   /* datagrams to the port but none of the groups, unicast say */
+    unsigned long long unmatchedLogged;
+    long long statsTick;
+    cpu_set_t cpus;             /* all its channels' */
+    } lmtShared;
+
+/*
+ * Every monitored channel. Channels are allocated one by one and never move, so the
+ * parsers keep their pointer for good. The list is only changed by the main thread,
+ * under the lock; readers (reports, metrics) hold the lock while they walk it. A
+ * removed channel goes to retired until its parser has let go of it.
+ */
+typedef struct lmtRegistry
+    {
+    pthread_mutex_t lock;
+    thread_params **chans;
+    int count;
+    int size;
+    thread_params **retired;
+    int retiredCnt;
+    int retiredSize;
+    const char *cfgFile;
+    const char *outFolder;
+    int history;                /* seconds of <id>.hist kept per channel, 0 for none */
+    lmtWorker *workers;         /* NULL unless workers > 0 */
+    int workerCnt;
+    bool fixed;                 /* packet capture, shared sockets and replay can't add or remove channels */
+    lmtStatsHdr *stats;
+    } lmtRegistry;
 
 char *trimStr(char* str)
 {
@@ -135,114 +921,714 @@ char *trimStr(char* str)
     return str;
 }
 
-static inline uint16_t lmtTs_get_pid(const uint8_t *p_ts)
+/* <outFolder>/<name>, making sure of the slash and no whitespaces */
+char *lmtMakeFolderPath(const char *outFolder, const char *name)
 {
-    return ((p_ts[1] & 0x1f) << 8) | p_ts[2];
+    int size = strlen(outFolder);
+    char tmpfilename[size + 2];
+    memset(tmpfilename, 0, sizeof(tmpfilename));
+    memcpy(tmpfilename, outFolder, size);
+
+    char *folder = trimStr(tmpfilename);
+    if (folder[0] == 0 || folder[strlen(folder) - 1] != '/')
+    {
+        strcat(folder, "/");
+    }
+
+    char *filename = malloc(strlen(folder) + strlen(name) + 1);
+    if (filename)
+        sprintf(filename, "%s%s", folder, name);
+    return filename;
 }
 
-static inline int lmt_get_tscc(const uint8_t* tsBuf)
+/*
+ * Logging. The packet path only pushes fixed size records into a per thread
+ * single producer ring, lmtLogLoop() formats them and writes them in batches.
+ * logWithTime() stays for the cold paths and writes straight through.
+ */
+
+static const char *lmtLogFormats[LMT_EV_COUNT] =
 {
-    return tsBuf[3] & 0x0f;
+    [LMT_EV_RTP_SEQ]    = "Channel: %d RTP loss: %d datagrams from sequence number %d",
+    [LMT_EV_CC]         = "%d CC Error: PID: %d expected %d got %d",
+    [LMT_EV_NOT_TS]     = "Channel: %d Not an RTP or UDP TS stream, packet size is: %d",
+    [LMT_EV_RECV_ERR]   = "[ERROR] Channel: %d recvmmsg: %s",     /* errno, put into words by lmtLogLoop() */
+    [LMT_EV_CRC]        = "Channel: %d CRC Error: PID: %d table_id: %d",
+};
+
+static const char *lmtTrNames[TR_COUNT] =
+    {
+    "TS_sync_loss", "Sync_byte_error", "PAT_error", "Continuity_count_error", "PMT_error", "PID_error",
+    "Transport_error", "CRC_error", "PCR_repetition_error", "PCR_discontinuity_indicator_error", "PTS_error"
+    };
+
+static const char *lmtAlarmNames[ALARM_COUNT] =
+    {
+    "no_data", "pat_missing", "pmt_missing", "cc_errors", "bitrate", "pat_changed", "pmt_changed", "audio_tracks"
+    };
+
+static const char *lmtAlarmDetails[ALARM_COUNT] =
+{
+    [ALARM_NO_DATA]         = "nothing received for %d s",
+    [ALARM_PAT]             = "no PAT with the program for %d s",
+    [ALARM_PMT]             = "no PMT for %d s",
+    [ALARM_CC]              = "%d CC errors in the last minute",
+    [ALARM_BITRATE]         = "%d kbit/s, out of range",
+    [ALARM_PAT_CHANGED]     = "PAT version %d",
+    [ALARM_PMT_CHANGED]     = "PMT version %d",
+    [ALARM_AUDIO_TRACKS]    = "%d audio tracks, were %d",
+};
+
+static const char *lmtAlarmStates[] = { "raise", "clear", "event" };
+
+static pthread_mutex_t g_logOutLock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *g_logFile;
+static bool g_logStdout = true;
+static bool g_logLossless;      /* a replay waits for room in its ring rather than drop records */
+static lmtLogRing *g_logRings;
+static __thread lmtLogRing *t_logRing;
+static lmtLogRing *g_alarmRings;
+static __thread lmtLogRing *t_alarmRing;
+static lmtEvidenceConf g_evidence = { .pre = 5, .post = 2, .holdoff = 60, .triggers = (1u << EVIDENCE_REASONS) - 1,
+    .channelBytes = 24 << 20, .totalBytes = 256 << 20, .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+static lmtAlarmConf g_alarm = { .raiseSecs = 3, .clearSecs = 10, .ccRaise = 1, .ccClear = 0, .hysteresis = 0.05, .sock = -1 };
+static lmtRegistry g_reg = { .lock = PTHREAD_MUTEX_INITIALIZER };
+static volatile sig_atomic_t g_reload;
+
+/* Writes finished lines to stdout and the log file, the only place that does */
+void lmtLogOutput(const char *data, size_t len)
+{
+    pthread_mutex_lock(&g_logOutLock);
+    if (g_logStdout || !g_logFile)
+    {
+        fwrite(data, 1, len, stdout);
+        fflush(stdout);
+    }
+    if (g_logFile)
+    {
+        fwrite(data, 1, len, g_logFile);
+        fflush(g_logFile);
+    }
+    pthread_mutex_unlock(&g_logOutLock);
 }
 
-static inline uint32_t bytes_to_uint32(const uint8_t *bytes)
+int lmtFormatTime(char *out, size_t size, time_t date)
 {
-    return
-        (bytes[0] << 24) |
-        (bytes[1] << 16) |
-        (bytes[2] << 8)  |
-         bytes[3];
+    struct tm ltime;
+    localtime_r(&date, &ltime);
+    return snprintf(out, size, "%4d-%02d-%02d %02d:%02d:%02d: ", ltime.tm_year + 1900, ltime.tm_mon + 1, ltime.tm_mday, ltime.tm_hour, ltime.tm_min, ltime.tm_sec);
 }
 
-int RTP_Header_Parse(RTP_Header *rtpHeader, const uint8_t *buf, int len)
+void logWithTime(const char* tolog, ...){
+    char line[LOG_LINE_SIZE];
+    int len = lmtFormatTime(line, sizeof(line), time(NULL));
+    va_list args;
+    va_start (args, tolog);
+    len += vsnprintf (line + len, sizeof(line) - len - 1, tolog, args);
+    va_end (args);
+    if (len > (int)sizeof(line) - 2)
+        len = sizeof(line) - 2;
+    line[len++] = '\n';
+    lmtLogOutput(line, len);
+}
+
+/* First record from a thread registers its ring on the list, it's never freed */
+lmtLogRing *lmtLogRegister(lmtLogRing **list)
 {
-    if (len < 12)
-        return -1;
+    lmtLogRing *ring = calloc(1, sizeof(lmtLogRing));
+    if (!ring)
+        return NULL;
 
-    rtpHeader->version = (buf[0] & 0xC0) >> 6;
-    rtpHeader->p = (buf[0] & 0x20) >> 5;
-    rtpHeader->x = (buf[0] & 0x10) >> 4;
-    rtpHeader->cc = buf[0] & 0x0F;
-    rtpHeader->m = (buf[1] & 0x80) >> 7;
-    rtpHeader->pt = buf[1] & 0x7F;
-    rtpHeader->seq = (buf[2] << 8) | buf[3];
-    rtpHeader->ts = bytes_to_uint32(&buf[4]);
-    rtpHeader->ssrc = bytes_to_uint32(&buf[8]);
+    ring->next = __atomic_load_n(list, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(list, &ring->next, ring, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+    return ring;
+}
 
-    if (rtpHeader->cc > 0)
+void lmtLogPush(lmtLogRing *ring, long long sec, int event, int chan, int a0, int a1, int a2)
+{
+    unsigned int head = ring->head;
+    while (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= LOG_RING_SIZE)
+    {
+        if (!g_logLossless)
         {
-        if (len < 12 + rtpHeader->cc * 4)
-            return -1;
+            __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+            return;
+        }
+        sched_yield();
+    }
+
+    lmtLogRec *rec = &ring->recs[head & (LOG_RING_SIZE - 1)];
+    rec->sec = sec;
+    rec->chan = chan;
+    rec->event = event;
+    rec->args[0] = a0;
+    rec->args[1] = a1;
+    rec->args[2] = a2;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
 
-        int i;
-        for (i = 0; i < rtpHeader->cc; i++)
-            rtpHeader->csrc[i] = bytes_to_uint32(&buf[12 + i * 4]);
+/* Hot path logging, never blocks and never allocates after the first call of a thread */
+void lmtLog(int event, int chan, int a0, int a1, int a2)
+{
+    lmtLogRing *ring = t_logRing ? t_logRing : (t_logRing = lmtLogRegister(&g_logRings));
+    struct timespec ts;
+    if (!ring)
+        return;
 
-        return 12 + rtpHeader->cc * 4;
-        }
-    else
-        return 12;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    lmtLogPush(ring, ts.tv_sec, event, chan, a0, a1, a2);
 }
 
-void usage(const char *progname)
+/*
+ * Alarms go through rings of their own, so that a flood of CC error lines can't crowd
+ * them out, to the same thread as the log. It writes them to the log and the sink.
+ */
+void lmtAlarmPush(long long sec, int chan, int alarm, int state, int value, int value2)
 {
-    fprintf(stderr, "Usage: %s <multicast_ip> <port> [<interval>] [<output filename>]\n", progname);
-    exit(EXIT_FAILURE);
+    lmtLogRing *ring = t_alarmRing ? t_alarmRing : (t_alarmRing = lmtLogRegister(&g_alarmRings));
+    if (ring)
+        lmtLogPush(ring, sec, alarm, chan, state, value, value2);
 }
 
-uint16_t lmt_get_program(uint8_t* p_ts)
+/* "file:path" appends lines, "unix:path" sends each as a datagram, "exec:path" runs it with state, id, name and detail */
+int lmtAlarmSinkOpen(const char *sink)
 {
-    int adaptation_len = (((p_ts[3] >> 4) & 3) > 1) ? p_ts[4] + 1 : 0;
-    if (((p_ts[13 + adaptation_len] << 8) | p_ts[14 + adaptation_len]) > 0 )
+    const char *path = strchr(sink, ':');
+
+    if (!path || !path[1])
+    {
+        logWithTime("[WARNING] alarm sink \"%s\" isn't file:, unix: or exec: and a path, alarms only go to the log", sink);
+        return -1;
+    }
+    path++;
+    if (!strncmp(sink, "file:", 5))
+    {
+        g_alarm.file = fopen(path, "a");
+        if (!g_alarm.file)
+        {
+            logWithTime("[WARNING] alarm sink %s: %s, alarms only go to the log", path, strerror(errno));
+            return -1;
+        }
+    }
+    else if (!strncmp(sink, "unix:", 5))
+    {
+        if (strlen(path) >= sizeof(g_alarm.addr.sun_path))
+        {
+            logWithTime("[WARNING] alarm sink %s: path too long, alarms only go to the log", path);
+            return -1;
+        }
+        if ((g_alarm.sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0)
+        {
+            logWithTime("[WARNING] alarm sink %s: %s, alarms only go to the log", path, strerror(errno));
+            return -1;
+        }
+        g_alarm.addr.sun_family = AF_UNIX;
+        strcpy(g_alarm.addr.sun_path, path);
+    }
+    else if (!strncmp(sink, "exec:", 5))
+    {
+        if (access(path, X_OK) < 0)
+        {
+            logWithTime("[WARNING] alarm sink %s: %s, alarms only go to the log", path, strerror(errno));
+            return -1;
+        }
+        g_alarm.hook = strdup(path);
+    }
+    else
     {
-        return ((p_ts[13 + adaptation_len]) << 8) | p_ts[14 + adaptation_len];
-    }else{
-        return ((p_ts[13 + adaptation_len + 4]) << 8) | p_ts[14 + adaptation_len + 4];
+        logWithTime("[WARNING] alarm sink \"%s\" isn't file:, unix: or exec: and a path, alarms only go to the log", sink);
+        return -1;
     }
+    g_alarm.sink = strdup(sink);
+    logWithTime("alarms to %s", sink);
+    return 0;
 }
 
-uint16_t lmt_get_pmt(uint8_t *p_ts, uint16_t sid)
+/* Only the log thread calls it. A hook is never waited for, finished ones are reaped on the next alarm */
+void lmtAlarmSinkSend(const lmtLogRec *rec, const char *detail)
 {
-    int adaptation_len = (((p_ts[3] >> 4) & 3) > 1) ? p_ts[4] + 1 : 0;
-    uint16_t secLen = (((p_ts[6 + adaptation_len] & 0xF ) << 8) | p_ts[7 + adaptation_len]);
-
-    int offSet = 13 + adaptation_len;
+    const char *state = lmtAlarmStates[rec->args[0]], *name = lmtAlarmNames[rec->event];
+    char line[LOG_LINE_SIZE];
 
-    while(offSet < secLen + 3)
+    if (g_alarm.file || g_alarm.sock >= 0)
     {
-        if (((p_ts[offSet] << 8) | p_ts[offSet + 1]) == sid)
+        int len = snprintf(line, sizeof(line) - 1, "%lld %d %s %s %s", rec->sec, rec->chan, state, name, detail);
+        if (len > (int)sizeof(line) - 2)
+            len = sizeof(line) - 2;
+        line[len++] = '\n';
+        bool sent = g_alarm.file ? fwrite(line, 1, len, g_alarm.file) == (size_t)len && fflush(g_alarm.file) == 0
+            : sendto(g_alarm.sock, line, len, MSG_DONTWAIT, (struct sockaddr *)&g_alarm.addr, sizeof(g_alarm.addr)) >= 0;
+        if (!sent)
         {
-            return ((p_ts[offSet + 2] & 0x1F) << 8) | p_ts[offSet + 3];
+            if (!g_alarm.failed)
+                logWithTime("[WARNING] alarm sink %s: %s", g_alarm.sink, strerror(errno));
+            g_alarm.failed = true;
         }
-        offSet += 4;
+        else
+            g_alarm.failed = false;
     }
+    else if (g_alarm.hook)
+    {
+        char id[16];
+        char *argv[] = { g_alarm.hook, (char *)state, id, (char *)name, (char *)detail, NULL };
+        pid_t pid;
 
-    return 0;
+        snprintf(id, sizeof(id), "%d", rec->chan);
+        int err = posix_spawn(&pid, g_alarm.hook, NULL, NULL, argv, environ);
+        if (err && !g_alarm.failed)
+            logWithTime("[WARNING] alarm sink %s: %s", g_alarm.hook, strerror(err));
+        g_alarm.failed = err != 0;
+    }
 }
 
-long long usec_time()
+/* The log line of an alarm record, the sink gets it too */
+int lmtAlarmLine(char *out, size_t size, const lmtLogRec *rec)
 {
-    struct timeval tv;
-    if (gettimeofday(&tv, NULL) < 0)
+    char detail[128];
+
+    if (rec->args[0] == ALARM_CLEARED)
+        snprintf(detail, sizeof(detail), "after %d s", rec->args[1]);
+    else
+        snprintf(detail, sizeof(detail), lmtAlarmDetails[rec->event], rec->args[1], rec->args[2]);
+    lmtAlarmSinkSend(rec, detail);
+    return snprintf(out, size, "[ALARM] Channel: %d %s %s: %s", rec->chan, lmtAlarmStates[rec->args[0]], lmtAlarmNames[rec->event], detail);
+}
+
+void *lmtLogLoop(void *arg)
+{
+    static char out[LOG_BATCH_SIZE];
+    char stamp[32];
+    int stampLen = 0;
+    long long stampSec = -1;
+    struct timespec pause = { 0, LOG_FLUSH_MS * 1000000L };
+
+    while(1)
+    {
+        size_t len = 0;
+
+        for (int alarms = 0; alarms < 2; ++alarms)
+        for (lmtLogRing *ring = __atomic_load_n(alarms ? &g_alarmRings : &g_logRings, __ATOMIC_ACQUIRE); ring; ring = ring->next)
         {
-        perror("gettimeofday");
-        exit(EXIT_FAILURE);
+            unsigned int tail = ring->tail;
+            unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+            unsigned long long dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+
+            for (; tail != head; tail++)
+            {
+                const lmtLogRec *rec = &ring->recs[tail & (LOG_RING_SIZE - 1)];
+                if (len > sizeof(out) - LOG_LINE_SIZE)
+                {
+                    lmtLogOutput(out, len);
+                    len = 0;
+                }
+                if (rec->sec != stampSec)
+                {
+                    stampSec = rec->sec;
+                    stampLen = lmtFormatTime(stamp, sizeof(stamp), (time_t)rec->sec);
+                }
+                memcpy(out + len, stamp, stampLen);
+                len += stampLen;
+                if (alarms)
+                    len += lmtAlarmLine(out + len, LOG_LINE_SIZE - stampLen - 1, rec);
+                else if (rec->event == LMT_EV_RECV_ERR)
+                    len += snprintf(out + len, LOG_LINE_SIZE - stampLen - 1, lmtLogFormats[rec->event], rec->chan, strerror(rec->args[0]));
+                else
+                    len += snprintf(out + len, LOG_LINE_SIZE - stampLen - 1, lmtLogFormats[rec->event], rec->chan, rec->args[0], rec->args[1], rec->args[2]);
+                out[len++] = '\n';
+            }
+            __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+            if (dropped != ring->reported)
+            {
+                if (len > sizeof(out) - LOG_LINE_SIZE)
+                {
+                    lmtLogOutput(out, len);
+                    len = 0;
+                }
+                len += lmtFormatTime(out + len, LOG_LINE_SIZE, time(NULL));
+                len += snprintf(out + len, LOG_LINE_SIZE - 32, "[WARNING] %s ring full, %llu records dropped", alarms ? "alarm" : "log",
+                    dropped - ring->reported);
+                out[len++] = '\n';
+                ring->reported = dropped;
+            }
         }
-    return tv.tv_sec * 1000000 + tv.tv_usec;
+
+        if (len)
+            lmtLogOutput(out, len);
+        /* hooks that finished are reaped here, not only when the next alarm spawns one */
+        while (g_alarm.hook && waitpid(-1, NULL, WNOHANG) > 0)
+            ;
+        nanosleep(&pause, NULL);
+    }
+    return 0;
 }
 
-static inline const char *lmt_get_streamtype_txt(uint8_t i_stream_type) 
+/* Returns once everything logged so far is out */
+void lmtLogFlush(void)
 {
-    /* ISO/IEC 13818-1 | Table 2-36 - Stream type assignments */
-    if (i_stream_type == 0)
-        return "Reserved";
-    switch (i_stream_type) {
-        case 0x01: return "11172-2 video (MPEG-1)";
-        case 0x02: return "13818-2 video (MPEG-2)";
-        case 0x03: return "11172-3 audio (MPEG-1)";
-        case 0x04: return "13818-3 audio (MPEG-2)";
-        case 0x05: return "13818-1 private sections";
-        case 0x06: return "13818-1 PES private data";
+    struct timespec pause = { 0, LOG_FLUSH_MS * 1000000L };
+
+    for (int alarms = 0; alarms < 2; ++alarms)
+    for (lmtLogRing *ring = __atomic_load_n(alarms ? &g_alarmRings : &g_logRings, __ATOMIC_ACQUIRE); ring; ring = ring->next)
+    {
+        while (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) != __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE))
+            nanosleep(&pause, NULL);
+    }
+    /* the last batch is written after the tails move */
+    nanosleep(&pause, NULL);
+    nanosleep(&pause, NULL);
+}
+
+void lmtLogStart(const char *outFolder, bool toFile, bool toStdout)
+{
+    pthread_t thread;
+
+    if (toFile)
+    {
+        char *path = lmtMakeFolderPath(outFolder, LOG_FILE_NAME);
+        g_logFile = path ? fopen(path, "a") : NULL;
+        if (!g_logFile)
+            logWithTime("[WARNING] can't open log file %s: %s", path ? path : LOG_FILE_NAME, strerror(errno));
+        free(path);
+    }
+    g_logStdout = toStdout;
+
+    if (pthread_create(&thread, NULL, lmtLogLoop, NULL))
+    {
+        logWithTime("ERROR Creating logger thread");
+        exit(-1);
+    }
+    pthread_detach(thread);
+}
+
+/*
+ * Evidence: the last datagrams of a channel, kept so that an error can be looked at later.
+ * The parser copies every datagram into a preallocated ring of slots as it parses it, an
+ * error marks a reason, the next datagram turns it into a trigger and the datagram after
+ * the post window freezes the ring. lmtEvidenceLoop() writes the window out as a pcap and
+ * hands the ring back, the parser doesn't record meanwhile.
+ */
+static const char *lmtEvidenceNames[EVIDENCE_REASONS] = { "cc", "rtp", "pat", "pmt", "loss" };
+
+static inline void lmtEvidenceMark(thread_params *chan, int reason)
+{
+    if (chan->evidence && (g_evidence.triggers & (1u << reason)))
+        chan->evidence->pending |= 1u << reason;
+}
+
+void lmtEvidenceFreeze(thread_params *chan, long long until)
+{
+    lmtEvidence *ev = chan->evidence;
+
+    ev->job.reason = ev->reason;
+    ev->job.trigger = ev->trigger;
+    ev->job.from = ev->trigger - g_evidence.pre * 1000000000LL;
+    ev->job.until = until;
+    ev->holdoff = ev->trigger + g_evidence.holdoff * 1000000000LL;
+    ev->trigger = 0;
+    ev->pending = 0;
+    __atomic_store_n(&ev->frozen, true, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&g_evidence.lock);
+    ev->next = g_evidence.queue;
+    g_evidence.queue = chan;
+    pthread_cond_signal(&g_evidence.cond);
+    pthread_mutex_unlock(&g_evidence.lock);
+}
+
+static inline const lmtEvidenceRec *lmtEvidenceAt(const lmtEvidence *ev, size_t off)
+{
+    return (const lmtEvidenceRec *)(ev->buf + off);
+}
+
+/*
+ * Room for a record of stride bytes at head, the oldest records make way. Records are
+ * never split: one that doesn't fit before the end goes to 0 and wrapAt marks where
+ * the ones before it end.
+ */
+static inline lmtEvidenceRec *lmtEvidenceRoom(lmtEvidence *ev, size_t stride)
+{
+    while (1)
+    {
+        if (!ev->records)
+            ev->head = ev->tail = ev->wrapAt = 0;
+        if (!ev->wrapAt)
+        {
+            if (ev->head + stride <= ev->size)
+                break;
+            ev->wrapAt = ev->head;
+            ev->head = 0;
+        }
+        if (ev->head + stride <= ev->tail)
+            break;
+        ev->evictedArr = lmtEvidenceAt(ev, ev->tail)->arrival;
+        ev->tail += lmtEvidenceAt(ev, ev->tail)->stride;
+        ev->records--;
+        if (ev->tail >= ev->wrapAt)
+            ev->tail = ev->wrapAt = 0;
+    }
+    lmtEvidenceRec *rec = (lmtEvidenceRec *)(ev->buf + ev->head);
+    rec->stride = stride;
+    ev->head += stride;
+    ev->records++;
+    return rec;
+}
+
+/* Every datagram of a channel with a ring, before it is parsed. A copy, the receive buffers are reused by the next batch */
+static inline void lmtEvidenceDgram(thread_params *chan, const uint8_t *data, int len, long long arrival)
+{
+    lmtEvidence *ev = chan->evidence;
+
+    if (__atomic_load_n(&ev->frozen, __ATOMIC_ACQUIRE))
+        return;
+    if (__builtin_expect(ev->pending != 0, 0))
+    {
+        if (!ev->trigger && arrival >= ev->holdoff)
+        {
+            ev->reason = __builtin_ctz(ev->pending);
+            ev->trigger = arrival;
+            ev->until = arrival + g_evidence.post * 1000000000LL;
+        }
+        ev->pending = 0;
+    }
+    if (ev->trigger && arrival > ev->until)
+    {
+        lmtEvidenceFreeze(chan, ev->until);
+        return;
+    }
+    int caplen = len < EVIDENCE_SNAP ? len : EVIDENCE_SNAP;
+    lmtEvidenceRec *rec = lmtEvidenceRoom(ev, (sizeof(lmtEvidenceRec) + caplen + 7) & ~(size_t)7);
+    rec->arrival = arrival;
+    rec->len = len;
+    rec->caplen = caplen;
+    memcpy(rec->data, data, caplen);
+    ev->lastArr = arrival;
+}
+
+/* The stream stopped: a window waiting for its post part is written as it is, one that was flowing is a trigger itself */
+void lmtEvidenceLoss(thread_params *chan, bool wasStream)
+{
+    lmtEvidence *ev = chan->evidence;
+
+    if (!ev || __atomic_load_n(&ev->frozen, __ATOMIC_ACQUIRE) || !ev->records)
+        return;
+    long long last = ev->lastArr;
+    if (!ev->trigger && wasStream && (g_evidence.triggers & (1u << EVIDENCE_LOSS)) && last >= ev->holdoff)
+    {
+        ev->reason = EVIDENCE_LOSS;
+        ev->trigger = last;
+    }
+    if (ev->trigger)
+        lmtEvidenceFreeze(chan, last);
+    ev->pending = 0;
+}
+
+static inline uint8_t *lmtPut16(uint8_t *p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v;
+    return p + 2;
+}
+
+/* One datagram as a LINKTYPE_IPV4 record, with the IP and UDP headers it came in with made up again */
+void lmtEvidenceRecord(FILE *fp, const thread_params *chan, const lmtEvidenceRec *slot)
+{
+    uint32_t rec[4] = { slot->arrival / 1000000000LL, slot->arrival % 1000000000LL, 28 + slot->caplen, 28 + slot->len };
+    uint8_t hdr[28] = { 0x45, 0 };
+    uint32_t src = inet_addr(chan->ifAddr), dst = inet_addr(chan->mcastAddr), sum = 0;
+
+    lmtPut16(hdr + 2, 28 + slot->len);
+    lmtPut16(hdr + 6, 0x4000);              /* DF, no fragments */
+    hdr[8] = 64;
+    hdr[9] = IPPROTO_UDP;
+    memcpy(hdr + 12, &src, 4);
+    memcpy(hdr + 16, &dst, 4);
+    for (int i = 0; i < 20; i += 2)
+        sum += (hdr[i] << 8) | hdr[i + 1];
+    sum = (sum & 0xffff) + (sum >> 16);
+    lmtPut16(hdr + 10, ~(sum + (sum >> 16)));
+    lmtPut16(hdr + 20, chan->port);
+    lmtPut16(hdr + 22, chan->port);
+    lmtPut16(hdr + 24, 8 + slot->len);     /* UDP checksum 0, none */
+    fwrite(rec, sizeof(rec), 1, fp);
+    fwrite(hdr, sizeof(hdr), 1, fp);
+    fwrite(slot->data, slot->caplen, 1, fp);
+}
+
+/* <outputFolder>/<id>-<time>-<reason>.pcap, nanosecond pcap that discont -r reads back */
+void lmtEvidenceWrite(thread_params *chan)
+{
+    lmtEvidence *ev = chan->evidence;
+    uint32_t global[6] = { 0xa1b23c4d, 2 | (4 << 16), 0, 0, 28 + EVIDENCE_SNAP, LINKTYPE_IPV4 };
+    size_t off = ev->tail;
+    time_t t = ev->job.trigger / 1000000000LL;
+    char stamp[32], name[96];
+    struct tm tm;
+    long long firstArr = 0, lastArr = 0;
+    int written = 0;
+
+    localtime_r(&t, &tm);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+    snprintf(name, sizeof(name), "%d-%s-%s.pcap", chan->id, stamp, lmtEvidenceNames[ev->job.reason]);
+    char *path = lmtMakeFolderPath(chan->outFolder, name);
+    FILE *fp = path ? fopen(path, "w") : NULL;
+    if (!fp)
+    {
+        logWithTime("[WARNING] Channel: %d evidence %s: %s", chan->id, path ? path : name, strerror(errno));
+        free(path);
+        return;
+    }
+    fwrite(global, sizeof(global), 1, fp);
+    for (size_t i = 0; i < ev->records; ++i)
+    {
+        const lmtEvidenceRec *slot = lmtEvidenceAt(ev, off);
+        off += slot->stride;
+        if (ev->wrapAt && off == ev->wrapAt)
+            off = 0;
+        if (slot->arrival < ev->job.from || slot->arrival > ev->job.until)
+            continue;
+        lmtEvidenceRecord(fp, chan, slot);
+        if (!written++)
+            firstArr = slot->arrival;
+        lastArr = slot->arrival;
+    }
+    if (fclose(fp) != 0)
+        logWithTime("[WARNING] Channel: %d evidence %s: %s", chan->id, path, strerror(errno));
+    else
+        logWithTime("Channel: %d evidence %s, %d datagrams, %.1f s before and %.1f s after the %s trigger", chan->id, path, written,
+            written ? (ev->job.trigger - firstArr) / 1e9 : 0.0, written ? (lastArr - ev->job.trigger) / 1e9 : 0.0, lmtEvidenceNames[ev->job.reason]);
+    if (ev->evictedArr >= ev->job.from)
+        logWithTime("[WARNING] Channel: %d evidence ring held %.1f s of the %d s pre + post, raise channelMB, or bitrateMax if it sizes the ring", chan->id,
+            written ? (lastArr - firstArr) / 1e9 : 0.0, g_evidence.pre + g_evidence.post);
+    free(path);
+}
+
+/* The one writer, files are written here and nowhere near a parser */
+void *lmtEvidenceLoop(void *arg)
+{
+    (void)arg;
+    while (1)
+    {
+        pthread_mutex_lock(&g_evidence.lock);
+        while (!g_evidence.queue)
+            pthread_cond_wait(&g_evidence.cond, &g_evidence.lock);
+        thread_params *chan = g_evidence.queue;
+        g_evidence.queue = chan->evidence->next;
+        pthread_mutex_unlock(&g_evidence.lock);
+
+        lmtEvidenceWrite(chan);
+        __atomic_store_n(&chan->evidence->frozen, false, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+void greating()
+{
+    logWithTime("===============================");
+    logWithTime("lmtDiscont Version %0.1f", VERSION);
+    // logWithTime(("lmtDiscont Version "));
+    logWithTime("MPEG-TS channel monitoring tool");
+    logWithTime("===============================");
+}
+
+/* vDSO read of the last tick, a few ms coarse and never a syscall */
+long long lmtCoarseUs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static inline uint16_t lmtTs_get_pid(const uint8_t *p_ts)
+{
+    return ((p_ts[1] & 0x1f) << 8) | p_ts[2];
+}
+
+static inline int lmt_get_tscc(const uint8_t* tsBuf)
+{
+    return tsBuf[3] & 0x0f;
+}
+
+static inline uint32_t bytes_to_uint32(const uint8_t *bytes)
+{
+    return
+        (bytes[0] << 24) |
+        (bytes[1] << 16) |
+        (bytes[2] << 8)  |
+         bytes[3];
+}
+
+int RTP_Header_Parse(RTP_Header *rtpHeader, const uint8_t *buf, int len)
+{
+    if (len < 12)
+        return -1;
+
+    rtpHeader->version = (buf[0] & 0xC0) >> 6;
+    rtpHeader->p = (buf[0] & 0x20) >> 5;
+    rtpHeader->x = (buf[0] & 0x10) >> 4;
+    rtpHeader->cc = buf[0] & 0x0F;
+    rtpHeader->m = (buf[1] & 0x80) >> 7;
+    rtpHeader->pt = buf[1] & 0x7F;
+    rtpHeader->seq = (buf[2] << 8) | buf[3];
+    rtpHeader->ts = bytes_to_uint32(&buf[4]);
+    rtpHeader->ssrc = bytes_to_uint32(&buf[8]);
+
+    int hdrLen = 12 + rtpHeader->cc * 4;
+    if (len < hdrLen)
+        return -1;
+
+    int i;
+    for (i = 0; i < rtpHeader->cc; i++)
+        rtpHeader->csrc[i] = bytes_to_uint32(&buf[12 + i * 4]);
+
+    /* header extension: 16 bit profile, 16 bit length in 32 bit words */
+    if (rtpHeader->x)
+        {
+        if (len < hdrLen + 4)
+            return -1;
+        hdrLen += 4 + (((buf[hdrLen + 2] << 8) | buf[hdrLen + 3]) * 4);
+        if (len < hdrLen)
+            return -1;
+        }
+
+    return hdrLen;
+}
+
+void usage(const char *progname)
+{
+    fprintf(stderr, "Usage: %s [-c config] [-r capture [-x] [-b Mbit/s]]\n", progname);
+    fprintf(stderr, "  -c: config file, %s by default\n", DEFAULT_CONFIG_FILENAME);
+    fprintf(stderr, "  -r: analyse a pcap, pcapng or TS file instead of the live channels, datagrams go by their destination\n");
+    fprintf(stderr, "      to the configured channels, a TS file goes to the first channel\n");
+    fprintf(stderr, "  -x: replay as fast as possible instead of at the capture's pace\n");
+    fprintf(stderr, "  -b: bitrate a TS file is played at, 10 by default\n");
+    exit(EXIT_FAILURE);
+}
+
+long long usec_time()
+{
+    struct timeval tv;
+    if (gettimeofday(&tv, NULL) < 0)
+        {
+        perror("gettimeofday");
+        exit(EXIT_FAILURE);
+        }
+    return tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static inline const char *lmt_get_streamtype_txt(uint8_t i_stream_type) 
+{
+    /* ISO/IEC 13818-1 | Table 2-36 - Stream type assignments */
+    if (i_stream_type == 0)
+        return "Reserved";
+    switch (i_stream_type) {
+        case 0x01: return "11172-2 video (MPEG-1)";
+        case 0x02: return "13818-2 video (MPEG-2)";
+        case 0x03: return "11172-3 audio (MPEG-1)";
+        case 0x04: return "13818-3 audio (MPEG-2)";
+        case 0x05: return "13818-1 private sections";
+        case 0x06: return "13818-1 PES private data";
         case 0x07: return "13522 MHEG";
         case 0x08: return "H.222.0/13818-1 Annex A - DSM CC";
         case 0x09: return "H.222.1";
@@ -307,17 +1693,21 @@ static inline int lmt_get_adaptationLen(uint8_t* p_ts)
     return 0;
 }
 
-int getOneMinuteCC(lmtChanInfo* chanInfo)
+/* FORCE goes past net.core.rmem_max but needs CAP_NET_ADMIN */
+void lmtSetRcvbuf(int fd, int rcvbuf, int id)
 {
-    int sum = 0;
-    for (int i = 0; i < 60; ++i)
+    if (rcvbuf > 0 && setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) < 0)
     {
-        sum += chanInfo->cCArray[i];
+        int got = 0;
+        socklen_t len = sizeof(got);
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+        getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &got, &len);
+        if (got / 2 < rcvbuf)
+            logWithTime("[WARNING] Channel: %d rcvbuf %d capped at %d by net.core.rmem_max", id, rcvbuf, got / 2);
     }
-    return sum;
 }
 
-int openDgramSocket(const char* mcastAddr, unsigned short int port, const char* ifAddr, const int id)
+int openDgramSocket(const char* mcastAddr, unsigned short int port, const char* ifAddr, const int id, int rcvbuf)
 {
     int fdes;
     unsigned int yes = 1;
@@ -335,21 +1725,23 @@ int openDgramSocket(const char* mcastAddr, unsigned short int port, const char*
             // fprintf(stderr, "[ERROR] Channel: %d socket\n", id);
             logWithTime("[ERROR] Channel: %d socket", id);
             fclose(f);
-            pthread_exit(NULL);
+            return -1;
         }
     if (setsockopt(fdes, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) < 0)
         {
             // fprintf("[ERROR] Channel: %d setsockopt (SO_REUSEADDR)\n", id);
             logWithTime("[ERROR] Channel: %d setsockopt (SO_REUSEADDR)", id);
             fclose(f);
-            pthread_exit(NULL);
+            close(fdes);
+            return -1;
         }
     if (setsockopt(fdes, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) < 0)
         {
             // fprintf(f, "[ERROR] Channel: %d setsockopt (SO_REUSEPORT)\n", id);
             logWithTime("[ERROR] Channel: %d setsockopt (SO_REUSEPORT)", id);
             fclose(f);
-            pthread_exit(NULL);
+            close(fdes);
+            return -1;
         }
     
     struct timeval tv;
@@ -360,15 +1752,29 @@ int openDgramSocket(const char* mcastAddr, unsigned short int port, const char*
             // fprintf(f, "[ERROR] Channel: %d setsockopt (SO_RCVTIMEO)\n", id);
             logWithTime("[ERROR] Channel: %d setsockopt (SO_RCVTIMEO)", id);
             fclose(f);
-            pthread_exit(NULL);
+            close(fdes);
+            return -1;
+        }
+
+    if (setsockopt(fdes, SOL_SOCKET, SO_TIMESTAMPNS, &yes, sizeof(yes)) < 0)
+        {
+            logWithTime("[WARNING] Channel: %d setsockopt (SO_TIMESTAMPNS), using receive time", id);
         }
 
+    if (setsockopt(fdes, SOL_SOCKET, SO_RXQ_OVFL, &yes, sizeof(yes)) < 0)
+        {
+            logWithTime("[WARNING] Channel: %d setsockopt (SO_RXQ_OVFL), kernel drops won't be counted", id);
+        }
+
+    lmtSetRcvbuf(fdes, rcvbuf, id);
+
     if (bind(fdes, (struct sockaddr *)&(sin), sizeof(sin)) < 0)
         {
             // fprintf(f, "[ERROR] Channel: %d bind error\n", id);
             logWithTime("[ERROR] Channel: %d bind error", id);
             fclose(f);
-            pthread_exit(NULL);
+            close(fdes);
+            return -1;
         }
 
     mreq.imr_multiaddr.s_addr=inet_addr(mcastAddr);
@@ -378,283 +1784,4516 @@ int openDgramSocket(const char* mcastAddr, unsigned short int port, const char*
             // fprintf(f, "[ERROR] Channel: %d setsockopt (IP_ADD_MEMBERSHIP)\n", id);
             logWithTime("[ERROR] Channel: %d setsockopt (IP_ADD_MEMBERSHIP)", id);
             fclose(f);
-            pthread_exit(NULL);
+            close(fdes);
+            return -1;
         }
     
     fclose(f);
     return fdes;
 }
 
-void *lmtParseStream(void* arg)
+/* Leaves the group right away instead of whenever the socket's last reference goes */
+void lmtCloseDgramSocket(int fd, const char *mcastAddr, const char *ifAddr)
 {
-    struct thread_params *inArg = (struct thread_params*)arg;
+    struct ip_mreq mreq;
 
-    uint16_t tmpPid;
-    int tmpCc;
+    if (fd < 0)
+        return;
+    mreq.imr_multiaddr.s_addr = inet_addr(mcastAddr);
+    mreq.imr_interface.s_addr = inet_addr(ifAddr);
+    setsockopt(fd, IPPROTO_IP, IP_DROP_MEMBERSHIP, &mreq, sizeof(mreq));
+    close(fd);
+}
 
-    int id = inArg->id;
-    const char *ip = inArg->mcastAddr;
-    unsigned short int port = inArg->port;
-    const char *ifAddr = inArg->ifAddr;
-    // char *filename = (char*)inArg->outFolder;
-    
-    int size = strlen(inArg->outFolder);
-    char tmpfilename[size+4];
-    memset(tmpfilename, 0, sizeof(tmpfilename));
-    strncpy(tmpfilename, inArg->outFolder, size);
+/* Placement: which CPUs a channel's thread runs on and which NUMA node its memory is on */
 
-    char *filename = &tmpfilename[0];
-    char *slash = "/";
-    FILE *fp;
-    /*Making sure the folder address ends in /(slash) and no whitespaces*/
-    filename = trimStr(filename);
+static short *g_cpuNodes;       /* node of every CPU, -1 if the kernel doesn't say */
+static int g_cpuNodesCnt;
+static int g_nodeCnt;
 
-    if (filename[strlen(filename) - 1] != '/')
+/* "0-3,8,10-11" into a CPU set, returns the number of CPUs, -1 if it doesn't parse */
+int lmtParseCpus(const char *list, cpu_set_t *set)
+{
+    const char *p = list;
+
+    CPU_ZERO(set);
+    while (*p)
     {
-        strcat(filename, slash);
+        char *end;
+        long lo = strtol(p, &end, 10), hi = lo;
+        if (end == p || lo < 0)
+            return -1;
+        if (*end == '-')
+        {
+            p = end + 1;
+            hi = strtol(p, &end, 10);
+            if (end == p || hi < lo)
+                return -1;
+        }
+        if (hi >= CPU_SETSIZE)
+            return -1;
+        for (long c = lo; c <= hi; ++c)
+            CPU_SET(c, set);
+        p = end;
+        while (*p == ',' || isspace((unsigned char)*p))
+            ++p;
     }
-    sprintf(filename, "%s%d.out", filename, id);
-    /////////////////////////////////////////////////////////////////////
-    long long lasTime, timeDiff, bigTime;
-
-    char buf[BUF_SIZE];
-    bool saidstreamtype = false;
+    return CPU_COUNT(set);
+}
 
-    int n, tOffset;
-    unsigned short pCounter;
-    struct RTP_Packet *pPack;
-    int sok = openDgramSocket(ip, port, ifAddr, id);
+/* The other way round, "-" for an empty set */
+int lmtFormatCpus(char *out, size_t size, const cpu_set_t *set)
+{
+    int len = 0;
 
-    // printf("Starting monitoring of channel: %d Address: %s Port: %hu\n", id, ip, port);
-    int packetCount = 0, ccIndex = 0;
-    lasTime = getUsecs();
-    bigTime = getUsecs();
-    while(1)
+    out[0] = '\0';
+    for (int c = 0; c < CPU_SETSIZE && len < (int)size - 24; ++c)
     {
+        if (!CPU_ISSET(c, set))
+            continue;
+        int hi = c;
+        while (hi + 1 < CPU_SETSIZE && CPU_ISSET(hi + 1, set))
+            ++hi;
+        len += snprintf(out + len, size - len, hi > c ? "%s%d-%d" : "%s%d", len ? "," : "", c, hi);
+        c = hi;
+    }
+    if (!len)
+        snprintf(out, size, "-");
+    return len;
+}
 
-        memset(buf, 0, BUF_SIZE);
-        n = recv(sok, buf, BUF_SIZE, 0);
+/* CPU to node map, off /sys/devices/system/node/node<N>/cpulist */
+void lmtCpuNodesInit(void)
+{
+    char path[64], list[1024];
 
-        if (n <= 0 && errno != EAGAIN)
-            break;
+    g_cpuNodesCnt = CPU_SETSIZE;
+    g_cpuNodes = malloc(g_cpuNodesCnt * sizeof(short));
+    if (!g_cpuNodes)
+    {
+        g_cpuNodesCnt = 0;
+        return;
+    }
+    for (int c = 0; c < g_cpuNodesCnt; ++c)
+        g_cpuNodes[c] = -1;
 
-        if (n <= 0){
-            // printf("Channel: %d Error: Receave timeout for 2 seconds\n", id);
-            memset(&inArg->chanInfo, 0, sizeof(lmtChanInfo));
-            inArg->id = id;
-            saidstreamtype = false;
-            inArg->isStream = false;
+    for (int node = 0; node < NODE_MAX; ++node)
+    {
+        cpu_set_t set;
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        FILE *f = fopen(path, "r");
+        if (!f)
             continue;
-        }
-
-        if ((n - 12) / 7 == 188 || n / 7 == 188) 
+        if (fgets(list, sizeof(list), f) && lmtParseCpus(list, &set) >= 0)
         {
-            if ((n - 12) / 7 == 188)
-            {
-                tOffset = 12;
-                if (saidstreamtype == false)
-                {
-                   inArg->chanInfo.sStreamType = "RTP";
-                }
-                struct RTP_Header tHeader;
-                pPack = (struct RTP_Packet*)buf;
-                RTP_Header_Parse(&tHeader, (u_int8_t*)pPack, 12);
-
-                if ((pCounter + 1) % 65536 != tHeader.seq)
-                {
-                    logWithTime("Channel: %d RTP CC Error: expected %d got %d", id, (pCounter + 1) % 65535, tHeader.seq);
-                    inArg->chanInfo.cCerrors++;
-                }
-                pCounter = tHeader.seq;
-            }else
-            {
-                tOffset = 0;
-                pPack = (struct RTP_Packet*)buf;
-                if (saidstreamtype == false)
-                 {
-                    inArg->chanInfo.sStreamType = "UDP";
-                 }
-            }
-            
-            saidstreamtype = true;
-            uint16_t tPid;
-
-            if (inArg->chanInfo.sPmt == 0)
-            {
-            
-                for (int i = 0; i < 7; ++i)
-                {
-                    tPid = lmtTs_get_pid((uint8_t*)pPack + tOffset);
-                    if (tPid == 0)
-                    {
-                        inArg->chanInfo.sSid = lmt_get_program((uint8_t*)pPack + tOffset);
-                        inArg->chanInfo.sPmt = lmt_get_pmt((uint8_t*)pPack + tOffset, inArg->chanInfo.sSid);
-                        inArg->chanInfo.sPatParsed = true;
-                    }
-                    tOffset += 188;
-                }
-            }else if (inArg->chanInfo.pmtParsed == 0)
-            {
-                for (int i = 0; i < 7; ++i)
-                {
-                    tPid = lmtTs_get_pid((uint8_t*)pPack + tOffset);
-                    if (tPid == inArg->chanInfo.sPmt)
-                    {
-                        uint8_t* p_pmt;
-                        int af = lmt_get_adaptationLen((uint8_t*)pPack + tOffset); // get adaptation field
-                        if (af > 0)
-                        {
-                            p_pmt = (uint8_t*)pPack + tOffset + 5 + af;
-                        }else p_pmt = (uint8_t*)pPack + tOffset + 4; 
-
-                        int data_length = ((p_pmt[2] & 0xF) << 8)| (p_pmt[3] - 4);
-                        int descriptor_len = ((p_pmt[11] & 0xF) << 8)| p_pmt[12];
-                        int j = 13 + descriptor_len;
-
-                        while(j < data_length)
-                        {
-                            int secLen = ((p_pmt[j + 3] & 0xf) << 8)| p_pmt[j + 4];
-                            switch (lmt_get_streamtype(p_pmt[j])){
-                                case 0:
-                                    inArg->chanInfo.sVpid.pid = ((p_pmt[j + 1] & 0x1f) << 8)| p_pmt[j + 2];
-                                    inArg->chanInfo.sVpid.pFormat = lmt_get_streamtype_txt(p_pmt[j]);
-                                    j += secLen + 5;
-                                    break;
-                                case 1:
-                                    inArg->chanInfo.sApid[inArg->chanInfo.aPidCnt].pid = ((p_pmt[j + 1] & 0x1f) << 8)| p_pmt[j + 2];
-                                    inArg->chanInfo.sApid[inArg->chanInfo.aPidCnt].pFormat = lmt_get_streamtype_txt(p_pmt[j]);
-                                    inArg->chanInfo.aPidCnt = inArg->chanInfo.aPidCnt + 1;
-                                    j += secLen + 5;
-                                    break;
-                                default: 
-                                    j += secLen + 5;
-                                    break;
-                            }
-                        }
-                        inArg->chanInfo.pmtParsed = 1;
-                    }
-                    tOffset += 188;
-                }
-            }else
-            { 
-                for (int i = 0; i < 7; ++i)
-                {
-                    tmpPid = lmtTs_get_pid((uint8_t*)pPack + tOffset);
-                    tmpCc = lmt_get_tscc((uint8_t*)pPack + tOffset);
-
-                    if (inArg->chanInfo.sVpid.pid == tmpPid)
-                    {
-                        if ((inArg->chanInfo.sVpid.cc + 1) % 16 != tmpCc)
-                        {
-                            logWithTime("%d CC Error: vPID: %d expected %d got %d", id, tmpPid, (inArg->chanInfo.sVpid.cc + 1) % 15, tmpCc);
-                            inArg->chanInfo.cCerrors++;                            
-                        }
-                        inArg->chanInfo.sVpid.cc = tmpCc;
-                    }else{
-                        for (int i = 0; i < inArg->chanInfo.aPidCnt; i++)
-                        {
-                            if (inArg->chanInfo.sApid[i].pid == tmpPid)
-                            {
-                                if ((inArg->chanInfo.sApid[i].cc + 1) % 16 != tmpCc)
-                                {
-                                    logWithTime("%d CC Error: aPID: %d expected %d got %d", id, tmpPid, (inArg->chanInfo.sApid[i].cc + 1) % 15, tmpCc);
-                                    inArg->chanInfo.cCerrors++;
-                                }
-                                inArg->chanInfo.sApid[i].cc = tmpCc;
-                            }
-                        }
-                    }
-                    tOffset += 188;
-                }
-            }
-
-            if ((getUsecs() - lasTime) > 1000000)
-            {
-                timeDiff = getUsecs() - lasTime;
-                long long bits = strcmp(inArg->chanInfo.sStreamType, "UDP") ? (packetCount * 1316 * 8) : (packetCount * 1328 * 8);
-                long long bitTimeRatio = bits * 1000000 / timeDiff;
-                inArg->chanInfo.sBitrate = (double)bitTimeRatio / 1000000;
-                inArg->isStream = true;
-                saidstreamtype = false;
-                packetCount = 0;
-                lasTime = getUsecs();
-                inArg->chanInfo.cCArray[ccIndex] = inArg->chanInfo.cCerrors;
-                inArg->chanInfo.cCerrors = 0;
-                ccIndex = (ccIndex < 60) ? ccIndex + 1 : 0;
-            }
-            
-            if((getUsecs() - bigTime) > 10000000 && inArg->logToFile)
+            for (int c = 0; c < g_cpuNodesCnt; ++c)
             {
-                fp = fopen((const char*)filename, "w");
-                if (fp <= 0)
-                {
-                    logWithTime("Channel: %d Error opening file: %s: %s", id, filename, strerror(errno));
-                    break;
-                }
-                fprintf(fp, "%d", getOneMinuteCC(&inArg->chanInfo));
-                fclose(fp);
-                bigTime = getUsecs();
+                if (CPU_ISSET(c, &set))
+                    g_cpuNodes[c] = node;
             }
-
-            packetCount++;
-        }else 
-        {
-            logWithTime("Channel: %d Not an RTP or UDP TS stream, packet size is: %d", id, n);
-            inArg->chanInfo.sStreamType = "Error";
-            usleep(2000000);
-            continue;
         }
+        fclose(f);
+        g_nodeCnt++;
     }
-    close(sok);
-    return 0;
-  }
-
-
+}
 
-int main(int argc, char *argv[])
+static inline int lmtCpuNode(int cpu)
 {
-    greating();
-    const char* cfg_file = DEFAULT_CONFIG_FILENAME;
-    const char* outputFolder = "./";
-    int mLogTofile;
-    int chanCount, parsedChanCount = 0;
-    int thrd_created;
+    return cpu >= 0 && cpu < g_cpuNodesCnt ? g_cpuNodes[cpu] : -1;
+}
 
-    /* Config parse*/
-    config_t cfg;
-    config_setting_t *channels;
-    // config_setting_t *global;
+/* Node of the first CPU of a set, -1 for an empty one */
+int lmtCpusNode(const cpu_set_t *set)
+{
+    for (int c = 0; c < CPU_SETSIZE; ++c)
+    {
+        if (CPU_ISSET(c, set))
+            return lmtCpuNode(c);
+    }
+    return -1;
+}
 
-    config_init(&cfg);
+/* Zeroed memory on node, if there is one; the pages are taken from there when first touched */
+void *lmtNodeAlloc(size_t size, int node)
+{
+    static bool warned;
+    unsigned long mask[NODE_MAX / (8 * sizeof(unsigned long))];
 
-    if (!config_read_file(&cfg, cfg_file))
+    if (node < 0 || node >= NODE_MAX)
+        return calloc(1, size);
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+    memset(mask, 0, sizeof(mask));
+    mask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+    if (syscall(SYS_mbind, p, size, MPOL_PREFERRED, mask, NODE_MAX + 1, 0) < 0 && !warned)
     {
-        fprintf(stderr, "%s:%d - %s\n", config_error_file(&cfg), config_error_line(&cfg), config_error_text(&cfg));
-        config_destroy(&cfg);
-        return(EXIT_FAILURE);
+        warned = true;
+        logWithTime("[WARNING] mbind to node %d: %s, memory goes wherever the kernel puts it", node, strerror(errno));
     }
+    return p;
+}
 
-    /*Global Config*/
+void lmtNodeFree(void *p, size_t size, int node)
+{
+    if (!p)
+        return;
+    if (node < 0 || node >= NODE_MAX)
+        free(p);
+    else
+        munmap(p, size);
+}
+
+/* Like pthread_create(), pinned to cpus unless that's empty. CPUs it may not use get a warning and no pinning */
+int lmtThreadCreate(pthread_t *thread, void *(*fn)(void *), void *arg, const cpu_set_t *cpus, const char *what)
+{
+    pthread_attr_t attr;
+    char list[256];
+    int ret;
+
+    if (!cpus || CPU_COUNT(cpus) == 0)
+        return pthread_create(thread, NULL, fn, arg);
+    pthread_attr_init(&attr);
+    pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), cpus);
+    ret = pthread_create(thread, &attr, fn, arg);
+    pthread_attr_destroy(&attr);
+    if (ret == EINVAL)
+    {
+        lmtFormatCpus(list, sizeof(list), cpus);
+        logWithTime("[WARNING] %s: cpus %s not usable, running unpinned", what, list);
+        ret = pthread_create(thread, NULL, fn, arg);
+    }
+    return ret;
+}
+
+/* SO_BUSY_POLL past net.core.busy_read needs CAP_NET_ADMIN */
+void lmtSetBusyPoll(int fd, int usecs, bool prefer, int id)
+{
+    int one = 1;
+
+    if (usecs <= 0)
+        return;
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs)) < 0)
+        logWithTime("[WARNING] Channel: %d setsockopt (SO_BUSY_POLL): %s", id, strerror(errno));
+    if (prefer && setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &one, sizeof(one)) < 0)
+        logWithTime("[WARNING] Channel: %d setsockopt (SO_PREFER_BUSY_POLL): %s", id, strerror(errno));
+}
+
+int lmtRingInit(lmtDgramRing *ring, int size, int node)
+{
+    ring->size = size;
+    ring->node = node;
+    ring->slots = lmtNodeAlloc((size_t)size * DGRAM_SLOT_SIZE, node);
+    ring->iov = lmtNodeAlloc(size * sizeof(struct iovec), node);
+    ring->msgs = lmtNodeAlloc(size * sizeof(struct mmsghdr), node);
+    ring->ctrl = lmtNodeAlloc((size_t)size * DGRAM_CTRL_SIZE, node);
+    if (!ring->slots || !ring->iov || !ring->msgs || !ring->ctrl)
+        return -1;
+
+    for (int i = 0; i < size; ++i)
+    {
+        ring->iov[i].iov_base = ring->slots + (size_t)i * DGRAM_SLOT_SIZE;
+        ring->iov[i].iov_len = DGRAM_SLOT_SIZE;
+        ring->msgs[i].msg_hdr.msg_iov = &ring->iov[i];
+        ring->msgs[i].msg_hdr.msg_iovlen = 1;
+        ring->msgs[i].msg_hdr.msg_control = ring->ctrl + (size_t)i * DGRAM_CTRL_SIZE;
+    }
+    return 0;
+}
+
+/* the kernel shrinks msg_controllen to what it filled in, give the room back before each call */
+static inline void lmtRingArm(lmtDgramRing *ring, int cnt)
+{
+    for (int i = 0; i < cnt; ++i)
+        ring->msgs[i].msg_hdr.msg_controllen = DGRAM_CTRL_SIZE;
+}
+
+long long lmtNowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* For durations, a step of the wall clock doesn't end up in them */
+long long lmtMonoNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* SO_TIMESTAMPNS arrival time of a datagram, in ns of CLOCK_REALTIME */
+static inline long long lmtMsgArrival(struct msghdr *msg, long long fallback)
+{
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(msg); c; c = CMSG_NXTHDR(msg, c))
+    {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPNS)
+        {
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+            return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+        }
+    }
+    return fallback;
+}
+
+/* SO_RXQ_OVFL of a datagram, the socket's drops so far; the kernel leaves it out while that is 0 */
+static inline bool lmtMsgDrops(struct msghdr *msg, uint32_t *drops)
+{
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(msg); c; c = CMSG_NXTHDR(msg, c))
+    {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SO_RXQ_OVFL)
+        {
+            memcpy(drops, CMSG_DATA(c), sizeof(*drops));
+            return true;
+        }
+    }
+    return false;
+}
+
+/* IP_PKTINFO destination address of a datagram, network order, 0 without it */
+static inline uint32_t lmtMsgDest(struct msghdr *msg)
+{
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(msg); c; c = CMSG_NXTHDR(msg, c))
+    {
+        if (c->cmsg_level == IPPROTO_IP && c->cmsg_type == IP_PKTINFO)
+        {
+            struct in_pktinfo pi;
+            memcpy(&pi, CMSG_DATA(c), sizeof(pi));
+            return pi.ipi_addr.s_addr;
+        }
+    }
+    return 0;
+}
+
+void lmtRingFree(lmtDgramRing *ring)
+{
+    lmtNodeFree(ring->slots, (size_t)ring->size * DGRAM_SLOT_SIZE, ring->node);
+    lmtNodeFree(ring->iov, ring->size * sizeof(struct iovec), ring->node);
+    lmtNodeFree(ring->msgs, ring->size * sizeof(struct mmsghdr), ring->node);
+    lmtNodeFree(ring->ctrl, (size_t)ring->size * DGRAM_CTRL_SIZE, ring->node);
+    memset(ring, 0, sizeof(lmtDgramRing));
+}
+
+char *lmtMakeHistoryFile(const char *outFolder, int id)
+{
+    char name[16];
+    sprintf(name, "%d.hist", id);
+    return lmtMakeFolderPath(outFolder, name);
+}
+
+/* MPEG-2 CRC32 (poly 0x04C11DB7, MSB first), slicing-by-8 */
+static uint32_t g_crcTable[8][256];
+
+void lmtCrc32Init(void)
+{
+    for (int i = 0; i < 256; ++i)
+    {
+        uint32_t crc = (uint32_t)i << 24;
+        for (int k = 0; k < 8; ++k)
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : crc << 1;
+        g_crcTable[0][i] = crc;
+    }
+    for (int t = 1; t < 8; ++t)
+    {
+        for (int i = 0; i < 256; ++i)
+            g_crcTable[t][i] = (g_crcTable[t - 1][i] << 8) ^ g_crcTable[0][g_crcTable[t - 1][i] >> 24];
+    }
+}
+
+/* Over a whole section including its CRC_32 field this is 0 when the section is intact */
+uint32_t lmtCrc32(const uint8_t *p, int len)
+{
+    uint32_t crc = 0xFFFFFFFF;
+
+    for (; len >= 8; len -= 8, p += 8)
+    {
+        uint32_t lo = crc ^ bytes_to_uint32(p);
+        uint32_t hi = bytes_to_uint32(p + 4);
+        crc = g_crcTable[7][lo >> 24] ^ g_crcTable[6][(lo >> 16) & 0xff] ^
+              g_crcTable[5][(lo >> 8) & 0xff] ^ g_crcTable[4][lo & 0xff] ^
+              g_crcTable[3][hi >> 24] ^ g_crcTable[2][(hi >> 16) & 0xff] ^
+              g_crcTable[1][(hi >> 8) & 0xff] ^ g_crcTable[0][hi & 0xff];
+    }
+    while (len--)
+        crc = (crc << 8) ^ g_crcTable[0][(crc >> 24) ^ *p++];
+    return crc;
+}
+
+/*
+ * ETSI TR 101 290 first and second priority indicators. Counters are bumped where
+ * the parser already looks at the thing in question (sync, CC, TEI, sections, PCR),
+ * the timeouts are lazy deadlines checked from datagram arrivals. Per packet the
+ * engine costs one lookup in the PID watch map, only watched PIDs do any more.
+ */
+static inline bool lmtTrExpired(lmtTrTimer *t, long long now, long long limit, long long *next)
+{
+    bool expired = false;
+
+    if (!t->last)
+        return false;           /* not expected yet */
+    long long since = t->last > t->from ? t->last : t->from;
+    if (now - since > limit)
+    {
+        /* count again every limit for as long as it stays away */
+        expired = true;
+        t->from = now;
+        since = now;
+    }
+    if (since + limit < *next)
+        *next = since + limit;
+    return expired;
+}
+
+void lmtTrCheck(thread_params *inArg)
+{
+    lmtTr *tr = inArg->tr;
+    lmtChanInfo *info = &inArg->chanInfo;
+    long long now = tr->now, next = now + TR_PID_TIMEOUT_NS;
+    unsigned int active = info->trActive & (1 << TR_SYNC_LOSS);
+
+    for (int s = TR_SLOT_PAT; s < tr->watchCnt; ++s)
+    {
+        long long limit = s == TR_SLOT_PAT || s == TR_SLOT_PMT ? TR_PSI_TIMEOUT_NS : TR_PID_TIMEOUT_NS;
+        int ind = s == TR_SLOT_PAT ? TR_PAT : s == TR_SLOT_PMT ? TR_PMT : TR_PID;
+
+        if (lmtTrExpired(&tr->seen[s], now, limit, &next))
+            info->tr[ind]++;
+        if (tr->seen[s].last && now - tr->seen[s].last > limit)
+            active |= 1 << ind;
+        if (lmtTrExpired(&tr->pts[s], now, TR_PTS_TIMEOUT_NS, &next))
+            info->tr[TR_PTS]++;
+        if (tr->pts[s].last && now - tr->pts[s].last > TR_PTS_TIMEOUT_NS)
+            active |= 1 << TR_PTS;
+    }
+    /* clear the active marks soon after things come back */
+    if ((active & ~(1 << TR_SYNC_LOSS)) && next > now + TR_RECHECK_NS)
+        next = now + TR_RECHECK_NS;
+    info->trActive = active;
+    tr->nextCheck = next;
+}
+
+/* Rebuilds the watch map after the PAT or PMT changed, timers of PIDs that stay keep running */
+void lmtTrWatch(thread_params *inArg)
+{
+    lmtTr *tr = inArg->tr;
+    lmtChanInfo *info = &inArg->chanInfo;
+    uint8_t *watch = inArg->pids->watch;
+    uint16_t pids[TR_MAX_WATCH];
+    int cnt = TR_SLOT_PMT;
+
+    pids[TR_SLOT_PAT] = 0;
+    if (info->sPatParsed)
+        pids[cnt++] = info->sPmt;
+    if (info->pmtParsed)
+    {
+        if (info->sVpid.pid)
+            pids[cnt++] = info->sVpid.pid;
+        for (int i = 0; i < info->aPidCnt && cnt < TR_MAX_WATCH; ++i)
+            pids[cnt++] = info->sApid[i].pid;
+    }
+
+    for (int s = TR_SLOT_PAT; s < tr->watchCnt; ++s)
+        watch[tr->watchPid[s]] = 0;
+    for (int s = TR_SLOT_PAT; s < TR_MAX_WATCH; ++s)
+    {
+        if (s < cnt && s < tr->watchCnt && tr->watchPid[s] == pids[s])
+            continue;
+        /* a PID that just appeared in the tables is expected from now on */
+        tr->seen[s].last = s < cnt ? tr->now : 0;
+        tr->seen[s].from = 0;
+        tr->pts[s].last = 0;
+        tr->pts[s].from = 0;
+    }
+    for (int s = cnt - 1; s >= TR_SLOT_PAT; --s)
+    {
+        tr->watchPid[s] = pids[s];
+        if (!watch[pids[s]])
+            watch[pids[s]] = s;     /* a PID listed twice keeps its first slot */
+    }
+    tr->watchCnt = cnt;
+    tr->nextCheck = 0;
+}
+
+/* A packet on a PID the engine watches */
+void lmtTrPacket(thread_params *inArg, int slot, const uint8_t *p_ts, uint8_t flags)
+{
+    lmtTr *tr = inArg->tr;
+    bool scrambled = p_ts[3] & 0xc0;
+
+    if (slot <= TR_SLOT_PMT)
+    {
+        /* PAT and PMT are never scrambled, their presence is taken from whole sections */
+        if (scrambled)
+            inArg->chanInfo.tr[slot == TR_SLOT_PAT ? TR_PAT : TR_PMT]++;
+        return;
+    }
+
+    tr->seen[slot].last = tr->now;
+    if (!(flags & TS_FLAG_PUSI) || scrambled || !(p_ts[3] & 0x10))
+        return;
+
+    const uint8_t *pes = p_ts + 4;
+    if (p_ts[3] & 0x20)
+        pes += 1 + p_ts[4];
+    /* start code, and PTS_DTS_flags of a stream_id that has the optional header */
+    if (pes + 9 <= p_ts + TS_SIZE && pes[0] == 0 && pes[1] == 0 && pes[2] == 1
+        && pes[3] != 0xbe && pes[3] != 0xbf && (pes[7] & 0x80))
+        tr->pts[slot].last = tr->now;
+}
+
+/* TS_sync_loss: two bad sync bytes in a row lose sync, five good ones get it back */
+void lmtTrSyncErrors(thread_params *inArg, unsigned long long seq, int cnt)
+{
+    lmtTr *tr = inArg->tr;
+
+    tr->syncRun = (tr->lastSyncErr + 1 == seq) ? tr->syncRun + cnt : cnt;
+    tr->lastSyncErr = seq + cnt - 1;
+    inArg->chanInfo.tr[TR_SYNC_BYTE] += cnt;
+    if (tr->syncRun >= 2 && !tr->syncLost)
+    {
+        tr->syncLost = true;
+        inArg->chanInfo.tr[TR_SYNC_LOSS]++;
+        inArg->chanInfo.trActive |= 1 << TR_SYNC_LOSS;
+    }
+}
+
+/* Called once per datagram before its packets */
+static inline void lmtTrDgram(thread_params *inArg, long long arrival)
+{
+    lmtTr *tr = inArg->tr;
+
+    tr->now = arrival;
+    if (__builtin_expect(tr->watchCnt == 0, 0))
+        lmtTrWatch(inArg);
+    if (__builtin_expect(tr->syncLost, 0) && tr->pktSeq - tr->lastSyncErr > 5)
+    {
+        tr->syncLost = false;
+        inArg->chanInfo.trActive &= ~(1 << TR_SYNC_LOSS);
+    }
+    if (arrival >= tr->nextCheck)
+        lmtTrCheck(inArg);
+}
+
+int lmtFormatPidMap(char *out, size_t size, uint16_t pmt, const lmtChanInfo *info)
+{
+    int len = snprintf(out, size, "pmt %hu vPid %hu aPids", pmt, info->sVpid.pid);
+    for (int i = 0; i < info->aPidCnt && len < (int)size; ++i)
+    {
+        len += snprintf(out + len, size - len, "%s%hu", i ? "," : " ", info->sApid[i].pid);
+    }
+    if (info->aPidCnt == 0 && len < (int)size)
+        len += snprintf(out + len, size - len, " -");
+    return len;
+}
+
+void lmtForgetPmt(thread_params *inArg)
+{
+    memset(&inArg->psi->pmt, 0, sizeof(lmtPsiTable));
+    inArg->psi->pmtSec.synced = false;
+    inArg->chanInfo.pmtParsed = false;
+    inArg->chanInfo.aPidCnt = 0;
+    memset(&inArg->chanInfo.sVpid, 0, sizeof(lmtPidInfo));
+    memset(inArg->chanInfo.sApid, 0, sizeof(inArg->chanInfo.sApid));
+}
+
+/*
+ * The service table, parser thread only. A PAT whose programs changed sizes a new one,
+ * services that keep their program number and PMT PID keep their state in it.
+ */
+static inline bool lmtServiceWanted(const thread_params *inArg, uint16_t sid)
+{
+    if (!inArg->serviceSids)
+        return true;
+    for (int i = 0; i < inArg->serviceSidCnt; ++i)
+    {
+        if (inArg->serviceSids[i] == sid)
+            return true;
+    }
+    return false;
+}
+
+void lmtServicesUnmap(thread_params *inArg)
+{
+    const lmtServices *t = &inArg->svc;
+    uint16_t *map = inArg->pids->svc;
+
+    for (int i = 0; i < t->count; ++i)
+    {
+        const lmtService *svc = &t->svc[i];
+        map[svc->snap.pmtPid] = 0;
+        for (int e = 0; e < svc->snap.esCnt; ++e)
+            map[t->es[svc->esAt + e].pid] = 0;
+    }
+}
+
+/* A PID two services list is counted for the first of them, a PMT PID always says it is one */
+void lmtServicesMap(thread_params *inArg)
+{
+    const lmtServices *t = &inArg->svc;
+    uint16_t *map = inArg->pids->svc;
+
+    for (int i = 0; i < t->count; ++i)
+    {
+        const lmtService *svc = &t->svc[i];
+        for (int e = 0; e < svc->snap.esCnt; ++e)
+        {
+            if (!map[t->es[svc->esAt + e].pid])
+                map[t->es[svc->esAt + e].pid] = i + 1;
+        }
+    }
+    for (int i = t->count - 1; i >= 0; --i)
+        map[t->svc[i].snap.pmtPid] = (i + 1) | SERVICE_PMT;
+}
+
+void lmtServicesFree(thread_params *inArg)
+{
+    lmtServices *t = &inArg->svc;
+
+    if (t->svc)
+        lmtNodeFree(t->svc, t->count * sizeof(lmtService), inArg->node);
+    if (t->es)
+        lmtNodeFree(t->es, t->esSize * sizeof(lmtServiceEs), inArg->node);
+    memset(t, 0, sizeof(lmtServices));
+}
+
+/*
+ * Room for cnt ES entries of svc. A list that fits stays where it is, one that doesn't is
+ * carved from the end of the arena; a full arena is repacked into one twice what is in use.
+ */
+lmtServiceEs *lmtServiceEsAlloc(thread_params *inArg, lmtService *svc, int cnt)
+{
+    lmtServices *t = &inArg->svc;
+
+    if (cnt <= svc->esCap)
+        return t->es + svc->esAt;
+    if (t->esUsed + cnt > t->esSize)
+    {
+        int live = cnt;
+        for (int i = 0; i < t->count; ++i)
+            live += &t->svc[i] != svc ? t->svc[i].snap.esCnt : 0;
+        int size = live * 2 > t->count * SERVICE_ES_PER ? live * 2 : t->count * SERVICE_ES_PER;
+        lmtServiceEs *es = lmtNodeAlloc(size * sizeof(lmtServiceEs), inArg->node);
+        if (!es)
+            return NULL;
+        int used = 0;
+        for (int i = 0; i < t->count; ++i)
+        {
+            lmtService *other = &t->svc[i];
+            if (other == svc)
+                continue;
+            memcpy(es + used, t->es + other->esAt, other->snap.esCnt * sizeof(lmtServiceEs));
+            other->esAt = used;
+            other->esCap = other->snap.esCnt;
+            used += other->snap.esCnt;
+        }
+        if (t->es)
+            lmtNodeFree(t->es, t->esSize * sizeof(lmtServiceEs), inArg->node);
+        t->es = es;
+        t->esSize = size;
+        t->esUsed = used;
+    }
+    svc->esAt = t->esUsed;
+    svc->esCap = cnt;
+    t->esUsed += cnt;
+    return t->es + svc->esAt;
+}
+
+/* Once every section of a PAT version is in; services that keep their program number and PMT PID keep their state */
+void lmtServicesPat(thread_params *inArg)
+{
+    const lmtPsi *psi = inArg->psi;
+    lmtServices *t = &inArg->svc;
+    int cnt = 0;
+    bool same = true;
+
+    for (int p = 0; p <= psi->patLast; ++p)
+    {
+        const lmtPatSection *sec = &psi->patProgs[p];
+        for (int i = 0; i < sec->count; ++i)
+        {
+            if (sec->prog[i] == 0 || !lmtServiceWanted(inArg, sec->prog[i]))
+                continue;
+            same = same && cnt < t->count && t->svc[cnt].snap.sid == sec->prog[i] && t->svc[cnt].snap.pmtPid == sec->pmtPid[i];
+            cnt++;
+        }
+    }
+    if (same && cnt == t->count)
+        return;
+
+    lmtService *svc = cnt ? lmtNodeAlloc(cnt * sizeof(lmtService), inArg->node) : NULL;
+    if (cnt && !svc)
+    {
+        logWithTime("[ERROR] Channel: %d no memory for %d services", inArg->id, cnt);
+        return;
+    }
+    lmtServicesUnmap(inArg);
+    int n = 0;
+    for (int p = 0; p <= psi->patLast; ++p)
+    {
+        const lmtPatSection *sec = &psi->patProgs[p];
+        for (int i = 0; i < sec->count; ++i)
+        {
+            if (sec->prog[i] == 0 || !lmtServiceWanted(inArg, sec->prog[i]))
+                continue;
+            lmtService *s = &svc[n];
+            for (int o = 0; o < t->count; ++o)
+            {
+                if (t->svc[o].snap.sid == sec->prog[i] && t->svc[o].snap.pmtPid == sec->pmtPid[i])
+                {
+                    *s = t->svc[o];
+                    break;
+                }
+            }
+            if (!s->snap.sid)
+            {
+                s->snap.sid = sec->prog[i];
+                s->snap.pmtPid = sec->pmtPid[i];
+                s->snap.pmtVersion = -1;
+            }
+            s->pmt.svc = ++n;
+        }
+    }
+    if (t->svc)
+        lmtNodeFree(t->svc, t->count * sizeof(lmtService), inArg->node);
+    t->svc = svc;
+    t->count = cnt;
+    if (!t->es && cnt && (t->es = lmtNodeAlloc(cnt * SERVICE_ES_PER * sizeof(lmtServiceEs), inArg->node)))
+        t->esSize = cnt * SERVICE_ES_PER;
+    lmtServicesMap(inArg);
+
+    char list[LOG_LINE_SIZE - 96];
+    int used = 0;
+    for (int i = 0; i < cnt && used < (int)sizeof(list) - 16; ++i)
+        used += sprintf(list + used, " %hu/%hu", svc[i].snap.sid, svc[i].snap.pmtPid);
+    logWithTime("Channel: %d %d services, program/PMT PID:%s", inArg->id, cnt, cnt ? list : " -");
+}
+
+/* A changed section on a service's PMT PID, for the service with its program_number; the ES list is sized by it */
+void lmtServicePmt(thread_params *inArg, lmtPsiTable *tbl, const uint8_t *sec, int len)
+{
+    uint16_t prog = (sec[3] << 8) | sec[4];
+    lmtService *svc = &inArg->svc.svc[tbl->svc - 1];
+    int first = 12 + (((sec[10] & 0xF) << 8) | sec[11]), cnt = 0, version = (sec[5] >> 1) & 0x1f;
+
+    /* programs sharing a PMT PID share its assembly too */
+    for (int i = 0; i < inArg->svc.count && svc->snap.sid != prog; ++i)
+    {
+        if (inArg->svc.svc[i].snap.sid == prog && inArg->svc.svc[i].snap.pmtPid == svc->snap.pmtPid)
+            svc = &inArg->svc.svc[i];
+    }
+    if (svc->snap.sid != prog)
+        return;
+    for (int j = first; j + 5 <= len - 4; j += 5 + (((sec[j + 3] & 0xf) << 8) | sec[j + 4]))
+        cnt++;
+
+    lmtServiceSnap *snap = &svc->snap;
+    lmtServicesUnmap(inArg);
+    lmtServiceEs *es = lmtServiceEsAlloc(inArg, svc, cnt);
+    if (!es && cnt)
+    {
+        logWithTime("[ERROR] Channel: %d no memory for service %hu's %d streams", inArg->id, prog, cnt);
+        snap->esCnt = 0;
+        lmtServicesMap(inArg);
+        return;
+    }
+    snap->esCnt = 0;
+    snap->vPid = 0;
+    snap->aPidCnt = 0;
+    snap->pcrPid = ((sec[8] & 0x1f) << 8) | sec[9];
+    for (int j = first; j + 5 <= len - 4 && snap->esCnt < cnt; j += 5 + (((sec[j + 3] & 0xf) << 8) | sec[j + 4]))
+    {
+        uint16_t pid = ((sec[j + 1] & 0x1f) << 8) | sec[j + 2];
+        es[snap->esCnt].pid = pid;
+        es[snap->esCnt++].type = sec[j];
+        if (lmt_get_streamtype(sec[j]) == 0 && !snap->vPid)
+            snap->vPid = pid;
+        else if (lmt_get_streamtype(sec[j]) == 1)
+            snap->aPidCnt++;
+    }
+    lmtServicesMap(inArg);
+
+    if (snap->pmtVersion >= 0 && snap->pmtVersion != version)
+    {
+        logWithTime("Channel: %d service %hu PMT version %d -> %d, %d streams, vPid %hu, %d audio", inArg->id, prog, snap->pmtVersion,
+            version, snap->esCnt, snap->vPid, snap->aPidCnt);
+        snap->pmtChanges++;
+    }
+    snap->pmtVersion = version;
+}
+
+/* Keeps the program loop of a PAT section, true once every section of its version is in */
+bool lmtPatCollect(lmtPsi *psi, const uint8_t *sec, int len)
+{
+    int secNum = sec[6], version = (sec[5] >> 1) & 0x1f;
+    int last = sec[7] < PSI_MAX_SECTIONS ? sec[7] : PSI_MAX_SECTIONS - 1;
+
+    if (secNum > last)
+        return false;           /* past the sections remembered */
+    if (psi->patHave && (version != psi->patVersion || last != psi->patLast))
+        psi->patHave = 0;
+    psi->patVersion = version;
+    psi->patLast = last;
+
+    lmtPatSection *out = &psi->patProgs[secNum];
+    out->count = 0;
+    for (int i = 8; i + 4 <= len - 4 && out->count < PAT_MAX_PROGRAMS; i += 4)
+    {
+        out->prog[out->count] = (sec[i] << 8) | sec[i + 1];
+        out->pmtPid[out->count++] = ((sec[i + 2] & 0x1f) << 8) | sec[i + 3];
+    }
+    psi->patHave |= 1u << secNum;
+    return psi->patHave == (2u << last) - 1;
+}
+
+/* Picks the program from the whole PAT, so one in a later section isn't passed over for the first of another */
+void lmtParsePat(thread_params *inArg)
+{
+    lmtChanInfo *info = &inArg->chanInfo;
+    const lmtPsi *psi = inArg->psi;
+    uint16_t sid = 0, pmt = 0;
+    uint16_t want = inArg->sid ? inArg->sid : info->sSid;
+
+    for (int s = 0; s <= psi->patLast; ++s)
+    {
+        const lmtPatSection *sec = &psi->patProgs[s];
+        for (int i = 0; i < sec->count; ++i)
+        {
+            if (sec->prog[i] == 0)
+                continue;       /* network PID */
+            if (sec->prog[i] == want)
+            {
+                sid = sec->prog[i];
+                pmt = sec->pmtPid[i];
+                s = psi->patLast;
+                break;
+            }
+            if (sid == 0)
+            {
+                sid = sec->prog[i];
+                pmt = sec->pmtPid[i];
+            }
+        }
+    }
+    if (sid == 0)
+        return;
+
+    if (inArg->sid && sid != inArg->sid && (!info->sPatParsed || sid != info->sSid))
+        logWithTime("[WARNING] Channel: %d program %d is not in the PAT, monitoring program %hu", inArg->id, inArg->sid, sid);
+    if (info->sPatParsed && (sid != info->sSid || pmt != info->sPmt))
+        logWithTime("Channel: %d PAT version %d -> %d, program %hu PMT PID %hu -> program %hu PMT PID %hu", inArg->id,
+            info->sPatVer, psi->patVersion, info->sSid, info->sPmt, sid, pmt);
+    if (pmt != info->sPmt)
+        lmtForgetPmt(inArg);
+
+    info->sSid = sid;
+    info->sPmt = pmt;
+    info->sPatParsed = true;
+    lmtTrWatch(inArg);
+}
+
+void lmtParsePmt(thread_params *inArg, const uint8_t *sec, int len)
+{
+    lmtChanInfo *info = &inArg->chanInfo;
+    lmtChanInfo old = *info;
+    int descriptor_len = ((sec[10] & 0xF) << 8) | sec[11];
+    int j = 12 + descriptor_len;
+
+    info->aPidCnt = 0;
+    memset(&info->sVpid, 0, sizeof(lmtPidInfo));
+    info->sPcr = ((sec[8] & 0x1f) << 8) | sec[9];
+    while (j + 5 <= len - 4)
+    {
+        int esLen = ((sec[j + 3] & 0xf) << 8) | sec[j + 4];
+        uint16_t pid = ((sec[j + 1] & 0x1f) << 8) | sec[j + 2];
+        switch (lmt_get_streamtype(sec[j])){
+            case 0:
+                info->sVpid.pid = pid;
+                info->sVpid.pFormat = lmt_get_streamtype_txt(sec[j]);
+                break;
+            case 1:
+                if (info->aPidCnt < MAX_APIDS)
+                {
+                    info->sApid[info->aPidCnt].pid = pid;
+                    info->sApid[info->aPidCnt].pFormat = lmt_get_streamtype_txt(sec[j]);
+                    info->aPidCnt++;
+                }
+                break;
+            default:
+                break;
+        }
+        j += esLen + 5;
+    }
+
+    if (old.pmtParsed)
+    {
+        char oldMap[128], newMap[128];
+        lmtFormatPidMap(oldMap, sizeof(oldMap), old.sPmt, &old);
+        lmtFormatPidMap(newMap, sizeof(newMap), info->sPmt, info);
+        logWithTime("Channel: %d PMT version %d -> %d, old: %s new: %s", inArg->id, old.sPmtVer, (sec[5] >> 1) & 0x1f, oldMap, newMap);
+        info->pmtChanges++;
+        lmtEvidenceMark(inArg, EVIDENCE_PMT);
+    }
+    info->sPmtVer = (sec[5] >> 1) & 0x1f;
+    info->pmtParsed = true;
+    lmtTrWatch(inArg);
+}
+
+/*
+ * A complete section. A repeat of the last good copy is recognised by its length
+ * and CRC_32 bytes alone, only a changed section is CRC checked and parsed.
+ */
+void lmtPsiSection(thread_params *inArg, lmtPsiTable *tbl, const uint8_t *sec, int len)
+{
+    int secNum = sec[6];
+    uint32_t crc = bytes_to_uint32(sec + len - 4);
+    bool isPat = tbl == &inArg->psi->pat;
+
+    if (secNum < PSI_MAX_SECTIONS && tbl->valid && tbl->sectionLen[secNum] == len && tbl->crc[secNum] == crc)
+    {
+        if (!tbl->svc)
+            inArg->tr->seen[isPat ? TR_SLOT_PAT : TR_SLOT_PMT].last = inArg->tr->now;
+        return;
+    }
+
+    if (lmtCrc32(sec, len) != 0)
+    {
+        uint16_t pid = tbl->svc ? inArg->svc.svc[tbl->svc - 1].snap.pmtPid : isPat ? 0 : inArg->chanInfo.sPmt;
+        /* the program's own PMT PID is assembled twice, its errors count once */
+        if (!tbl->svc || pid != inArg->chanInfo.sPmt)
+        {
+            lmtLog(LMT_EV_CRC, inArg->id, pid, sec[0], 0);
+            inArg->chanInfo.tr[TR_CRC]++;
+        }
+        return;
+    }
+    /* section_syntax_indicator and current_next_indicator */
+    if (!(sec[1] & 0x80) || !(sec[5] & 0x01))
+        return;
+
+    if (tbl->svc)
+    {
+        if (sec[0] != 0x02)
+            return;
+        lmtServicePmt(inArg, tbl, sec, len);
+    }
+    else if (isPat)
+    {
+        if (sec[0] != 0x00)
+        {
+            inArg->chanInfo.tr[TR_PAT]++;
+            return;
+        }
+        inArg->tr->seen[TR_SLOT_PAT].last = inArg->tr->now;
+        if (lmtPatCollect(inArg->psi, sec, len))
+        {
+            if (inArg->services)
+                lmtServicesPat(inArg);
+            lmtParsePat(inArg);
+            inArg->chanInfo.sPatVer = inArg->psi->patVersion;
+        }
+        if (tbl->valid && tbl->version != ((sec[5] >> 1) & 0x1f))
+        {
+            inArg->chanInfo.patChanges++;
+            lmtEvidenceMark(inArg, EVIDENCE_PAT);
+        }
+    }
+    else
+    {
+        /* other programs' PMTs can share the PID */
+        if (sec[0] != 0x02 || ((sec[3] << 8) | sec[4]) != inArg->chanInfo.sSid)
+            return;
+        inArg->tr->seen[TR_SLOT_PMT].last = inArg->tr->now;
+        lmtParsePmt(inArg, sec, len);
+    }
+
+    if (tbl->valid && tbl->version != ((sec[5] >> 1) & 0x1f))
+        memset(tbl->sectionLen, 0, sizeof(tbl->sectionLen));
+    tbl->valid = true;
+    tbl->version = (sec[5] >> 1) & 0x1f;
+    if (secNum < PSI_MAX_SECTIONS)
+    {
+        tbl->sectionLen[secNum] = len;
+        tbl->crc[secNum] = crc;
+    }
+}
+
+/* Copies section bytes until the section is complete, returns where it stopped */
+static const uint8_t *lmtSectionAppend(thread_params *inArg, lmtSection *sec, lmtPsiTable *tbl, const uint8_t *p, const uint8_t *end, bool mayStart)
+{
+    while (p < end)
+    {
+        if (sec->len == 0 && (!mayStart || *p == 0xff))
+            return end;         /* stuffing, or a new section outside a PUSI packet */
+
+        int want = (sec->len < 3) ? 3 - sec->len : sec->need - sec->len;
+        int take = (end - p < want) ? end - p : want;
+        memcpy(sec->buf + sec->len, p, take);
+        sec->len += take;
+        p += take;
+
+        if (sec->len == 3)
+        {
+            sec->need = 3 + (((sec->buf[1] & 0x0f) << 8) | sec->buf[2]);
+            if (sec->need > PSI_MAX_SECTION || sec->need < 12)
+            {
+                sec->synced = false;
+                sec->len = 0;
+                return end;
+            }
+        }
+        else if (sec->len == sec->need)
+        {
+            lmtPsiSection(inArg, tbl, sec->buf, sec->len);
+            sec->len = 0;
+        }
+    }
+    return p;
+}
+
+/* Feeds one PAT or PMT packet, sections may span packets and packets may hold several sections */
+void lmtPsiPacket(thread_params *inArg, lmtSection *sec, lmtPsiTable *tbl, const uint8_t *p_ts)
+{
+    int afc = (p_ts[3] >> 4) & 3;
+    int cc = p_ts[3] & 0x0f;
+    const uint8_t *p = p_ts + 4;
+    const uint8_t *end = p_ts + 188;
+
+    if (!(afc & 1))
+        return;
+    if (afc & 2)
+        p += 1 + p_ts[4];
+    if (p >= end)
+        return;
+
+    if (sec->synced)
+    {
+        if (cc == sec->cc)
+            return;             /* duplicate */
+        if (cc != ((sec->cc + 1) & 0x0f))
+            sec->len = 0;       /* lost a piece of the section */
+    }
+    sec->cc = cc;
+
+    if (p_ts[1] & 0x40)
+    {
+        const uint8_t *start = p + 1 + *p;
+        if (start > end)
+        {
+            sec->synced = false;
+            sec->len = 0;
+            return;
+        }
+        if (sec->synced && sec->len)
+            lmtSectionAppend(inArg, sec, tbl, p + 1, start, false);
+        sec->synced = true;
+        sec->len = 0;
+        lmtSectionAppend(inArg, sec, tbl, start, end, true);
+    }
+    else if (sec->synced && sec->len)
+    {
+        lmtSectionAppend(inArg, sec, tbl, p, end, false);
+    }
+}
+
+/*
+ * TS framing. lmtTsFrame() finds where the TS packets start (UDP, or RTP with any
+ * CSRC count, extension and padding) and whether they're 188 or 204 bytes, then a
+ * header kernel pulls PID, CC/AF control and TEI/PUSI of every packet into lmtTsBatch.
+ */
+
+/* w is the first 4 bytes of a TS packet loaded little endian */
+static inline void lmtTsHdrScalar(lmtTsBatch *tb, int i, uint32_t w)
+{
+    tb->pid[i] = (w & 0x1f00) | ((w >> 16) & 0xff);
+    tb->ccAfc[i] = (w >> 24) & 0x3f;
+    tb->flags[i] = ((w >> 8) & (TS_FLAG_TEI | TS_FLAG_PUSI)) | ((w & 0xff) != 0x47 ? TS_FLAG_SYNC_ERR : 0);
+}
+
+static inline uint32_t lmtLoad32(const uint8_t *p)
+{
+    uint32_t w;
+    memcpy(&w, p, 4);
+    return w;
+}
+
+void lmtTsHdrsScalar(lmtTsBatch *tb)
+{
+    for (int i = 0; i < tb->count; ++i)
+        lmtTsHdrScalar(tb, i, lmtLoad32(tb->first + i * tb->size));
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/* four headers at a time, the loads are scalar since SSE2 has no gather */
+void lmtTsHdrsSse2(lmtTsBatch *tb)
+{
+    const __m128i pidHi = _mm_set1_epi32(0x1f00);
+    const __m128i lowByte = _mm_set1_epi32(0xff);
+    const __m128i ccMask = _mm_set1_epi32(0x3f);
+    const __m128i flagMask = _mm_set1_epi32(TS_FLAG_TEI | TS_FLAG_PUSI);
+    const __m128i sync = _mm_set1_epi32(0x47);
+    const __m128i syncErr = _mm_set1_epi32(TS_FLAG_SYNC_ERR);
+    const uint8_t *p = tb->first;
+    int size = tb->size;
+    int i = 0;
+
+    for (; i + 4 <= tb->count; i += 4, p += 4 * size)
+    {
+        __m128i w = _mm_set_epi32(lmtLoad32(p + 3 * size), lmtLoad32(p + 2 * size), lmtLoad32(p + size), lmtLoad32(p));
+        __m128i pid = _mm_or_si128(_mm_and_si128(w, pidHi), _mm_and_si128(_mm_srli_epi32(w, 16), lowByte));
+        __m128i cc = _mm_and_si128(_mm_srli_epi32(w, 24), ccMask);
+        __m128i bad = _mm_andnot_si128(_mm_cmpeq_epi32(_mm_and_si128(w, lowByte), sync), syncErr);
+        __m128i flags = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(w, 8), flagMask), bad);
+
+        _mm_storel_epi64((__m128i*)&tb->pid[i], _mm_packs_epi32(pid, pid));
+        __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(cc, flags), _mm_setzero_si128());
+        uint32_t ccs = _mm_cvtsi128_si32(bytes);
+        uint32_t fls = _mm_cvtsi128_si32(_mm_srli_si128(bytes, 4));
+        memcpy(&tb->ccAfc[i], &ccs, 4);
+        memcpy(&tb->flags[i], &fls, 4);
+    }
+    for (; i < tb->count; ++i)
+        lmtTsHdrScalar(tb, i, lmtLoad32(tb->first + i * size));
+}
+
+/* eight headers at a time with one gather */
+__attribute__((target("avx2")))
+void lmtTsHdrsAvx2(lmtTsBatch *tb)
+{
+    const __m256i pidHi = _mm256_set1_epi32(0x1f00);
+    const __m256i lowByte = _mm256_set1_epi32(0xff);
+    const __m256i ccMask = _mm256_set1_epi32(0x3f);
+    const __m256i flagMask = _mm256_set1_epi32(TS_FLAG_TEI | TS_FLAG_PUSI);
+    const __m256i sync = _mm256_set1_epi32(0x47);
+    const __m256i syncErr = _mm256_set1_epi32(TS_FLAG_SYNC_ERR);
+    int size = tb->size;
+    const __m256i idx = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(size));
+    int i = 0;
+
+    for (; i + 8 <= tb->count; i += 8)
+    {
+        __m256i w = _mm256_i32gather_epi32((const int*)(tb->first + i * size), idx, 1);
+        __m256i pid = _mm256_or_si256(_mm256_and_si256(w, pidHi), _mm256_and_si256(_mm256_srli_epi32(w, 16), lowByte));
+        __m256i cc = _mm256_and_si256(_mm256_srli_epi32(w, 24), ccMask);
+        __m256i bad = _mm256_andnot_si256(_mm256_cmpeq_epi32(_mm256_and_si256(w, lowByte), sync), syncErr);
+        __m256i flags = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(w, 8), flagMask), bad);
+
+        /* packs work per 128 bit lane, the permute puts the halves back in order */
+        __m256i pid16 = _mm256_permute4x64_epi64(_mm256_packus_epi32(pid, pid), 0xD8);
+        _mm_storeu_si128((__m128i*)&tb->pid[i], _mm256_castsi256_si128(pid16));
+        __m256i cf16 = _mm256_permute4x64_epi64(_mm256_packus_epi32(cc, flags), 0xD8);
+        __m128i bytes = _mm_packus_epi16(_mm256_castsi256_si128(cf16), _mm256_extracti128_si256(cf16, 1));
+        _mm_storel_epi64((__m128i*)&tb->ccAfc[i], bytes);
+        _mm_storel_epi64((__m128i*)&tb->flags[i], _mm_srli_si128(bytes, 8));
+    }
+    for (; i < tb->count; ++i)
+        lmtTsHdrScalar(tb, i, lmtLoad32(tb->first + i * size));
+}
+#endif
+
+static void (*g_tsHdrs)(lmtTsBatch *tb) = lmtTsHdrsScalar;
+
+const char *lmtTsHdrsInit(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        g_tsHdrs = lmtTsHdrsAvx2;
+        return "AVX2";
+    }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        g_tsHdrs = lmtTsHdrsSse2;
+        return "SSE2";
+    }
+#endif
+    g_tsHdrs = lmtTsHdrsScalar;
+    return "scalar";
+}
+
+/* Fills tb for one datagram, returns -1 if it doesn't carry whole TS packets */
+int lmtTsFrame(const uint8_t *buf, int n, lmtTsBatch *tb, RTP_Header *rtp)
+{
+    int off = 0;
+    int len = n;
+
+    tb->isRtp = false;
+    if (n > 12 && buf[0] != 0x47 && (buf[0] >> 6) == 2)
+    {
+        off = RTP_Header_Parse(rtp, buf, n);
+        if (off < 0)
+            return -1;
+        if (rtp->p)
+            len -= buf[n - 1];
+        tb->isRtp = true;
+    }
+    len -= off;
+    if (len < TS_SIZE || buf[off] != 0x47)
+        return -1;
+
+    if (len % TS_SIZE == 0 && (len == TS_SIZE || buf[off + TS_SIZE] == 0x47))
+        tb->size = TS_SIZE;
+    else if (len % TS_SIZE_FEC == 0 && (len == TS_SIZE_FEC || buf[off + TS_SIZE_FEC] == 0x47))
+        tb->size = TS_SIZE_FEC;
+    else
+        return -1;
+
+    tb->first = buf + off;
+    tb->count = len / tb->size;
+    if (tb->count > TS_MAX_PER_DGRAM)
+        tb->count = TS_MAX_PER_DGRAM;
+    g_tsHdrs(tb);
+    return 0;
+}
+
+/*
+ * ISO/IEC 13818-1 continuity. The state byte of a PID is PID_SEEN | 0x10 | next expected
+ * counter, so a payload-only packet with the right counter costs one load and one compare.
+ * Everything else (first packet, adaptation field, duplicates, errors) goes the slow way.
+ */
+void lmtCheckCcSlow(thread_params *inArg, const uint8_t *p_ts, uint16_t pid)
+{
+    lmtPidTable *tbl = inArg->pids;
+    uint8_t st = tbl->cc[pid];
+    int cc = p_ts[3] & 0x0f;
+    int afc = (p_ts[3] >> 4) & 3;
+    int next = st & 0x0f;
+
+    if (pid == TS_NULL_PID || afc == 0)
+        return;
+
+    if (!(st & PID_SEEN))
+    {
+        if (tbl->activeCnt < TS_PID_COUNT)
+            tbl->active[tbl->activeCnt++] = pid;
+        tbl->cc[pid] = PID_SEEN | 0x10 | ((cc + ((afc & 1) ? 1 : 0)) & 0x0f);
+        return;
+    }
+
+    /* discontinuity_indicator: any counter is fine */
+    if ((afc & 2) && p_ts[4] > 0 && (p_ts[5] & 0x80))
+    {
+        tbl->cc[pid] = PID_SEEN | 0x10 | ((cc + ((afc & 1) ? 1 : 0)) & 0x0f);
+        return;
+    }
+
+    if (afc & 1)
+    {
+        if (cc == next)
+        {
+            tbl->cc[pid] = PID_SEEN | 0x10 | ((cc + 1) & 0x0f);
+            return;
+        }
+        /* one duplicate of the previous packet is allowed */
+        if (cc == ((next - 1) & 0x0f) && !(st & PID_DUP))
+        {
+            tbl->cc[pid] = st | PID_DUP;
+            return;
+        }
+        lmtLog(LMT_EV_CC, inArg->id, pid, next, cc);
+        inArg->mdi->ccLost += (cc - next) & 0x0f;
+        tbl->cc[pid] = PID_SEEN | 0x10 | ((cc + 1) & 0x0f);
+    }
+    else
+    {
+        /* adaptation field only, the counter doesn't move */
+        if (cc == ((next - 1) & 0x0f))
+            return;
+        lmtLog(LMT_EV_CC, inArg->id, pid, (next - 1) & 0x0f, cc);
+        tbl->cc[pid] = PID_SEEN | 0x10 | ((cc + 1) & 0x0f);
+    }
+    tbl->errors[pid]++;
+    if (tbl->svc[pid])
+        inArg->svc.svc[(tbl->svc[pid] & ~SERVICE_PMT) - 1].snap.ccErrors++;
+    inArg->chanInfo.cCerrors++;
+    inArg->chanInfo.tr[TR_CC]++;
+    lmtEvidenceMark(inArg, EVIDENCE_CC);
+}
+
+static inline void lmtCheckCc(thread_params *inArg, uint16_t pid, uint8_t ccAfc, const uint8_t *p_ts)
+{
+    if (__builtin_expect(inArg->pids->cc[pid] == (PID_SEEN | ccAfc), 1))
+    {
+        inArg->pids->cc[pid] = PID_SEEN | 0x10 | ((ccAfc + 1) & 0x0f);
+        return;
+    }
+    lmtCheckCcSlow(inArg, p_ts, pid);
+}
+
+void lmtResetPids(lmtPidTable *tbl)
+{
+    memset(tbl->cc, 0, sizeof(tbl->cc));
+    memset(tbl->errors, 0, sizeof(tbl->errors));
+    memset(tbl->watch, 0, sizeof(tbl->watch));
+    memset(tbl->svc, 0, sizeof(tbl->svc));
+    tbl->activeCnt = 0;
+}
+
+static inline void lmtCopyName(char *out, size_t size, const char *name)
+{
+    strncpy(out, name ? name : "", size - 1);
+    out[size - 1] = '\0';
+}
+
+/* Rewrites the channel's record of the stats segment, same seqlock as lmtPublish() */
+void lmtStatsWrite(thread_params *inArg, const lmtChanSnap *snap)
+{
+    lmtStatRec *rec = inArg->stat;
+    const lmtChanInfo *info = &snap->chanInfo;
+    unsigned int seq = rec->seq;
+
+    __atomic_store_n(&rec->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    rec->updated = lmtNowNs();
+    rec->isStream = snap->isStream;
+    rec->streamType = !info->sStreamType ? LMT_STREAM_NONE : !strcmp(info->sStreamType, "UDP") ? LMT_STREAM_UDP
+        : !strcmp(info->sStreamType, "RTP") ? LMT_STREAM_RTP : LMT_STREAM_ERROR;
+    rec->bitrate = info->sBitrate;
+    rec->bitrateAvg = info->sBitrateAvg;
+    rec->nullBitrate = info->sNullBitrate;
+    rec->oneMinuteCC = snap->oneMinuteCC;
+    rec->tsPacketSize = info->tsPacketSize;
+    rec->patParsed = info->sPatParsed;
+    rec->pmtParsed = info->pmtParsed;
+    rec->sid = info->sSid;
+    rec->pmtPid = info->sPmt;
+    rec->pcrPid = info->sPcr;
+    rec->vPid = info->sVpid.pid;
+    rec->patVersion = info->sPatParsed ? info->sPatVer : -1;
+    rec->pmtVersion = info->pmtParsed ? info->sPmtVer : -1;
+    rec->aPidCnt = info->aPidCnt < LMT_STATS_MAX_APIDS ? info->aPidCnt : LMT_STATS_MAX_APIDS;
+    lmtCopyName(rec->vFormat, sizeof(rec->vFormat), info->sVpid.pFormat);
+    for (int i = 0; i < rec->aPidCnt; ++i)
+    {
+        rec->aPids[i] = info->sApid[i].pid;
+        lmtCopyName(rec->aFormat[i], sizeof(rec->aFormat[i]), info->sApid[i].pFormat);
+    }
+    rec->patChanges = info->patChanges;
+    rec->pmtChanges = info->pmtChanges;
+    for (int i = 0; i < TR_COUNT; ++i)
+        rec->tr[i] = info->tr[i];
+    rec->trActive = info->trActive;
+    rec->mdiDf = snap->mdi.df;
+    rec->mdiMlr = snap->mdi.mlr;
+    rec->pcrJitterP99Us = snap->pcr.jitterP99Us;
+    rec->pcrDriftPpm = snap->pcr.driftPpm;
+    rec->rtpLost = info->rtpLost;
+    rec->kernelDrops = snap->probe.drops;
+    rec->truncated = snap->probe.truncated;
+    rec->rcvbuf = snap->probe.rcvbuf;
+    rec->parseP99Ns = snap->probe.parseP99Ns;
+    rec->queueP99Us = snap->probe.queueP99Us;
+    rec->rxCpu = snap->probe.rxCpu;
+    rec->parseCpu = snap->probe.parseCpu;
+    rec->napiId = snap->probe.napiId;
+    rec->alarms = snap->alarms;
+    rec->rtpJitterUs = snap->rtp.jitterUs;
+    rec->rtpReordered = snap->rtp.reordered;
+    rec->rtpLate = snap->rtp.late;
+    rec->rtpDuplicates = snap->rtp.duplicates;
+    rec->fecRecoverable = snap->rtp.fecRecoverable;
+    rec->fecUnrecoverable = snap->rtp.fecUnrecoverable;
+    rec->pidCnt = snap->pidCnt < LMT_STATS_MAX_PIDS ? snap->pidCnt : LMT_STATS_MAX_PIDS;
+    for (int i = 0; i < rec->pidCnt; ++i)
+    {
+        rec->pids[i].pid = snap->pids[i].pid;
+        rec->pids[i].ccErrors = snap->pids[i].ccErrors;
+        rec->pidMbps[i] = snap->pids[i].mbps;
+    }
+    rec->serviceCnt = snap->serviceCnt;
+    for (int i = 0; i < snap->serviceCnt && i < LMT_STATS_MAX_SERVICES; ++i)
+    {
+        const lmtServiceSnap *svc = &snap->services[i];
+        lmtStatService *out = &rec->services[i];
+        out->sid = svc->sid;
+        out->pmtPid = svc->pmtPid;
+        out->pcrPid = svc->pcrPid;
+        out->vPid = svc->vPid;
+        out->esCnt = svc->esCnt < 255 ? svc->esCnt : 255;
+        out->present = svc->present;
+        out->pmtVersion = svc->pmtVersion;
+        out->pmtChanges = svc->pmtChanges;
+        out->ccErrors = svc->ccErrors;
+        out->mbps = svc->mbps;
+    }
+    __atomic_store_n(&rec->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/* Seqlock writer, there is exactly one parser per channel */
+void lmtPublish(thread_params *inArg)
+{
+    unsigned int seq = inArg->pub.seq;
+
+    __atomic_store_n(&inArg->pub.seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    inArg->pub.snap.id = inArg->id;
+    inArg->pub.snap.isStream = inArg->isStream;
+    inArg->pub.snap.chanInfo = inArg->chanInfo;
+    inArg->pub.snap.oneMinuteCC = inArg->hist.hdr ? inArg->hist.hdr->sums[0].ccErrors : 0;
+    inArg->pub.snap.alarms = inArg->alarm.active;
+    inArg->pub.snap.pcr = inArg->pcr->snap;
+    inArg->pub.snap.mdi = inArg->mdi->snap;
+    inArg->pub.snap.rtp = inArg->rtp->snap;
+    inArg->pub.snap.probe = inArg->probe->snap;
+    inArg->pub.snap.pidCnt = 0;
+    for (int i = 0; inArg->pids && i < inArg->pids->activeCnt && i < SNAP_MAX_PIDS; ++i)
+    {
+        uint16_t pid = inArg->pids->active[i];
+        inArg->pub.snap.pids[i].pid = pid;
+        inArg->pub.snap.pids[i].ccErrors = inArg->pids->errors[pid];
+        inArg->pub.snap.pids[i].mbps = inArg->meter->rate[pid];
+        inArg->pub.snap.pidCnt++;
+    }
+    inArg->pub.snap.serviceCnt = inArg->svc.count;
+    for (int i = 0; i < inArg->svc.count && i < SNAP_MAX_SERVICES; ++i)
+        inArg->pub.snap.services[i] = inArg->svc.svc[i].snap;
+    __atomic_store_n(&inArg->pub.seq, seq + 2, __ATOMIC_RELEASE);
+
+    if (inArg->stat)
+        lmtStatsWrite(inArg, &inArg->pub.snap);
+}
+
+/* Seqlock reader, retries instead of ever making the parser wait */
+void lmtSnapRead(thread_params *chan, lmtChanSnap *out)
+{
+    unsigned int s1, s2;
+
+    do
+    {
+        s1 = __atomic_load_n(&chan->pub.seq, __ATOMIC_ACQUIRE);
+        if (s1 & 1)
+        {
+            sched_yield();
+            continue;
+        }
+        memcpy(out, &chan->pub.snap, sizeof(lmtChanSnap));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        s2 = __atomic_load_n(&chan->pub.seq, __ATOMIC_RELAXED);
+        if (s1 == s2)
+            return;
+    } while(1);
+}
+
+/*
+ * Stats segment, see lmtstats.h. A name without any further '/' is a POSIX shared
+ * memory object, anything else a file that gets mmap'd (put it on tmpfs).
+ */
+_Static_assert(TR_COUNT <= LMT_STATS_TR_COUNT, "TR indicators don't fit the stats record");
+
+/* First free record for the channel, readers see it from the next lmtPublish() on */
+void lmtStatsAttach(lmtStatsHdr *hdr, thread_params *chan)
+{
+    for (uint32_t i = 0; i < hdr->capacity; ++i)
+    {
+        lmtStatRec *rec = (lmtStatRec *)((char *)hdr + hdr->hdrSize) + i;
+        if (rec->mcastAddr)
+            continue;
+        rec->id = chan->id;
+        rec->port = chan->port;
+        __atomic_store_n(&rec->mcastAddr, inet_addr(chan->mcastAddr), __ATOMIC_RELEASE);
+        if (i >= hdr->chanCount)
+            __atomic_store_n(&hdr->chanCount, i + 1, __ATOMIC_RELEASE);
+        chan->stat = rec;
+        return;
+    }
+    logWithTime("[WARNING] Channel: %d no room left in the stats segment, restart to resize it", chan->id);
+}
+
+/* Once the parser is done with the channel, the record goes back to being a free slot */
+void lmtStatsDetach(thread_params *chan)
+{
+    lmtStatRec *rec = chan->stat;
+
+    if (!rec)
+        return;
+    unsigned int seq = rec->seq;
+    __atomic_store_n(&rec->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memset((char *)rec + sizeof(rec->seq), 0, sizeof(lmtStatRec) - sizeof(rec->seq));
+    __atomic_store_n(&rec->seq, seq + 2, __ATOMIC_RELEASE);
+    chan->stat = NULL;
+}
+
+int lmtStatsOpen(const char *name, thread_params **chans, int count)
+{
+    uint32_t capacity = count + count / 2 + STATS_SPARE_SLOTS;
+    size_t size = sizeof(lmtStatsHdr) + (size_t)capacity * sizeof(lmtStatRec);
+    bool isShm = name[0] == '/' && !strchr(name + 1, '/');
+
+    /* a fresh object every start, readers still mapping the old one must not see it shrink */
+    if (isShm)
+        shm_unlink(name);
+    else
+        unlink(name);
+    int fd = isShm ? shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644) : open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+
+    if (fd < 0)
+    {
+        logWithTime("[ERROR] stats %s: %s", name, strerror(errno));
+        return -1;
+    }
+    if (ftruncate(fd, size) < 0)
+    {
+        logWithTime("[ERROR] stats %s: ftruncate: %s", name, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    lmtStatsHdr *hdr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (hdr == MAP_FAILED)
+    {
+        logWithTime("[ERROR] stats %s: mmap: %s", name, strerror(errno));
+        return -1;
+    }
+
+    hdr->version = LMT_STATS_VERSION;
+    hdr->hdrSize = sizeof(lmtStatsHdr);
+    hdr->recSize = sizeof(lmtStatRec);
+    hdr->capacity = capacity;
+    hdr->writerPid = getpid();
+    hdr->startTime = time(NULL);
+    for (int i = 0; i < count; ++i)
+    {
+        lmtStatsAttach(hdr, chans[i]);
+        lmtPublish(chans[i]);
+    }
+    /* readers go by the magic, it goes in last */
+    __atomic_store_n(&hdr->magic, LMT_STATS_MAGIC, __ATOMIC_RELEASE);
+    g_reg.stats = hdr;
+    logWithTime("stats segment %s, %d channels, room for %u, %zu bytes", name, count, capacity, size);
+    return 0;
+}
+
+static inline lmtHistoryRec *lmtHistorySlot(lmtHistoryHdr *hdr, uint32_t sec)
+{
+    return (lmtHistoryRec *)lmtHistoryAt(hdr, sec);
+}
+
+static void lmtHistorySumRec(lmtHistorySum *sum, const lmtHistoryRec *rec, int sign)
+{
+    sum->present += sign * (rec->flags & LMT_HIST_PRESENT ? 1 : 0);
+    sum->errored += sign * (rec->ccErrors || rec->rtpLost ? 1 : 0);
+    sum->pcrDisc += sign * rec->pcrDisc;
+    sum->ccErrors += (int64_t)sign * rec->ccErrors;
+    sum->rtpLost += (int64_t)sign * rec->rtpLost;
+    sum->kbps += (int64_t)sign * rec->bitrateKbps;
+}
+
+/* The window sums from the records up to lastSec, for a file just mapped or a clock that went back */
+static void lmtHistoryResum(lmtHistoryHdr *hdr)
+{
+    for (int w = 0; w < LMT_HISTORY_WINDOWS; ++w)
+    {
+        lmtHistorySum *sum = &hdr->sums[w];
+        memset(sum, 0, sizeof(lmtHistorySum));
+        sum->window = g_lmtHistoryWindows[w];
+        for (uint32_t i = 0; i < sum->window && i < hdr->lastSec; ++i)
+        {
+            const lmtHistoryRec *rec = lmtHistoryAt(hdr, hdr->lastSec - i);
+            if (rec->sec == hdr->lastSec - i)
+                lmtHistorySumRec(sum, rec, 1);
+        }
+    }
+}
+
+/* Writes the second after lastSec, what leaves a window comes off its sum first as it may share the slot */
+static void lmtHistoryStep(lmtHistoryHdr *hdr, const lmtHistoryRec *rec)
+{
+    for (int w = 0; w < LMT_HISTORY_WINDOWS; ++w)
+    {
+        uint32_t gone = rec->sec - hdr->sums[w].window;
+        const lmtHistoryRec *old = lmtHistoryAt(hdr, gone);
+        if (old->sec == gone)
+            lmtHistorySumRec(&hdr->sums[w], old, -1);
+    }
+    *lmtHistorySlot(hdr, rec->sec) = *rec;
+    for (int w = 0; w < LMT_HISTORY_WINDOWS; ++w)
+        lmtHistorySumRec(&hdr->sums[w], rec, 1);
+    hdr->lastSec = rec->sec;
+}
+
+/*
+ * <id>.hist mapped, a file of another retention or channel starts over. The flock keeps a
+ * second writer out: the old parser of a restarted channel has it until it is reaped, so a
+ * locked file is tried again every second for a while. NULL to stay in memory or to retry.
+ */
+lmtHistoryHdr *lmtHistoryFile(thread_params *chan, size_t size, uint32_t now)
+{
+    lmtHistory *h = &chan->hist;
+    lmtHistoryHdr old;
+    struct stat st;
+    int fd = open(h->path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    int err = fd < 0 ? errno : flock(fd, LOCK_EX | LOCK_NB) < 0 ? errno : fstat(fd, &st) < 0 ? errno : 0;
+
+    if (err == EWOULDBLOCK && ++h->retries < HISTORY_RETRIES)
+    {
+        close(fd);
+        h->retrySec = now + 1;
+        return NULL;
+    }
+    if (!err)
+    {
+        bool same = st.st_size == (off_t)size && pread(fd, &old, sizeof(old), 0) == sizeof(old) && old.magic == LMT_HISTORY_MAGIC &&
+            old.version == LMT_HISTORY_VERSION && old.hdrSize == sizeof(lmtHistoryHdr) && old.recSize == sizeof(lmtHistoryRec) &&
+            old.slots == h->slots && old.id == chan->id;
+        lmtHistoryHdr *hdr = MAP_FAILED;
+        if ((same || (ftruncate(fd, 0) == 0 && ftruncate(fd, size) == 0)) &&
+            (hdr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) != MAP_FAILED)
+        {
+            h->fd = fd;
+            if (same)
+            {
+                lmtHistoryResum(hdr);
+                logWithTime("Channel: %d history %s continues, last written %u s ago", chan->id, h->path, now - hdr->lastSec);
+            }
+            return hdr;
+        }
+        err = errno;
+    }
+    logWithTime("[WARNING] Channel: %d history %s: %s, kept in memory only", chan->id, h->path,
+        err == EWOULDBLOCK ? "another discont writes it" : strerror(err));
+    if (fd >= 0)
+        close(fd);
+    free(h->path);
+    h->path = NULL;
+    return NULL;
+}
+
+/* Maps the history on the parser's first second, anonymous memory when there is no file so the windows still work */
+void lmtHistoryMap(thread_params *chan, uint32_t now)
+{
+    lmtHistory *h = &chan->hist;
+    size_t size = sizeof(lmtHistoryHdr) + (size_t)h->slots * sizeof(lmtHistoryRec);
+    lmtHistoryHdr *hdr = h->path ? lmtHistoryFile(chan, size, now) : NULL;
+
+    if (!hdr && h->path)
+        return;
+    if (!hdr)
+    {
+        hdr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (hdr == MAP_FAILED)
+        {
+            logWithTime("[ERROR] Channel: %d no memory for its history", chan->id);
+            h->retrySec = UINT32_MAX;
+            return;
+        }
+    }
+    if (hdr->magic != LMT_HISTORY_MAGIC)
+    {
+        hdr->version = LMT_HISTORY_VERSION;
+        hdr->hdrSize = sizeof(lmtHistoryHdr);
+        hdr->recSize = sizeof(lmtHistoryRec);
+        hdr->slots = h->slots;
+        hdr->id = chan->id;
+        hdr->created = time(NULL);
+        lmtHistoryResum(hdr);
+        __atomic_store_n(&hdr->magic, LMT_HISTORY_MAGIC, __ATOMIC_RELEASE);
+    }
+    hdr->mcastAddr = inet_addr(chan->mcastAddr);
+    hdr->port = chan->port;
+    h->hdr = hdr;
+    h->size = size;
+}
+
+/*
+ * One second into the history. A second that comes again adds to the record there, the
+ * seconds skipped since the last one were present if the channel didn't time out in
+ * between, a window that took a little over 1 s, and absent otherwise.
+ */
+void lmtHistoryPut(thread_params *chan, lmtHistoryRec *rec)
+{
+    lmtHistory *h = &chan->hist;
+
+    if (!h->hdr)
+    {
+        if (rec->sec < h->retrySec)
+            return;
+        lmtHistoryMap(chan, rec->sec);
+        if (!h->hdr)
+            return;
+    }
+    lmtHistoryHdr *hdr = h->hdr;
+    uint32_t seq = hdr->seq;
+
+    __atomic_store_n(&hdr->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    if (rec->sec == hdr->lastSec)
+    {
+        lmtHistoryRec *cur = lmtHistorySlot(hdr, rec->sec);
+        for (int w = 0; w < LMT_HISTORY_WINDOWS; ++w)
+            lmtHistorySumRec(&hdr->sums[w], cur, -1);
+        rec->ccErrors += cur->ccErrors;
+        rec->rtpLost += cur->rtpLost;
+        rec->pcrDisc = rec->pcrDisc + cur->pcrDisc < 255 ? rec->pcrDisc + cur->pcrDisc : 255;
+        rec->trActive |= cur->trActive;
+        rec->flags |= cur->flags;
+        if (!(rec->flags & LMT_HIST_PRESENT))
+            rec->bitrateKbps = cur->bitrateKbps;
+        *cur = *rec;
+        for (int w = 0; w < LMT_HISTORY_WINDOWS; ++w)
+            lmtHistorySumRec(&hdr->sums[w], cur, 1);
+    }
+    else
+    {
+        if (rec->sec < hdr->lastSec || rec->sec - hdr->lastSec > LMT_HISTORY_MIN_SLOTS)
+        {
+            hdr->lastSec = rec->sec - 1;
+            lmtHistoryResum(hdr);
+        }
+        bool filled = h->present && (rec->flags & LMT_HIST_PRESENT) && rec->sec - hdr->lastSec <= READ_TIMEOUT + 1;
+        for (uint32_t sec = hdr->lastSec + 1; sec < rec->sec; ++sec)
+        {
+            lmtHistoryRec gap = { .sec = sec };
+            if (filled)
+            {
+                gap.flags = rec->flags & (LMT_HIST_PRESENT | LMT_HIST_PAT | LMT_HIST_PMT | LMT_HIST_RTP);
+                gap.bitrateKbps = rec->bitrateKbps;
+            }
+            lmtHistoryStep(hdr, &gap);
+        }
+        lmtHistoryStep(hdr, rec);
+    }
+    h->present = rec->flags & LMT_HIST_PRESENT;
+    __atomic_store_n(&hdr->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/* The second a 1 s window closed in, by its last arrival so that a replay is filed under capture time */
+void lmtHistorySecond(thread_params *inArg, uint32_t sec)
+{
+    lmtHistory *h = &inArg->hist;
+    const lmtChanInfo *info = &inArg->chanInfo;
+    int pcrDisc = info->tr[TR_PCR_DISC] - h->pcrDiscPrev;
+    lmtHistoryRec rec =
+        {
+        .sec = sec,
+        .bitrateKbps = info->sBitrate * 1000 + 0.5,
+        .ccErrors = info->cCerrors,
+        .rtpLost = info->rtpLost - h->rtpLostPrev,
+        .pcrJitterP99Us = inArg->pcr->snap.count ? inArg->pcr->snap.jitterP99Us : 0,
+        .mdiDf = inArg->mdi->snap.df,
+        .mdiMlr = inArg->mdi->snap.mlr,
+        .trActive = info->trActive,
+        .flags = LMT_HIST_PRESENT | (info->sPatParsed ? LMT_HIST_PAT : 0) | (info->pmtParsed ? LMT_HIST_PMT : 0) |
+            (inArg->rtp->started ? LMT_HIST_RTP : 0) | (inArg->pcr->snap.count ? LMT_HIST_PCR : 0),
+        .pcrDisc = pcrDisc < 255 ? pcrDisc : 255,
+        };
+
+    inArg->chanInfo.cCerrors = 0;
+    h->rtpLostPrev = info->rtpLost;
+    h->pcrDiscPrev = info->tr[TR_PCR_DISC];
+    lmtHistoryPut(inArg, &rec);
+}
+
+void lmtHistoryClose(lmtHistory *h)
+{
+    if (h->hdr)
+        munmap(h->hdr, h->size);
+    if (h->fd >= 0)
+        close(h->fd);
+    free(h->path);
+}
+
+/* Debounces one condition, an alarm only changes after it disagreed for the whole raise or clear time */
+static void lmtAlarmEdge(thread_params *chan, uint32_t sec, int alarm, bool cond, int value, int raiseSecs)
+{
+    lmtAlarms *a = &chan->alarm;
+    bool active = a->active & (1u << alarm);
+
+    if (cond == active)
+    {
+        a->held[alarm] = 0;
+        return;
+    }
+    if (++a->held[alarm] < (active ? g_alarm.clearSecs : raiseSecs))
+        return;
+    a->held[alarm] = 0;
+    a->active ^= 1u << alarm;
+    if (active)
+        lmtAlarmPush(sec, chan->id, alarm, ALARM_CLEARED, sec - a->since[alarm], 0);
+    else
+    {
+        a->since[alarm] = sec;
+        lmtAlarmPush(sec, chan->id, alarm, ALARM_RAISED, value, 0);
+    }
+}
+
+/*
+ * A closed window against the alarm conditions, after the history took it so the minute's
+ * CC sum is current. Each channel is looked at by its own parser as its data comes in,
+ * the cost doesn't grow with the channel count and nothing scans the channels.
+ */
+void lmtAlarmWindow(thread_params *inArg, uint32_t sec)
+{
+    const lmtChanInfo *info = &inArg->chanInfo;
+    lmtAlarms *a = &inArg->alarm;
+    unsigned int tr = info->trActive;
+    int cc = inArg->hist.hdr ? inArg->hist.hdr->sums[0].ccErrors : 0;
+    bool ccUp = a->active & (1u << ALARM_CC), rateUp = a->active & (1u << ALARM_BITRATE);
+
+    lmtAlarmEdge(inArg, sec, ALARM_NO_DATA, false, 0, 1);
+    lmtAlarmEdge(inArg, sec, ALARM_PAT, !info->sPatParsed || (tr & (1 << TR_PAT)), g_alarm.raiseSecs, g_alarm.raiseSecs);
+    lmtAlarmEdge(inArg, sec, ALARM_PMT, info->sPatParsed && (!info->pmtParsed || (tr & (1 << TR_PMT))), g_alarm.raiseSecs, g_alarm.raiseSecs);
+    if (g_alarm.ccRaise > 0)
+        lmtAlarmEdge(inArg, sec, ALARM_CC, ccUp ? cc > g_alarm.ccClear : cc >= g_alarm.ccRaise, cc, 1);
+    if (inArg->bitrateMin > 0 || inArg->bitrateMax > 0)
+    {
+        double margin = rateUp ? g_alarm.hysteresis : 0;
+        bool out = info->sBitrate < inArg->bitrateMin * (1 + margin) || (inArg->bitrateMax > 0 && info->sBitrate > inArg->bitrateMax * (1 - margin));
+        lmtAlarmEdge(inArg, sec, ALARM_BITRATE, out, info->sBitrate * 1000 + 0.5, g_alarm.raiseSecs);
+    }
+
+    /* changes are events of their own, the first PAT and PMT are no change */
+    if (info->patChanges != a->patChanges)
+        lmtAlarmPush(sec, inArg->id, ALARM_PAT_CHANGED, ALARM_EVENT, inArg->psi->patVersion, 0);
+    if (info->pmtChanges != a->pmtChanges)
+        lmtAlarmPush(sec, inArg->id, ALARM_PMT_CHANGED, ALARM_EVENT, info->sPmtVer, 0);
+    if (info->pmtChanges != a->pmtChanges && info->aPidCnt != a->aPidCnt)
+        lmtAlarmPush(sec, inArg->id, ALARM_AUDIO_TRACKS, ALARM_EVENT, info->aPidCnt, a->aPidCnt);
+    a->patChanges = info->patChanges;
+    a->pmtChanges = info->pmtChanges;
+    if (info->pmtParsed)
+        a->aPidCnt = info->aPidCnt;
+}
+
+/* The receive timeout raises ALARM_NO_DATA at once, the other conditions wait for data to be judged again */
+void lmtAlarmIdle(thread_params *chan, uint32_t sec)
+{
+    lmtAlarms *a = &chan->alarm;
+
+    memset(a->held, 0, sizeof(a->held));
+    lmtAlarmEdge(chan, sec, ALARM_NO_DATA, true, READ_TIMEOUT, 1);
+    a->patChanges = 0;
+    a->pmtChanges = 0;
+    a->aPidCnt = 0;
+}
+
+/* A channel a reload removed clears what it had raised, on the main thread once its parser let go */
+void lmtAlarmRetire(thread_params *chan)
+{
+    uint32_t sec = time(NULL);
+
+    for (int i = 0; i < ALARM_STATES; ++i)
+    {
+        if (chan->alarm.active & (1u << i))
+            lmtAlarmPush(sec, chan->id, i, ALARM_CLEARED, sec - chan->alarm.since[i], 0);
+    }
+    chan->alarm.active = 0;
+}
+
+/*
+ * Log-linear histogram, HIST_SUB sub buckets per power of two (~12% resolution).
+ * Adding is a clz and an increment, percentiles are only worked out at window close.
+ */
+static inline int lmtHistIndex(unsigned long long v)
+{
+    if (v < HIST_SUB)
+        return (int)v;
+    int e = 63 - __builtin_clzll(v);
+    int idx = (e - HIST_SUB_BITS + 1) * HIST_SUB + (int)((v >> (e - HIST_SUB_BITS)) & (HIST_SUB - 1));
+    return idx < HIST_BUCKETS ? idx : HIST_BUCKETS - 1;
+}
+
+static inline unsigned long long lmtHistValue(int idx)
+{
+    if (idx < HIST_SUB)
+        return idx;
+    int e = idx / HIST_SUB + HIST_SUB_BITS - 1;
+    return ((unsigned long long)(HIST_SUB + (idx % HIST_SUB) + 1) << (e - HIST_SUB_BITS)) - 1;
+}
+
+static inline void lmtHistAdd(lmtHist *h, long long v)
+{
+    if (v < 0)
+        v = 0;
+    h->counts[lmtHistIndex(v)]++;
+    h->total++;
+    if (v > h->max)
+        h->max = v;
+}
+
+/* upper bound of the bucket holding the q quantile */
+long long lmtHistPercentile(const lmtHist *h, double q)
+{
+    unsigned long long want = (unsigned long long)(q * h->total + 0.5), seen = 0;
+
+    if (h->total == 0)
+        return 0;
+    if (want == 0)
+        want = 1;
+    for (int i = 0; i < HIST_BUCKETS; ++i)
+    {
+        seen += h->counts[i];
+        if (seen >= want)
+            return (long long)lmtHistValue(i) < h->max ? (long long)lmtHistValue(i) : h->max;
+    }
+    return h->max;
+}
+
+/*
+ * PCR analysis. Interval is measured in PCR time. Jitter is the arrival offset of
+ * each PCR against the PCR clock with the measured drift taken out, relative to the
+ * best (earliest) offset of the previous window. Everything is per PCR O(1), the
+ * window close re-anchors the clocks and refreshes the drift estimate. Drift is
+ * taken over the whole run so the arrival jitter averages out as it grows.
+ */
+void lmtPcrPacket(thread_params *inArg, const uint8_t *p_ts, long long arrival)
+{
+    lmtPcrStats *ps = inArg->pcr;
+
+    if (p_ts[4] < 7 || !(p_ts[5] & 0x10))
+        return;
+
+    uint64_t base = ((uint64_t)p_ts[6] << 25) | ((uint64_t)p_ts[7] << 17) | ((uint64_t)p_ts[8] << 9) | ((uint64_t)p_ts[9] << 1) | (p_ts[10] >> 7);
+    uint64_t pcr = base * 300 + (((p_ts[10] & 1) << 8) | p_ts[11]);
+    long long d = (long long)((pcr + PCR_WRAP - ps->prevPcr) % PCR_WRAP);
+    bool disc = p_ts[5] & 0x80;
+
+    if (!ps->havePrev || disc || d == 0 || d > PCR_MAX_GAP)
+    {
+        if (ps->havePrev && !disc)
+        {
+            ps->discontinuities++;
+            inArg->chanInfo.tr[TR_PCR_DISC]++;
+        }
+        ps->havePrev = true;
+        ps->haveFloor = false;
+        ps->prevPcr = pcr;
+        ps->prevArr = arrival;
+        ps->anchorArr = arrival;
+        ps->startArr = arrival;
+        ps->pcrSpan = 0;
+        ps->totalSpan = 0;
+        ps->drift = 0;
+        ps->offMin = ps->offMax = ps->offLast = 0;
+        return;
+    }
+
+    if (arrival - ps->prevArr > TR_PCR_REP_NS)
+        inArg->chanInfo.tr[TR_PCR_REP]++;
+
+    long long dNs = d * 1000 / 27;
+    lmtHistAdd(&ps->interval, dNs);
+    if (ps->count == 0 || dNs < ps->ivMin)
+        ps->ivMin = dNs;
+    if (dNs > ps->ivMax)
+        ps->ivMax = dNs;
+    ps->ivSum += dNs;
+    ps->count++;
+
+    ps->pcrSpan += d;
+    ps->totalSpan += d;
+    long long pcrNs = ps->pcrSpan * 1000 / 27;
+    long long off = (arrival - ps->anchorArr) - pcrNs - (long long)(ps->drift * pcrNs);
+    if (off < ps->offMin)
+        ps->offMin = off;
+    if (off > ps->offMax)
+        ps->offMax = off;
+    ps->offLast = off;
+    if (ps->haveFloor)
+        lmtHistAdd(&ps->jitter, off - ps->floor);
+
+    ps->prevPcr = pcr;
+    ps->prevArr = arrival;
+}
+
+void lmtPcrWindow(thread_params *inArg)
+{
+    lmtPcrStats *ps = inArg->pcr;
+    lmtPcrSnap *out = &ps->snap;
+
+    out->pid = inArg->chanInfo.sPcr;
+    out->count = ps->count;
+    out->discontinuities = ps->discontinuities;
+    out->ivMinMs = ps->count ? ps->ivMin / 1e6 : 0;
+    out->ivAvgMs = ps->count ? ps->ivSum / 1e6 / ps->count : 0;
+    out->ivMaxMs = ps->count ? ps->ivMax / 1e6 : 0;
+    out->ivP99Ms = lmtHistPercentile(&ps->interval, 0.99) / 1e6;
+    out->jitterP50Us = lmtHistPercentile(&ps->jitter, 0.50) / 1000;
+    out->jitterP99Us = lmtHistPercentile(&ps->jitter, 0.99) / 1000;
+    out->jitterMaxUs = ps->jitter.max / 1000;
+    out->jitterP2pUs = (ps->offMax - ps->offMin) / 1000;
+
+    if (ps->count >= 2 && ps->pcrSpan > 0)
+    {
+        long long totalNs = ps->totalSpan * 1000 / 27;
+        if (totalNs >= PCR_DRIFT_MIN_NS)
+        {
+            ps->drift = (double)(ps->prevArr - ps->startArr - totalNs) / totalNs;
+            out->driftPpm = -ps->drift * 1e6;
+        }
+
+        /* next window is anchored on the last PCR, carry the best offset over into its frame */
+        ps->floor = ps->offMin - ps->offLast;
+        ps->haveFloor = true;
+        ps->anchorArr = ps->prevArr;
+        ps->pcrSpan = 0;
+        ps->offMin = ps->offMax = ps->offLast = 0;
+    }
+    ps->count = 0;
+    ps->ivMin = ps->ivMax = ps->ivSum = 0;
+    memset(&ps->interval, 0, sizeof(lmtHist));
+    memset(&ps->jitter, 0, sizeof(lmtHist));
+}
+
+/*
+ * RFC 4445 Media Delivery Index. The virtual buffer fills with the TS bytes of each
+ * datagram as it arrives and drains at the rate measured over the previous window,
+ * DF is its swing in ms of that rate. MLR is lost media packets per second, from RTP
+ * sequence gaps or TS continuity, whichever saw more.
+ */
+static inline void lmtMdiDgram(lmtMdi *m, int bytes, long long arrival)
+{
+    if (!m->winStart)
+    {
+        m->winStart = arrival;
+        m->firstBytes = bytes;
+        m->vbMin = 0;
+        m->vbMax = bytes;
+    }
+    else if (m->rate > 0)
+    {
+        double vb = m->bytes - m->rate * (arrival - m->winStart) / 1e9;
+        if (vb < m->vbMin)
+            m->vbMin = vb;
+        if (vb + bytes > m->vbMax)
+            m->vbMax = vb + bytes;
+    }
+    m->bytes += bytes;
+    m->lastArr = arrival;
+}
+
+void lmtMdiWindow(thread_params *inArg)
+{
+    lmtMdi *m = inArg->mdi;
+    lmtMdiSnap *out = &m->snap;
+    long long dur = m->lastArr - m->winStart;
+    long long lost = m->rtpLost > m->ccLost ? m->rtpLost : m->ccLost;
+
+    if (!m->winStart || dur <= 0)
+        return;
+
+    out->df = m->rate > 0 ? (m->vbMax - m->vbMin) / m->rate * 1000 : 0;
+    out->mlr = lost * 1e9 / dur;
+    m->dfHist[m->histIdx] = out->df;
+    m->mlrHist[m->histIdx] = out->mlr;
+    m->histIdx = (m->histIdx + 1) % MDI_MINUTE;
+    if (m->histCnt < MDI_MINUTE)
+        m->histCnt++;
+
+    /* 1 min: worst DF and the average loss rate */
+    out->dfMinute = 0;
+    out->mlrMinute = 0;
+    for (int i = 0; i < m->histCnt; ++i)
+    {
+        if (m->dfHist[i] > out->dfMinute)
+            out->dfMinute = m->dfHist[i];
+        out->mlrMinute += m->mlrHist[i];
+    }
+    out->mlrMinute /= m->histCnt;
+
+    m->rate = (double)(m->bytes - m->firstBytes) * 1e9 / dur;
+    m->winStart = 0;
+    m->bytes = 0;
+    m->rtpLost = 0;
+    m->ccLost = 0;
+}
+
+/* What the kernel made of the asked for rcvbuf, once the socket is set up */
+void lmtProbeSocket(lmtProbe *pr, int sok)
+{
+    socklen_t len = sizeof(pr->snap.rcvbuf);
+    getsockopt(sok, SOL_SOCKET, SO_RCVBUF, &pr->snap.rcvbuf, &len);
+    pr->fd = sok;
+}
+
+static inline void lmtProbeDgram(lmtProbe *pr, long long queueNs, long long parseNs)
+{
+    lmtHistAdd(&pr->queue, queueNs);
+    lmtHistAdd(&pr->parse, parseNs);
+}
+
+/* the counter on the last datagram of a batch covers the whole batch */
+static inline void lmtProbeDrops(lmtProbe *pr, struct msghdr *msg)
+{
+    uint32_t ovfl;
+    if (lmtMsgDrops(msg, &ovfl))
+    {
+        pr->snap.drops += (uint32_t)(ovfl - pr->ovfl);
+        pr->ovfl = ovfl;
+    }
+}
+
+void lmtProbeWindow(thread_params *inArg)
+{
+    lmtProbe *pr = inArg->probe;
+
+    pr->snap.dgrams = pr->parse.total;
+    pr->snap.parseP50Ns = lmtHistPercentile(&pr->parse, 0.5);
+    pr->snap.parseP99Ns = lmtHistPercentile(&pr->parse, 0.99);
+    pr->snap.parseMaxNs = pr->parse.max;
+    pr->snap.queueP50Us = lmtHistPercentile(&pr->queue, 0.5) / 1000;
+    pr->snap.queueP99Us = lmtHistPercentile(&pr->queue, 0.99) / 1000;
+    pr->snap.queueMaxUs = pr->queue.max / 1000;
+    pr->snap.dropsWindow = pr->snap.drops - pr->dropsPrev;
+    pr->dropsPrev = pr->snap.drops;
+
+    /*
+     * softirq on one node and parsing on another is what placement is there to avoid. The
+     * kernel only keeps the incoming CPU of connected UDP sockets, the NAPI id (which
+     * receive queue) it keeps for all.
+     */
+    socklen_t len = sizeof(int);
+    pr->snap.rxCpu = -1;
+    pr->snap.napiId = 0;
+    if (pr->fd >= 0)
+    {
+        getsockopt(pr->fd, SOL_SOCKET, SO_INCOMING_CPU, &pr->snap.rxCpu, &len);
+        len = sizeof(pr->snap.napiId);
+        getsockopt(pr->fd, SOL_SOCKET, SO_INCOMING_NAPI_ID, &pr->snap.napiId, &len);
+    }
+    pr->snap.parseCpu = sched_getcpu();
+    memset(&pr->parse, 0, sizeof(lmtHist));
+    memset(&pr->queue, 0, sizeof(lmtHist));
+}
+
+/* RTP receive statistics, see lmtRtp. Bits are per extended sequence number, the window's slot of it */
+
+static inline bool lmtRtpBit(const uint64_t *bits, long long ext)
+{
+    unsigned int i = ext & (RTP_WINDOW - 1);
+    return bits[i >> 6] & (1ULL << (i & 63));
+}
+
+static inline void lmtRtpSet(uint64_t *bits, long long ext)
+{
+    unsigned int i = ext & (RTP_WINDOW - 1);
+    bits[i >> 6] |= 1ULL << (i & 63);
+}
+
+static inline void lmtRtpClear(uint64_t *bits, long long ext)
+{
+    unsigned int i = ext & (RTP_WINDOW - 1);
+    bits[i >> 6] &= ~(1ULL << (i & 63));
+}
+
+/* A run of lost datagrams ended: one line for all of it */
+static inline void lmtRtpRunEnd(thread_params *inArg)
+{
+    lmtRtp *r = inArg->rtp;
+
+    if (!r->runLen)
+        return;
+    lmtLog(LMT_EV_RTP_SEQ, inArg->id, r->runLen, r->runStart & 0xffff, 0);
+    r->runLen = 0;
+}
+
+/* ext is still missing RTP_REORDER datagrams later. A run of them is one sequence error */
+static inline void lmtRtpLost(thread_params *inArg, long long ext)
+{
+    lmtRtp *r = inArg->rtp;
+
+    lmtRtpSet(r->lost, ext);
+    inArg->chanInfo.rtpLost++;
+    inArg->mdi->rtpLost += r->tsPerDgram;
+    if (!r->runLen++)
+    {
+        r->runStart = ext;
+        inArg->chanInfo.cCerrors++;
+        lmtEvidenceMark(inArg, EVIDENCE_RTP);
+    }
+}
+
+/* The newest sequence number moves up to ext, settling what falls RTP_REORDER and RTP_FEC_DEPTH behind it */
+void lmtRtpSlide(thread_params *inArg, long long ext)
+{
+    lmtRtp *r = inArg->rtp;
+
+    for (long long e = r->maxExt + 1; e <= ext; ++e)
+    {
+        long long s = e - RTP_FEC_DEPTH;
+        if (r->fec && s >= r->firstExt && lmtRtpBit(r->lost, s))
+        {
+            if (lmtRtpBit(r->recov, s))
+                r->snap.fecRecoverable++;
+            else
+                r->snap.fecUnrecoverable++;
+        }
+        s = e - RTP_REORDER;
+        if (s >= r->firstExt)
+        {
+            if (lmtRtpBit(r->seen, s))
+                lmtRtpRunEnd(inArg);
+            else
+                lmtRtpLost(inArg, s);
+        }
+        /* the slot e takes over was e - RTP_WINDOW's */
+        lmtRtpClear(r->seen, e);
+        lmtRtpClear(r->lost, e);
+        lmtRtpClear(r->recov, e);
+    }
+    r->maxExt = ext;
+}
+
+/* Before the window is forgotten: the datagrams still undecided are lost or not, and the FEC gets its say on the lost ones */
+void lmtRtpSettle(thread_params *inArg)
+{
+    lmtRtp *r = inArg->rtp;
+    long long last = r->maxExt;
+
+    if (!r->started)
+        return;
+    lmtRtpSlide(inArg, last + RTP_REORDER);
+    for (long long s = last + RTP_REORDER - RTP_FEC_DEPTH + 1; r->fec && s <= last; ++s)
+    {
+        if (s >= r->firstExt && lmtRtpBit(r->lost, s))
+        {
+            if (lmtRtpBit(r->recov, s))
+                r->snap.fecRecoverable++;
+            else
+                r->snap.fecUnrecoverable++;
+        }
+    }
+    lmtRtpRunEnd(inArg);
+}
+
+/* First datagram, new SSRC or a jump RFC 3550 A.1 gives up on: nothing before seq is expected */
+void lmtRtpRestart(thread_params *inArg, const RTP_Header *hdr)
+{
+    lmtRtp *r = inArg->rtp;
+
+    lmtRtpSettle(inArg);
+    if (r->started)
+        r->snap.restarts++;
+    memset(r->seen, 0, sizeof(r->seen));
+    memset(r->lost, 0, sizeof(r->lost));
+    memset(r->recov, 0, sizeof(r->recov));
+    r->maxExt = r->firstExt = (((r->maxExt >> 16) + 2) << 16) | hdr->seq;
+    lmtRtpSet(r->seen, r->maxExt);
+    r->snap.ssrc = hdr->ssrc;
+    r->started = true;
+    r->haveTransit = false;
+    r->badSeq = 0;
+}
+
+/* Every RTP datagram of the channel, in arrival order */
+void lmtRtpPacket(thread_params *inArg, const RTP_Header *hdr, int tsCount, long long arrival)
+{
+    lmtRtp *r = inArg->rtp;
+    uint16_t delta = hdr->seq - (uint16_t)r->maxExt;
+
+    r->tsPerDgram = tsCount;
+    if (!r->started || hdr->ssrc != r->snap.ssrc)
+        lmtRtpRestart(inArg, hdr);
+    else if (delta == 0)
+    {
+        r->snap.duplicates++;
+        return;
+    }
+    else if (delta < RTP_MAX_DROPOUT)
+    {
+        lmtRtpSlide(inArg, r->maxExt + delta);
+        lmtRtpSet(r->seen, r->maxExt);
+    }
+    else if (delta > 0x10000 - RTP_MAX_MISORDER)
+    {
+        int back = 0x10000 - delta;
+        long long ext = r->maxExt - back;
+        if (ext < r->firstExt)
+            return;
+        if (lmtRtpBit(r->seen, ext))
+        {
+            r->snap.duplicates++;
+            return;
+        }
+        lmtRtpSet(r->seen, ext);
+        if (back < RTP_REORDER)
+            r->snap.reordered++;
+        else
+            r->snap.late++;
+    }
+    else if (hdr->seq + 1u == r->badSeq)
+        lmtRtpRestart(inArg, hdr);
+    else
+    {
+        /* a jump, believed once the next datagram follows on from it */
+        r->badSeq = ((hdr->seq + 1) & 0xffff) + 1;
+        return;
+    }
+
+    /* RFC 3550 6.4.1, the arrival in RTP timestamp units */
+    uint32_t transit = (uint32_t)(long long)(arrival * (RTP_CLOCK / 1e9)) - hdr->ts;
+    if (r->haveTransit)
+    {
+        int32_t d = transit - r->transit;
+        r->jitter += ((d < 0 ? -(double)d : d) - r->jitter) / 16;
+        r->snap.jitterUs = r->jitter * 1e6 / RTP_CLOCK;
+    }
+    r->transit = transit;
+    r->haveTransit = true;
+}
+
+/*
+ * A SMPTE 2022-1 FEC datagram, column or row: it protects the NA media datagrams
+ * SNBase + i * Offset. With all of them here but one, that one can be rebuilt.
+ * Ones rebuilt that way count as here for the FEC datagrams after it, a second
+ * dimension can then repair what the first couldn't.
+ */
+void lmtFecDgram(thread_params *inArg, const uint8_t *buf, int n)
+{
+    lmtRtp *r = inArg->rtp;
+    RTP_Header hdr;
+    int off = RTP_Header_Parse(&hdr, buf, n);
+    long long missing = 0;
+    int cnt = 0;
+
+    if (off < 0 || n < off + FEC_HDR_SIZE || !r->started)
+        return;
+    r->fec = true;
+    r->snap.fecPackets++;
+
+    const uint8_t *fec = buf + off;
+    uint16_t base = (fec[0] << 8) | fec[1];
+    int offset = fec[13], na = fec[14];
+    long long ext = r->maxExt - (uint16_t)((uint16_t)r->maxExt - base);
+    for (int i = 0; i < na && offset && cnt < 2; ++i, ext += offset)
+    {
+        /* not all here yet or gone from the window, nothing to tell */
+        if (ext > r->maxExt || ext <= r->maxExt - RTP_WINDOW || ext < r->firstExt)
+            return;
+        if (!lmtRtpBit(r->seen, ext) && !lmtRtpBit(r->recov, ext))
+        {
+            missing = ext;
+            cnt++;
+        }
+    }
+    if (cnt == 1 && missing > r->maxExt - RTP_FEC_DEPTH)
+        lmtRtpSet(r->recov, missing);
+}
+
+void lmtResetChannel(thread_params *inArg)
+{
+    int id = inArg->id;
+    unsigned long long lost = inArg->chanInfo.rtpLost;
+    lmtRtpSettle(inArg);
+    /* the losses it settles go into the last second and the stats segment before the counters start over */
+    if (inArg->chanInfo.rtpLost != lost)
+    {
+        lmtHistorySecond(inArg, inArg->meter->lastArr ? inArg->meter->lastArr / 1000000000LL : time(NULL));
+        lmtPublish(inArg);
+    }
+    lmtEvidenceLoss(inArg, inArg->isStream);
+    memset(&inArg->chanInfo, 0, sizeof(lmtChanInfo));
+    inArg->id = id;
+    inArg->saidstreamtype = false;
+    inArg->isStream = false;
+    lmtServicesFree(inArg);
+    lmtResetPids(inArg->pids);
+    memset(inArg->psi, 0, sizeof(lmtPsi));
+    memset(inArg->pcr, 0, sizeof(lmtPcrStats));
+    memset(inArg->tr, 0, sizeof(lmtTr));
+    memset(inArg->mdi, 0, sizeof(lmtMdi));
+    memset(inArg->meter, 0, sizeof(lmtMeter));
+    memset(inArg->rtp, 0, sizeof(lmtRtp));
+
+    /* the history keeps going: the seconds since the last data are absent, its counters start over with chanInfo's */
+    lmtHistoryRec idle = { .sec = time(NULL) };
+    inArg->hist.rtpLostPrev = 0;
+    inArg->hist.pcrDiscPrev = 0;
+    if (!inArg->hist.hdr || idle.sec > inArg->hist.hdr->lastSec)
+        lmtHistoryPut(inArg, &idle);
+    lmtAlarmIdle(inArg, idle.sec);
+    lmtPublish(inArg);
+}
+
+/* Parses one datagram that arrived at arrival ns (CLOCK_REALTIME), returns -1 if it doesn't look like RTP/UDP TS */
+int lmtParseDgram(thread_params *inArg, uint8_t *buf, int n, long long arrival)
+{
+    int id = inArg->id;
+    lmtTsBatch tb;
+    struct RTP_Header tHeader;
+
+    if (inArg->evidence)
+        lmtEvidenceDgram(inArg, buf, n, arrival);
+    lmtTrDgram(inArg, arrival);
+    if (lmtTsFrame(buf, n, &tb, &tHeader) < 0)
+    {
+        /* nothing in it could be framed, as far as sync goes these are all bad packets */
+        int lost = n / TS_SIZE ? n / TS_SIZE : 1;
+        lmtTrSyncErrors(inArg, inArg->tr->pktSeq, lost);
+        inArg->tr->pktSeq += lost;
+
+        /* one line per window is enough to tell what's arriving */
+        if (!inArg->saidNotTs)
+            lmtLog(LMT_EV_NOT_TS, id, n, 0, 0);
+        inArg->saidNotTs = true;
+        inArg->chanInfo.sStreamType = "Error";
+        return -1;
+    }
+
+    if (tb.isRtp)
+    {
+        if (inArg->saidstreamtype == false)
+        {
+           inArg->chanInfo.sStreamType = "RTP";
+        }
+        lmtRtpPacket(inArg, &tHeader, tb.count, arrival);
+    }else
+    {
+        if (inArg->saidstreamtype == false)
+         {
+            inArg->chanInfo.sStreamType = "UDP";
+         }
+    }
+    inArg->saidstreamtype = true;
+    inArg->chanInfo.tsPacketSize = tb.size;
+    lmtMdiDgram(inArg->mdi, tb.count * tb.size, arrival);
+    inArg->meter->bytes += tb.count * tb.size;
+    inArg->meter->lastArr = arrival;
+
+    for (int i = 0; i < tb.count; ++i)
+    {
+        const uint8_t *p_ts = tb.first + i * tb.size;
+        uint16_t tPid = tb.pid[i];
+
+        /* a packet with a bad sync byte or TEI has no header worth trusting */
+        if (__builtin_expect(tb.flags[i] & (TS_FLAG_SYNC_ERR | TS_FLAG_TEI), 0))
+        {
+            if (tb.flags[i] & TS_FLAG_SYNC_ERR)
+                lmtTrSyncErrors(inArg, inArg->tr->pktSeq + i, 1);
+            else
+                inArg->chanInfo.tr[TR_TRANSPORT]++;
+            continue;
+        }
+
+        /* every PID of the mux, whether the PAT/PMT are known yet or not */
+        inArg->meter->pkts[tPid]++;
+        lmtCheckCc(inArg, tPid, tb.ccAfc[i], p_ts);
+
+        uint8_t slot = inArg->pids->watch[tPid];
+        if (slot)
+            lmtTrPacket(inArg, slot, p_ts, tb.flags[i]);
+
+        if (tPid == inArg->chanInfo.sPcr && (tb.ccAfc[i] & 0x20))
+            lmtPcrPacket(inArg, p_ts, arrival);
+
+        if (tPid == 0)
+            lmtPsiPacket(inArg, &inArg->psi->patSec, &inArg->psi->pat, p_ts);
+        else if (tPid == inArg->chanInfo.sPmt && inArg->chanInfo.sPatParsed)
+            lmtPsiPacket(inArg, &inArg->psi->pmtSec, &inArg->psi->pmt, p_ts);
+        /* the service table, its PMTs get parsed, the program's own included */
+        uint16_t svc = inArg->pids->svc[tPid];
+        if (svc)
+        {
+            lmtService *s = &inArg->svc.svc[(svc & ~SERVICE_PMT) - 1];
+            s->pkts++;
+            if (__builtin_expect(svc & SERVICE_PMT, 0))
+                lmtPsiPacket(inArg, &s->pmtSec, &s->pmt, p_ts);
+        }
+    }
+    inArg->tr->pktSeq += tb.count;
+    return 0;
+}
+
+static inline double lmtSmooth(double avg, double val, bool first)
+{
+    return first ? val : avg + METER_SMOOTH * (val - avg);
+}
+
+/* Bitrate and presence of every service, off the packets lmtPidTable.svc gave it during the window closing */
+void lmtServicesWindow(thread_params *inArg, double perPkt)
+{
+    for (int i = 0; i < inArg->svc.count; ++i)
+    {
+        lmtService *svc = &inArg->svc.svc[i];
+        svc->snap.present = svc->pkts > 0;
+        svc->snap.mbps = lmtSmooth(svc->snap.mbps, svc->pkts * perPkt, !inArg->meter->smoothed);
+        svc->pkts = 0;
+    }
+}
+
+/*
+ * Every datagram of the window covers the time since the one before it, so the window
+ * runs from the last arrival of the previous one to its own last arrival. The first
+ * window, or one whose timestamps disagree with the coarse clock, uses the coarse clock.
+ */
+void lmtMeterWindow(thread_params *inArg, long long now)
+{
+    lmtMeter *m = inArg->meter;
+    lmtPidTable *tbl = inArg->pids;
+    double secs = (now - m->start) / 1e6;
+    double arrSecs = (m->lastArr - m->prevArr) / 1e9;
+    int size = inArg->chanInfo.tsPacketSize ? inArg->chanInfo.tsPacketSize : TS_SIZE;
+
+    if (m->prevArr && arrSecs > 0 && arrSecs > secs * 0.9 && arrSecs < secs * 1.1)
+        secs = arrSecs;
+    double perPkt = size * 8 / secs / 1e6;
+
+    inArg->chanInfo.sBitrate = m->bytes * 8 / secs / 1e6;
+    inArg->chanInfo.sBitrateAvg = lmtSmooth(inArg->chanInfo.sBitrateAvg, inArg->chanInfo.sBitrate, !m->smoothed);
+    lmtServicesWindow(inArg, perPkt);
+    for (int i = 0; i < tbl->activeCnt; ++i)
+    {
+        uint16_t pid = tbl->active[i];
+        m->rate[pid] = lmtSmooth(m->rate[pid], m->pkts[pid] * perPkt, !m->smoothed);
+        m->pkts[pid] = 0;
+    }
+    /* stuffing never makes it to the active list, it has no continuity to check */
+    m->rate[TS_NULL_PID] = lmtSmooth(m->rate[TS_NULL_PID], m->pkts[TS_NULL_PID] * perPkt, !m->smoothed);
+    inArg->chanInfo.sNullBitrate = m->rate[TS_NULL_PID];
+    m->pkts[TS_NULL_PID] = 0;
+
+    m->smoothed = true;
+    m->bytes = 0;
+    m->prevArr = m->lastArr;
+    m->start = now;
+}
+
+/* Closes the 1 s measurement window and publishes it, called once per batch of datagrams with a coarse now in us */
+void lmtParseWindow(thread_params *inArg, long long now)
+{
+    if (!inArg->meter->start)
+    {
+        inArg->meter->start = now;
+        return;
+    }
+    if (now - inArg->meter->start >= METER_WINDOW_US)
+    {
+        /* a window without framed TS has no arrival to go by */
+        uint32_t sec = inArg->meter->lastArr ? inArg->meter->lastArr / 1000000000LL : time(NULL);
+        lmtMeterWindow(inArg, now);
+        inArg->isStream = true;
+        inArg->saidstreamtype = false;
+        inArg->saidNotTs = false;
+        lmtPcrWindow(inArg);
+        lmtMdiWindow(inArg);
+        lmtHistorySecond(inArg, sec);
+        lmtAlarmWindow(inArg, sec);
+        lmtProbeWindow(inArg);
+        lmtPublish(inArg);
+    }
+}
+
+/*
+ * Hands a whole recvmmsg batch to the parser, one monotonic clock read per datagram times it.
+ * The wall clock is read once, for the queue delay behind the kernel's receive timestamps.
+ */
+void lmtParseBatch(thread_params *inArg, struct mmsghdr *msgs, int cnt)
+{
+    long long now = lmtNowNs(), start = lmtMonoNs();
+
+    for (int i = 0; i < cnt; ++i)
+    {
+        long long arrival = lmtMsgArrival(&msgs[i].msg_hdr, now);
+        if (__builtin_expect(msgs[i].msg_hdr.msg_flags & MSG_TRUNC, 0))
+            inArg->probe->snap.truncated++;
+        lmtParseDgram(inArg, msgs[i].msg_hdr.msg_iov->iov_base, msgs[i].msg_len, arrival);
+
+        long long end = lmtMonoNs();
+        lmtProbeDgram(inArg->probe, now - arrival, end - start);
+        start = end;
+    }
+    lmtProbeDrops(inArg->probe, &msgs[cnt - 1].msg_hdr);
+
+    lmtParseWindow(inArg, lmtCoarseUs());
+}
+
+/* Parameters a reload changed in place, taken over by the channel's own parser */
+static inline void lmtApplyConf(thread_params *chan)
+{
+    unsigned int gen = __atomic_load_n(&chan->confGen, __ATOMIC_ACQUIRE);
+
+    if (gen == chan->confApplied)
+        return;
+    chan->confApplied = gen;
+    chan->batchSize = chan->nextBatch;
+    chan->bitrateMin = chan->nextBitrateMin;
+    chan->bitrateMax = chan->nextBitrateMax;
+    if (chan->nextRcvbuf != chan->rcvbuf && chan->sok >= 0)
+    {
+        chan->rcvbuf = chan->nextRcvbuf;
+        lmtSetRcvbuf(chan->sok, chan->rcvbuf, chan->id);
+        lmtProbeSocket(chan->probe, chan->sok);
+    }
+}
+
+/* The column and row FEC sockets of a channel with fec on, what fails to open is only logged */
+void lmtFecOpen(thread_params *chan)
+{
+    if (!chan->fec)
+        return;
+    chan->fecSok[0] = openDgramSocket(chan->mcastAddr, chan->port + FEC_PORT_COL, chan->ifAddr, chan->id, 0);
+    chan->fecSok[1] = openDgramSocket(chan->mcastAddr, chan->port + FEC_PORT_ROW, chan->ifAddr, chan->id, 0);
+}
+
+void lmtFecClose(thread_params *chan)
+{
+    for (int k = 0; k < 2; ++k)
+    {
+        if (chan->fecSok[k] >= 0)
+            lmtCloseDgramSocket(chan->fecSok[k], chan->mcastAddr, chan->ifAddr);
+        chan->fecSok[k] = -1;
+    }
+}
+
+/* Whatever FEC is queued, read after each media batch into the same slots. FEC is a fraction of the media rate */
+void lmtFecRead(thread_params *chan, lmtDgramRing *ring, int size)
+{
+    for (int k = 0; k < 2; ++k)
+    {
+        int n;
+        if (chan->fecSok[k] < 0)
+            continue;
+        do
+        {
+            lmtRingArm(ring, size);
+            n = recvmmsg(chan->fecSok[k], ring->msgs, size, MSG_DONTWAIT, NULL);
+            for (int i = 0; i < n; ++i)
+                lmtFecDgram(chan, ring->msgs[i].msg_hdr.msg_iov->iov_base, ring->msgs[i].msg_len);
+        } while (n == size);
+    }
+}
+
+void *lmtParseStream(void* arg)
+{
+    struct thread_params *inArg = (struct thread_params*)arg;
+    lmtDgramRing ring;
+    int n;
+
+    int id = inArg->id;
+    const char *ip = inArg->mcastAddr;
+    unsigned short int port = inArg->port;
+    const char *ifAddr = inArg->ifAddr;
+
+    memset(&ring, 0, sizeof(ring));
+    inArg->sok = openDgramSocket(ip, port, ifAddr, id, inArg->rcvbuf);
+    if (inArg->sok < 0)
+    {
+        __atomic_store_n(&inArg->exited, true, __ATOMIC_RELEASE);
+        return NULL;
+    }
+    lmtSetBusyPoll(inArg->sok, inArg->busyPoll, inArg->preferBusyPoll, id);
+    lmtProbeSocket(inArg->probe, inArg->sok);
+    lmtFecOpen(inArg);
+
+    // printf("Starting monitoring of channel: %d Address: %s Port: %hu\n", id, ip, port);
+    /* a removed channel is noticed within READ_TIMEOUT, the socket never blocks longer */
+    while (!__atomic_load_n(&inArg->stop, __ATOMIC_ACQUIRE))
+    {
+        lmtApplyConf(inArg);
+        if (ring.size != inArg->batchSize)
+        {
+            lmtRingFree(&ring);
+            if (lmtRingInit(&ring, inArg->batchSize, inArg->node) < 0)
+            {
+                logWithTime("[ERROR] Channel: %d can't allocate %d datagram slots", id, inArg->batchSize);
+                break;
+            }
+        }
+
+        lmtRingArm(&ring, ring.size);
+        n = recvmmsg(inArg->sok, ring.msgs, ring.size, MSG_WAITFORONE, NULL);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0 && errno != EAGAIN)
+        {
+            lmtLog(LMT_EV_RECV_ERR, id, errno, 0, 0);
+            break;
+        }
+
+        if (n <= 0){
+            // printf("Channel: %d Error: Receave timeout for 2 seconds\n", id);
+            lmtResetChannel(inArg);
+            continue;
+        }
+
+        lmtParseBatch(inArg, ring.msgs, n);
+        lmtFecRead(inArg, &ring, ring.size);
+    }
+    lmtCloseDgramSocket(inArg->sok, ip, ifAddr);
+    inArg->sok = -1;
+    lmtFecClose(inArg);
+    lmtRingFree(&ring);
+    __atomic_store_n(&inArg->exited, true, __ATOMIC_RELEASE);
+    return 0;
+  }
+
+
+
+/* Reactor mode: a fixed pool of workers, each one owns a shard of the channel sockets */
+
+void lmtTimerUnlink(lmtTimer *t)
+{
+    if (t->next)
+    {
+        t->prev->next = t->next;
+        t->next->prev = t->prev;
+        t->next = t->prev = NULL;
+    }
+}
+
+void lmtTimerAdd(lmtTimerWheel *wheel, lmtTimer *t, long long expires)
+{
+    lmtTimer *head = &wheel->slots[expires & (TIMER_WHEEL_SLOTS - 1)];
+
+    lmtTimerUnlink(t);
+    t->expires = expires;
+    t->next = head->next;
+    t->prev = head;
+    head->next->prev = t;
+    head->next = t;
+}
+
+void lmtTimerWheelInit(lmtTimerWheel *wheel, long long tick)
+{
+    for (int i = 0; i < TIMER_WHEEL_SLOTS; ++i)
+    {
+        wheel->slots[i].next = wheel->slots[i].prev = &wheel->slots[i];
+    }
+    wheel->tick = tick;
+}
+
+long long lmtMonoTick(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000) / TIMER_TICK_MS;
+}
+
+/* The rx timer is lazy: data only moves lastRxTick, the timer re-arms itself when it fires */
+void lmtRxTimerFire(lmtTimerWheel *wheel, thread_params *chan)
+{
+    long long deadline = chan->lastRxTick + READ_TIMEOUT_TICKS;
+
+    if (deadline > wheel->tick)
+    {
+        lmtTimerAdd(wheel, &chan->rxTimer, deadline);
+        return;
+    }
+    lmtResetChannel(chan);
+    chan->lastRxTick = wheel->tick;
+    lmtTimerAdd(wheel, &chan->rxTimer, wheel->tick + READ_TIMEOUT_TICKS);
+}
+
+void lmtTimerWheelAdvance(lmtTimerWheel *wheel, long long now)
+{
+    while (wheel->tick < now)
+    {
+        wheel->tick++;
+        lmtTimer *head = &wheel->slots[wheel->tick & (TIMER_WHEEL_SLOTS - 1)];
+        lmtTimer pending = { .next = NULL };
+
+        /* detach the slot first, fired timers may land in the same slot again */
+        if (head->next == head)
+            continue;
+        pending.next = head->next;
+        pending.prev = head->prev;
+        pending.next->prev = &pending;
+        pending.prev->next = &pending;
+        head->next = head->prev = head;
+
+        while (pending.next != &pending)
+        {
+            lmtTimer *t = pending.next;
+            lmtTimerUnlink(t);
+            if (t->expires > wheel->tick)
+            {
+                lmtTimerAdd(wheel, t, t->expires);
+                continue;
+            }
+            lmtRxTimerFire(wheel, (thread_params*)((char*)t - offsetof(thread_params, rxTimer)));
+        }
+    }
+}
+
+void lmtWorkerRead(lmtWorker *worker, thread_params *chan)
+{
+    int n;
+
+    chan->lastRxTick = worker->wheel.tick;
+    lmtApplyConf(chan);
+    for (int i = 0; i < WORKER_MAX_READS; ++i)
+    {
+        lmtRingArm(&worker->ring, chan->batchSize);
+        n = recvmmsg(chan->sok, worker->ring.msgs, chan->batchSize, MSG_DONTWAIT, NULL);
+        if (n <= 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                lmtLog(LMT_EV_RECV_ERR, chan->id, errno, 0, 0);
+            return;
+        }
+        lmtParseBatch(chan, worker->ring.msgs, n);
+        lmtFecRead(chan, &worker->ring, chan->batchSize);
+
+        if (n < chan->batchSize)
+            return;
+    }
+}
+
+int lmtWorkerAddChannel(lmtWorker *worker, thread_params *chan)
+{
+    struct epoll_event ev;
+
+    chan->sok = openDgramSocket(chan->mcastAddr, chan->port, chan->ifAddr, chan->id, chan->rcvbuf);
+    if (chan->sok < 0)
+        return -1;
+    lmtSetBusyPoll(chan->sok, chan->busyPoll, chan->preferBusyPoll, chan->id);
+    lmtProbeSocket(chan->probe, chan->sok);
+    fcntl(chan->sok, F_SETFL, fcntl(chan->sok, F_GETFL) | O_NONBLOCK);
+    lmtFecOpen(chan);
+
+    chan->lastRxTick = worker->wheel.tick;
+    lmtTimerAdd(&worker->wheel, &chan->rxTimer, worker->wheel.tick + READ_TIMEOUT_TICKS);
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = chan;
+    if (epoll_ctl(worker->epfd, EPOLL_CTL_ADD, chan->sok, &ev) < 0)
+    {
+        logWithTime("[ERROR] Channel: %d epoll_ctl: %s", chan->id, strerror(errno));
+        lmtTimerUnlink(&chan->rxTimer);
+        close(chan->sok);
+        chan->sok = -1;
+        lmtFecClose(chan);
+        return -1;
+    }
+    return 0;
+}
+
+void lmtWorkerRemoveChannel(lmtWorker *worker, thread_params *chan)
+{
+    if (chan->sok >= 0)
+    {
+        epoll_ctl(worker->epfd, EPOLL_CTL_DEL, chan->sok, NULL);
+        lmtTimerUnlink(&chan->rxTimer);
+        lmtCloseDgramSocket(chan->sok, chan->mcastAddr, chan->ifAddr);
+        chan->sok = -1;
+        lmtFecClose(chan);
+    }
+    __atomic_store_n(&chan->exited, true, __ATOMIC_RELEASE);
+}
+
+/* Runs what the main thread queued, on the worker that owns the channels */
+void lmtWorkerCommands(lmtWorker *worker)
+{
+    uint64_t val;
+    lmtWorkerCmd *cmd, *next;
+
+    if (read(worker->evfd, &val, sizeof(val)) < 0 && errno != EAGAIN)
+        logWithTime("[ERROR] Worker: %d eventfd: %s", worker->idx, strerror(errno));
+    pthread_mutex_lock(&worker->cmdLock);
+    cmd = worker->cmdHead;
+    worker->cmdHead = worker->cmdTail = NULL;
+    pthread_mutex_unlock(&worker->cmdLock);
+
+    for (; cmd; cmd = next)
+    {
+        next = cmd->next;
+        if (cmd->type == LMT_CMD_REMOVE)
+            lmtWorkerRemoveChannel(worker, cmd->chan);
+        else if (lmtWorkerAddChannel(worker, cmd->chan) < 0)
+            logWithTime("[ERROR] Channel: %d not monitored", cmd->chan->id);
+        free(cmd);
+    }
+}
+
+/* Main thread side */
+void lmtWorkerPost(lmtWorker *worker, thread_params *chan, int type)
+{
+    uint64_t one = 1;
+    lmtWorkerCmd *cmd = malloc(sizeof(lmtWorkerCmd));
+
+    if (!cmd)
+    {
+        logWithTime("[ERROR] Channel: %d out of memory, worker %d not told", chan->id, worker->idx);
+        return;
+    }
+    cmd->type = type;
+    cmd->chan = chan;
+    cmd->next = NULL;
+    pthread_mutex_lock(&worker->cmdLock);
+    if (worker->cmdTail)
+        worker->cmdTail->next = cmd;
+    else
+        worker->cmdHead = cmd;
+    worker->cmdTail = cmd;
+    pthread_mutex_unlock(&worker->cmdLock);
+    if (write(worker->evfd, &one, sizeof(one)) < 0)
+        logWithTime("[ERROR] Worker: %d eventfd: %s", worker->idx, strerror(errno));
+}
+
+void *lmtWorkerLoop(void *arg)
+{
+    lmtWorker *worker = (lmtWorker*)arg;
+    struct epoll_event events[WORKER_MAX_EVENTS];
+
+    while(1)
+    {
+        int n = epoll_wait(worker->epfd, events, WORKER_MAX_EVENTS, TIMER_TICK_MS);
+        if (n < 0 && errno != EINTR)
+        {
+            logWithTime("[ERROR] Worker: %d epoll_wait: %s", worker->idx, strerror(errno));
+            break;
+        }
+
+        bool cmds = false;
+        lmtTimerWheelAdvance(&worker->wheel, lmtMonoTick());
+        for (int i = 0; i < n; ++i)
+        {
+            if (events[i].data.ptr)
+                lmtWorkerRead(worker, (thread_params*)events[i].data.ptr);
+            else
+                cmds = true;
+        }
+        /* after the events, none of them may be for a channel that's gone by then */
+        if (cmds)
+            lmtWorkerCommands(worker);
+    }
+    return 0;
+}
+
+/* The least busy worker, of those sharing a CPU with the channel if any do */
+lmtWorker *lmtPickWorker(lmtWorker *workers, int workerCnt, const thread_params *chan)
+{
+    lmtWorker *best = NULL;
+    bool bestFits = false;
+
+    for (int w = 0; w < workerCnt; ++w)
+    {
+        cpu_set_t both;
+        CPU_AND(&both, &workers[w].cpus, &chan->cpus);
+        bool fits = CPU_COUNT(&both) > 0;
+        if (!best || (fits && !bestFits) || (fits == bestFits && workers[w].chanCnt < best->chanCnt))
+        {
+            best = &workers[w];
+            bestFits = fits;
+        }
+    }
+    return best;
+}
+
+/* Shards chanCount channels over workerCnt workers, channels are set up before the workers start */
+lmtWorker *lmtStartWorkers(thread_params **chans, int chanCount, int workerCnt, const cpu_set_t *workerCpus, int workerCpusCnt)
+{
+    lmtWorker *workers = calloc(workerCnt, sizeof(lmtWorker));
+    if (!workers)
+        return NULL;
+
+    for (int w = 0; w < workerCnt; ++w)
+    {
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+
+        workers[w].idx = w;
+        if (workerCpusCnt)
+            workers[w].cpus = workerCpus[w % workerCpusCnt];
+        workers[w].node = lmtCpusNode(&workers[w].cpus);
+        workers[w].epfd = epoll_create1(0);
+        workers[w].evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        pthread_mutex_init(&workers[w].cmdLock, NULL);
+        lmtTimerWheelInit(&workers[w].wheel, lmtMonoTick());
+        if (workers[w].epfd < 0 || workers[w].evfd < 0 || epoll_ctl(workers[w].epfd, EPOLL_CTL_ADD, workers[w].evfd, &ev) < 0
+            || lmtRingInit(&workers[w].ring, MAX_BATCH_SIZE, workers[w].node) < 0)
+        {
+            logWithTime("[ERROR] Worker: %d init failed", w);
+            return NULL;
+        }
+    }
+
+    for (int i = 0; i < chanCount; ++i)
+    {
+        lmtWorker *worker = lmtPickWorker(workers, workerCnt, chans[i]);
+        chans[i]->worker = worker->idx;
+        worker->chanCnt++;
+        if (lmtWorkerAddChannel(worker, chans[i]) < 0)
+            logWithTime("[ERROR] Channel: %d not monitored", chans[i]->id);
+    }
+
+    for (int w = 0; w < workerCnt; ++w)
+    {
+        char list[256];
+
+        if (lmtThreadCreate(&workers[w].thread, lmtWorkerLoop, &workers[w], &workers[w].cpus, "Worker"))
+        {
+            logWithTime("ERROR Creating worker thread");
+            exit(-1);
+        }
+        lmtFormatCpus(list, sizeof(list), &workers[w].cpus);
+        logWithTime("Worker: %d with %d channels, cpus %s, node %d", w, workers[w].chanCnt, list, workers[w].node);
+    }
+    return workers;
+}
+
+/* (mcast address, port) -> channel lookup, open addressing, sized once at startup */
+
+static inline uint64_t lmtChanKey(uint32_t addr, uint16_t port)
+{
+    return (1ULL << 48) | ((uint64_t)addr << 16) | port;
+}
+
+static inline unsigned int lmtChanHash(const lmtChanMap *map, uint64_t key)
+{
+    return (unsigned int)((key * 0x9E3779B97F4A7C15ULL) >> 40) & map->mask;
+}
+
+int lmtChanMapInit(lmtChanMap *map, int count)
+{
+    unsigned int size = 16;
+
+    while (size < (unsigned int)count * 2)
+        size <<= 1;
+    map->mask = size - 1;
+    map->keys = calloc(size, sizeof(uint64_t));
+    map->vals = calloc(size, sizeof(thread_params*));
+    return (map->keys && map->vals) ? 0 : -1;
+}
+
+/* addr and port in network byte order, like they come off the wire */
+void lmtChanMapPut(lmtChanMap *map, uint32_t addr, uint16_t port, thread_params *chan)
+{
+    uint64_t key = lmtChanKey(addr, port);
+    unsigned int i = lmtChanHash(map, key);
+
+    while (map->keys[i] && map->keys[i] != key)
+        i = (i + 1) & map->mask;
+    map->keys[i] = key;
+    map->vals[i] = chan;
+}
+
+static inline thread_params *lmtChanMapGet(const lmtChanMap *map, uint32_t addr, uint16_t port)
+{
+    uint64_t key = lmtChanKey(addr, port);
+    unsigned int i = lmtChanHash(map, key);
+
+    while (map->keys[i])
+    {
+        if (map->keys[i] == key)
+            return map->vals[i];
+        i = (i + 1) & map->mask;
+    }
+    return NULL;
+}
+
+/*
+ * Shared socket mode: channels on the same port and interface share one socket bound
+ * to INADDR_ANY that joins all their groups. IP_PKTINFO says which group a datagram
+ * was sent to, the channel map does the rest. One recvmmsg() then serves a whole
+ * port instead of one channel, and the kernel has a single socket to match per port.
+ */
+
+/* Groups one socket may join, the kernel refuses more with ENOBUFS */
+int lmtIgmpMaxMemberships(void)
+{
+    int max = SHARED_MAX_GROUPS;
+    FILE *f = fopen("/proc/sys/net/ipv4/igmp_max_memberships", "r");
+
+    if (f)
+    {
+        if (fscanf(f, "%d", &max) != 1 || max < 1)
+            max = SHARED_MAX_GROUPS;
+        fclose(f);
+    }
+    return max;
+}
+
+int lmtSharedOpen(lmtShared *sh)
+{
+    int yes = 1, no = 0, busyPoll = 0;
+    bool preferBusyPoll = false;
+    struct sockaddr_in sin;
+
+    if ((sh->fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0)) < 0)
+    {
+        logWithTime("[ERROR] Shared: port %hu on %s socket: %s", sh->port, sh->ifAddr, strerror(errno));
+        return -1;
+    }
+    if (setsockopt(sh->fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) < 0 ||
+        setsockopt(sh->fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) < 0 ||
+        setsockopt(sh->fd, IPPROTO_IP, IP_PKTINFO, &yes, sizeof(yes)) < 0)
+    {
+        logWithTime("[ERROR] Shared: port %hu on %s setsockopt: %s", sh->port, sh->ifAddr, strerror(errno));
+        return -1;
+    }
+    /* otherwise a socket bound to INADDR_ANY gets every group anyone on the host joined */
+    if (setsockopt(sh->fd, IPPROTO_IP, IP_MULTICAST_ALL, &no, sizeof(no)) < 0)
+        logWithTime("[WARNING] Shared: port %hu on %s setsockopt (IP_MULTICAST_ALL): %s", sh->port, sh->ifAddr, strerror(errno));
+    if (setsockopt(sh->fd, SOL_SOCKET, SO_TIMESTAMPNS, &yes, sizeof(yes)) < 0)
+        logWithTime("[WARNING] Shared: port %hu on %s setsockopt (SO_TIMESTAMPNS), using receive time", sh->port, sh->ifAddr);
+    if (setsockopt(sh->fd, SOL_SOCKET, SO_RXQ_OVFL, &yes, sizeof(yes)) < 0)
+        logWithTime("[WARNING] Shared: port %hu on %s setsockopt (SO_RXQ_OVFL), kernel drops won't be counted", sh->port, sh->ifAddr);
+    lmtSetRcvbuf(sh->fd, sh->rcvbuf, sh->chans[0]->id);
+    for (int i = 0; i < sh->chanCnt; ++i)
+    {
+        if (sh->chans[i]->busyPoll > busyPoll)
+            busyPoll = sh->chans[i]->busyPoll;
+        preferBusyPoll |= sh->chans[i]->preferBusyPoll;
+    }
+    lmtSetBusyPoll(sh->fd, busyPoll, preferBusyPoll, sh->chans[0]->id);
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_ANY);
+    sin.sin_port = htons(sh->port);
+    if (bind(sh->fd, (struct sockaddr*)&sin, sizeof(sin)) < 0)
+    {
+        logWithTime("[ERROR] Shared: port %hu on %s bind: %s", sh->port, sh->ifAddr, strerror(errno));
+        return -1;
+    }
+
+    for (int i = 0; i < sh->chanCnt; ++i)
+    {
+        thread_params *chan = sh->chans[i];
+        struct ip_mreq mreq;
+
+        mreq.imr_multiaddr.s_addr = inet_addr(chan->mcastAddr);
+        mreq.imr_interface.s_addr = inet_addr(chan->ifAddr);
+        if (setsockopt(sh->fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0)
+        {
+            logWithTime("[ERROR] Channel: %d setsockopt (IP_ADD_MEMBERSHIP): %s", chan->id, strerror(errno));
+            continue;
+        }
+        lmtProbeSocket(chan->probe, sh->fd);
+        chan->lastRxTick = sh->wheel.tick;
+        lmtTimerAdd(&sh->wheel, &chan->rxTimer, sh->wheel.tick + READ_TIMEOUT_TICKS);
+        lmtChanMapPut(&sh->map, mreq.imr_multiaddr.s_addr, htons(sh->port), chan);
+    }
+    return 0;
+}
+
+/* Demultiplexes one recvmmsg batch, the window bookkeeping runs once per channel that got data */
+void lmtSharedBatch(lmtShared *sh, int cnt)
+{
+    struct mmsghdr *msgs = sh->ring.msgs;
+    long long now = lmtNowNs(), start = lmtMonoNs();
+    uint16_t port = htons(sh->port);
+
+    sh->gen++;
+    sh->touchedCnt = 0;
+    for (int i = 0; i < cnt; ++i)
+    {
+        thread_params *chan = lmtChanMapGet(&sh->map, lmtMsgDest(&msgs[i].msg_hdr), port);
+        if (!chan)
+        {
+            sh->unmatched++;
+            continue;
+        }
+
+        long long arrival = lmtMsgArrival(&msgs[i].msg_hdr, now);
+        if (__builtin_expect(msgs[i].msg_hdr.msg_flags & MSG_TRUNC, 0))
+            chan->probe->snap.truncated++;
+        chan->lastRxTick = sh->wheel.tick;
+        if (chan->captureGen != sh->gen)
+        {
+            chan->captureGen = sh->gen;
+            sh->touched[sh->touchedCnt++] = chan;
+        }
+        lmtParseDgram(chan, msgs[i].msg_hdr.msg_iov->iov_base, msgs[i].msg_len, arrival);
+
+        long long end = lmtMonoNs();
+        lmtProbeDgram(chan->probe, now - arrival, end - start);
+        start = end;
+    }
+
+    uint32_t ovfl;
+    if (lmtMsgDrops(&msgs[cnt - 1].msg_hdr, &ovfl))
+    {
+        sh->drops += (uint32_t)(ovfl - sh->ovfl);
+        sh->ovfl = ovfl;
+    }
+
+    for (int i = 0; i < sh->touchedCnt; ++i)
+    {
+        lmtParseWindow(sh->touched[i], lmtCoarseUs());
+    }
+}
+
+/* The socket's drops can't be put down to a channel, they are the whole port's */
+void lmtSharedStats(lmtShared *sh)
+{
+    sh->statsTick = sh->wheel.tick;
+    if (sh->drops != sh->dropsLogged)
+    {
+        logWithTime("[WARNING] Shared: port %hu on %s dropped %llu datagrams, %llu so far", sh->port, sh->ifAddr, sh->drops - sh->dropsLogged, sh->drops);
+        sh->dropsLogged = sh->drops;
+    }
+    if (sh->unmatched != sh->unmatchedLogged)
+    {
+        logWithTime("[WARNING] Shared: port %hu on %s got %llu datagrams for no configured group, %llu so far", sh->port, sh->ifAddr,
+            sh->unmatched - sh->unmatchedLogged, sh->unmatched);
+        sh->unmatchedLogged = sh->unmatched;
+    }
+}
+
+void *lmtSharedLoop(void *arg)
+{
+    lmtShared *sh = (lmtShared*)arg;
+    struct pollfd pfd = { .fd = sh->fd, .events = POLLIN };
+
+    while(1)
+    {
+        if (poll(&pfd, 1, TIMER_TICK_MS) < 0 && errno != EINTR)
+        {
+            logWithTime("[ERROR] Shared: port %hu on %s poll: %s", sh->port, sh->ifAddr, strerror(errno));
+            break;
+        }
+        lmtTimerWheelAdvance(&sh->wheel, lmtMonoTick());
+        if (sh->wheel.tick - sh->statsTick >= CAPTURE_STATS_TICKS)
+            lmtSharedStats(sh);
+
+        for (int i = 0; i < WORKER_MAX_READS; ++i)
+        {
+            int n = recvmmsg(sh->fd, sh->ring.msgs, sh->ring.size, MSG_DONTWAIT, NULL);
+            if (n <= 0)
+            {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                    logWithTime("[ERROR] Shared: port %hu on %s recvmmsg: %s", sh->port, sh->ifAddr, strerror(errno));
+                break;
+            }
+            lmtSharedBatch(sh, n);
+            /* a big ring mostly comes back nearly empty, only what the kernel touched is armed again */
+            lmtRingArm(&sh->ring, n);
+            if (n < sh->ring.size)
+            {
+                /* otherwise a port's datagrams come in one wakeup each, let some gather */
+                usleep(SHARED_COALESCE_US);
+                break;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Groups the channels by port and interface, a group that's full starts another socket */
+int lmtStartShared(thread_params **chans, int chanCount)
+{
+    lmtShared *shs = calloc(chanCount ? chanCount : 1, sizeof(lmtShared));
+    int shCnt = 0, maxGroups = lmtIgmpMaxMemberships();
+    if (!shs)
+        return -1;
+
+    for (int i = 0; i < chanCount; ++i)
+    {
+        lmtShared *sh = NULL;
+        for (int c = 0; c < shCnt && !sh; ++c)
+        {
+            if (shs[c].port == chans[i]->port && !strcmp(shs[c].ifAddr, chans[i]->ifAddr) && shs[c].chanCnt < maxGroups)
+                sh = &shs[c];
+        }
+        if (!sh)
+        {
+            sh = &shs[shCnt++];
+            sh->ifAddr = chans[i]->ifAddr;
+            sh->port = chans[i]->port;
+            sh->chans = calloc(maxGroups < chanCount ? maxGroups : chanCount, sizeof(thread_params*));
+            if (!sh->chans)
+                return -1;
+        }
+        sh->chans[sh->chanCnt++] = chans[i];
+        CPU_OR(&sh->cpus, &sh->cpus, &chans[i]->cpus);
+        sh->rcvbuf += chans[i]->rcvbuf;
+        sh->ring.size += chans[i]->batchSize;
+    }
+
+    for (int c = 0; c < shCnt; ++c)
+    {
+        lmtShared *sh = &shs[c];
+        int batch = sh->ring.size < MAX_BATCH_SIZE ? sh->ring.size : MAX_BATCH_SIZE;
+        char list[256];
+
+        sh->touched = calloc(sh->chanCnt, sizeof(thread_params*));
+        if (!sh->touched || lmtChanMapInit(&sh->map, sh->chanCnt) < 0 || lmtRingInit(&sh->ring, batch, sh->chans[0]->node) < 0)
+        {
+            logWithTime("[ERROR] Shared: out of memory");
+            return -1;
+        }
+        lmtRingArm(&sh->ring, batch);
+        lmtTimerWheelInit(&sh->wheel, lmtMonoTick());
+        if (lmtSharedOpen(sh) < 0)
+            return -1;
+        if (lmtThreadCreate(&sh->thread, lmtSharedLoop, sh, &sh->cpus, "Shared socket thread"))
+        {
+            logWithTime("ERROR Creating shared socket thread");
+            return -1;
+        }
+        lmtFormatCpus(list, sizeof(list), &sh->cpus);
+        logWithTime("Shared: %d channels on port %hu, interface %s, batch %d, cpus %s", sh->chanCnt, sh->port, sh->ifAddr, batch, list);
+    }
+    return 0;
+}
+
+/* Packet ring mode: one TPACKET_V3 ring per receive interface, frames are parsed in place */
+
+int lmtIfIndexByAddr(const char *ifAddr)
+{
+    struct ifaddrs *ifs, *ifa;
+    in_addr_t addr = inet_addr(ifAddr);
+    int idx = -1;
+
+    if (addr == INADDR_ANY)
+        return 0;
+    if (getifaddrs(&ifs) < 0)
+        return -1;
+    for (ifa = ifs; ifa; ifa = ifa->ifa_next)
+    {
+        if (ifa->ifa_addr && ifa->ifa_addr->sa_family == AF_INET &&
+            ((struct sockaddr_in*)ifa->ifa_addr)->sin_addr.s_addr == addr)
+        {
+            idx = if_nametoindex(ifa->ifa_name);
+            break;
+        }
+    }
+    freeifaddrs(ifs);
+    return idx;
+}
+
+/*
+ * Classic BPF over the IP header (SOCK_DGRAM packet socket): UDP, not a fragment,
+ * then five instructions per (group, port) so no jump has to reach past 255.
+ */
+int lmtBuildFilter(lmtCapture *cap, struct sock_fprog *prog)
+{
+    int n = 0;
+    struct sock_filter *f = calloc(7 + cap->chanCnt * 5 + 1, sizeof(struct sock_filter));
+    if (!f)
+        return -1;
+
+    f[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 9);
+    f[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 1, 0);
+    f[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0);
+    f[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 6);
+    f[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x1fff, 0, 1);
+    f[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0);
+    f[n++] = (struct sock_filter)BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0);
+
+    for (int i = 0; i < cap->chanCnt; ++i)
+    {
+        f[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 16);
+        f[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ntohl(inet_addr(cap->chans[i]->mcastAddr)), 0, 3);
+        f[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_H | BPF_IND, 2);
+        f[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, cap->chans[i]->port, 0, 1);
+        f[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0xffff);
+    }
+    f[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0);
+
+    prog->len = n;
+    prog->filter = f;
+    return 0;
+}
+
+int lmtCaptureOpen(lmtCapture *cap)
+{
+    int ver = TPACKET_V3;
+    struct sockaddr_ll sll;
+    struct sock_fprog prog;
+
+    if ((cap->fd = socket(AF_PACKET, SOCK_DGRAM, htons(ETH_P_IP))) < 0)
+    {
+        logWithTime("[ERROR] Capture: %s socket(AF_PACKET): %s", cap->ifAddr, strerror(errno));
+        return -1;
+    }
+
+    /* filter before the ring is bound, so nothing unrelated is ever queued */
+    if (lmtBuildFilter(cap, &prog) < 0 ||
+        setsockopt(cap->fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0)
+    {
+        logWithTime("[ERROR] Capture: %s setsockopt (SO_ATTACH_FILTER): %s", cap->ifAddr, strerror(errno));
+        return -1;
+    }
+    free(prog.filter);
+
+    if (setsockopt(cap->fd, SOL_PACKET, PACKET_VERSION, &ver, sizeof(ver)) < 0)
+    {
+        logWithTime("[ERROR] Capture: %s setsockopt (PACKET_VERSION): %s", cap->ifAddr, strerror(errno));
+        return -1;
+    }
+
+    memset(&cap->req, 0, sizeof(cap->req));
+    cap->req.tp_block_size = CAPTURE_BLOCK_SIZE;
+    cap->req.tp_block_nr = CAPTURE_BLOCK_NR;
+    cap->req.tp_frame_size = CAPTURE_FRAME_SIZE;
+    cap->req.tp_frame_nr = (CAPTURE_BLOCK_SIZE / CAPTURE_FRAME_SIZE) * CAPTURE_BLOCK_NR;
+    cap->req.tp_retire_blk_tov = CAPTURE_BLOCK_TOV_MS;
+    if (setsockopt(cap->fd, SOL_PACKET, PACKET_RX_RING, &cap->req, sizeof(cap->req)) < 0)
+    {
+        logWithTime("[ERROR] Capture: %s setsockopt (PACKET_RX_RING): %s", cap->ifAddr, strerror(errno));
+        return -1;
+    }
+
+    cap->ring = mmap(NULL, (size_t)CAPTURE_BLOCK_SIZE * CAPTURE_BLOCK_NR, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, cap->fd, 0);
+    if (cap->ring == MAP_FAILED)
+        cap->ring = mmap(NULL, (size_t)CAPTURE_BLOCK_SIZE * CAPTURE_BLOCK_NR, PROT_READ | PROT_WRITE, MAP_SHARED, cap->fd, 0);
+    if (cap->ring == MAP_FAILED)
+    {
+        logWithTime("[ERROR] Capture: %s mmap: %s", cap->ifAddr, strerror(errno));
+        return -1;
+    }
+
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_IP);
+    sll.sll_ifindex = cap->ifIndex;
+    if (bind(cap->fd, (struct sockaddr*)&sll, sizeof(sll)) < 0)
+    {
+        logWithTime("[ERROR] Capture: %s bind: %s", cap->ifAddr, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/* Hands one IPv4 frame to its channel, the payload stays in the ring */
+static inline void lmtCaptureFrame(lmtCapture *cap, const uint8_t *ip, unsigned int len, long long arrival, long long now)
+{
+    unsigned int ihl = (ip[0] & 0x0f) * 4;
+    if (len < ihl + 8)
+        return;
+
+    const uint8_t *udp = ip + ihl;
+    thread_params *chan = lmtChanMapGet(&cap->map, *(uint32_t*)(ip + 16), *(uint16_t*)(udp + 2));
+    if (!chan)
+        return;
+
+    int n = ((udp[4] << 8) | udp[5]) - 8;
+    if (n < 0 || (unsigned int)n > len - ihl - 8)
+        n = len - ihl - 8;
+
+    chan->lastRxTick = cap->wheel.tick;
+    if (chan->captureGen != cap->gen)
+    {
+        chan->captureGen = cap->gen;
+        cap->touched[cap->touchedCnt++] = chan;
+    }
+    long long start = lmtMonoNs();
+    lmtParseDgram(chan, (uint8_t*)udp + 8, n, arrival);
+    lmtProbeDgram(chan->probe, now - arrival, lmtMonoNs() - start);
+}
+
+void lmtCaptureBlock(lmtCapture *cap, struct tpacket_block_desc *block)
+{
+    struct tpacket3_hdr *hdr = (struct tpacket3_hdr*)((uint8_t*)block + block->hdr.bh1.offset_to_first_pkt);
+    long long now = lmtNowNs();
+
+    cap->gen++;
+    cap->touchedCnt = 0;
+    for (unsigned int i = 0; i < block->hdr.bh1.num_pkts; ++i)
+    {
+        struct sockaddr_ll *sll = (struct sockaddr_ll*)((uint8_t*)hdr + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+
+        /* locally sent copies of the groups are not what we're monitoring */
+        if (sll->sll_pkttype != PACKET_OUTGOING)
+            lmtCaptureFrame(cap, (uint8_t*)hdr + hdr->tp_net, hdr->tp_snaplen, (long long)hdr->tp_sec * 1000000000LL + hdr->tp_nsec, now);
+        hdr = (struct tpacket3_hdr*)((uint8_t*)hdr + hdr->tp_next_offset);
+    }
+
+    /* the window bookkeeping runs once per block per channel, like once per recvmmsg batch */
+    for (int i = 0; i < cap->touchedCnt; ++i)
+    {
+        lmtParseWindow(cap->touched[i], lmtCoarseUs());
+    }
+}
+
+/* The ring's drops can't be put down to a channel, they are the whole interface's */
+void lmtCaptureStats(lmtCapture *cap)
+{
+    struct tpacket_stats_v3 st;
+    socklen_t len = sizeof(st);
+
+    cap->statsTick = cap->wheel.tick;
+    if (getsockopt(cap->fd, SOL_PACKET, PACKET_STATISTICS, &st, &len) < 0 || st.tp_drops == 0)
+        return;
+    cap->drops += st.tp_drops;
+    logWithTime("[WARNING] Capture: %s ring dropped %u frames, %llu so far", cap->ifAddr, st.tp_drops, cap->drops);
+}
+
+void *lmtCaptureLoop(void *arg)
+{
+    lmtCapture *cap = (lmtCapture*)arg;
+    struct pollfd pfd = { .fd = cap->fd, .events = POLLIN | POLLERR };
+    unsigned int blockIdx = 0;
+
+    while(1)
+    {
+        struct tpacket_block_desc *block = (struct tpacket_block_desc*)(cap->ring + (size_t)blockIdx * CAPTURE_BLOCK_SIZE);
+
+        if (cap->wheel.tick - cap->statsTick >= CAPTURE_STATS_TICKS)
+            lmtCaptureStats(cap);
+
+        if ((__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0)
+        {
+            if (poll(&pfd, 1, TIMER_TICK_MS) < 0 && errno != EINTR)
+            {
+                logWithTime("[ERROR] Capture: %s poll: %s", cap->ifAddr, strerror(errno));
+                break;
+            }
+            lmtTimerWheelAdvance(&cap->wheel, lmtMonoTick());
+            continue;
+        }
+
+        lmtCaptureBlock(cap, block);
+        __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        blockIdx = (blockIdx + 1) % CAPTURE_BLOCK_NR;
+        lmtTimerWheelAdvance(&cap->wheel, lmtMonoTick());
+    }
+    return 0;
+}
+
+/* Groups the channels by receive interface and starts one ring reader per interface */
+int lmtStartCapture(thread_params **chans, int chanCount)
+{
+    lmtCapture *caps = calloc(chanCount, sizeof(lmtCapture));
+    int capCnt = 0;
+    if (!caps)
+        return -1;
+
+    for (int i = 0; i < chanCount; ++i)
+    {
+        lmtCapture *cap = NULL;
+        for (int c = 0; c < capCnt; ++c)
+        {
+            if (!strcmp(caps[c].ifAddr, chans[i]->ifAddr))
+                cap = &caps[c];
+        }
+        if (!cap)
+        {
+            cap = &caps[capCnt++];
+            cap->ifAddr = chans[i]->ifAddr;
+            cap->chans = calloc(chanCount, sizeof(thread_params*));
+            if (!cap->chans)
+                return -1;
+        }
+        cap->chans[cap->chanCnt++] = chans[i];
+        CPU_OR(&cap->cpus, &cap->cpus, &chans[i]->cpus);
+    }
+
+    for (int c = 0; c < capCnt; ++c)
+    {
+        lmtCapture *cap = &caps[c];
+        char list[256];
+        struct sock_filter dropAll = BPF_STMT(BPF_RET | BPF_K, 0);
+        struct sock_fprog dropProg = { .len = 1, .filter = &dropAll };
+
+        cap->ifIndex = lmtIfIndexByAddr(cap->ifAddr);
+        cap->touched = calloc(cap->chanCnt, sizeof(thread_params*));
+        if (cap->ifIndex < 0 || !cap->touched || lmtChanMapInit(&cap->map, cap->chanCnt) < 0)
+        {
+            logWithTime("[ERROR] Capture: no interface with address %s", cap->ifAddr);
+            return -1;
+        }
+        lmtTimerWheelInit(&cap->wheel, lmtMonoTick());
+
+        for (int i = 0; i < cap->chanCnt; ++i)
+        {
+            thread_params *chan = cap->chans[i];
+
+            /* IGMP membership stays on a regular socket that never queues any data */
+            chan->sok = openDgramSocket(chan->mcastAddr, chan->port, chan->ifAddr, chan->id, 0);
+            if (chan->sok < 0)
+            {
+                logWithTime("[ERROR] Channel: %d not monitored", chan->id);
+                continue;
+            }
+            setsockopt(chan->sok, SOL_SOCKET, SO_ATTACH_FILTER, &dropProg, sizeof(dropProg));
+
+            chan->lastRxTick = cap->wheel.tick;
+            lmtTimerAdd(&cap->wheel, &chan->rxTimer, cap->wheel.tick + READ_TIMEOUT_TICKS);
+            lmtChanMapPut(&cap->map, inet_addr(chan->mcastAddr), htons(chan->port), chan);
+        }
+
+        if (lmtCaptureOpen(cap) < 0)
+            return -1;
+        if (lmtThreadCreate(&cap->thread, lmtCaptureLoop, cap, &cap->cpus, "Capture thread"))
+        {
+            logWithTime("ERROR Creating capture thread");
+            return -1;
+        }
+        lmtFormatCpus(list, sizeof(list), &cap->cpus);
+        logWithTime("Capture: %d channels on interface %s (ifindex %d), cpus %s", cap->chanCnt, cap->ifAddr, cap->ifIndex, list);
+    }
+    return 0;
+}
+
+/*
+ * Replay of a capture through the same parser as live traffic. The file is mmap'd
+ * and datagrams are handed to lmtParseDgram() where they lie. Arrival times are
+ * the capture's own, so PCR, MDI and the 1 s windows come out the same whether
+ * it's paced in real time or run flat out (-x).
+ */
+static inline uint32_t lmtRd32(const uint8_t *p, bool swap)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return swap ? __builtin_bswap32(v) : v;
+}
+
+static inline uint16_t lmtRd16(const uint8_t *p, bool swap)
+{
+    uint16_t v;
+    memcpy(&v, p, 2);
+    return swap ? __builtin_bswap16(v) : v;
+}
+
+/* Holds the replay back until the capture's clock has caught up with the wall clock */
+static inline void lmtReplayPace(lmtReplay *rp, long long arrival)
+{
+    if (rp->fast)
+        return;
+    if (!rp->wallStart)
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        rp->wallStart = (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+        rp->capStart = arrival;
+        return;
+    }
+    long long due = rp->wallStart + (arrival - rp->capStart);
+    struct timespec ts = { .tv_sec = due / 1000000000LL, .tv_nsec = due % 1000000000LL };
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+static inline void lmtReplayDgram(lmtReplay *rp, thread_params *chan, const uint8_t *data, int len, long long arrival)
+{
+    lmtReplayPace(rp, arrival);
+    lmtParseDgram(chan, (uint8_t*)data, len, arrival);
+    lmtParseWindow(chan, arrival / 1000);
+    rp->dgrams++;
+    rp->bytes += len;
+    rp->tsPackets += len / TS_SIZE;
+    if (!rp->firstArr)
+        rp->firstArr = arrival;
+    rp->lastArr = arrival;
+}
+
+/* One captured frame of the given link type, only unfragmented IPv4 UDP to a configured channel gets through */
+void lmtReplayFrame(lmtReplay *rp, int linkType, const uint8_t *p, uint32_t len, long long arrival)
+{
+    const uint8_t *end = p + len;
+    uint16_t proto = ETH_P_IP;
+
+    switch (linkType)
+    {
+        case LINKTYPE_ETHERNET:
+            if (len < 14)
+                return;
+            proto = (p[12] << 8) | p[13];
+            p += 14;
+            while ((proto == ETH_P_8021Q || proto == ETH_P_8021AD) && p + 4 <= end)
+            {
+                proto = (p[2] << 8) | p[3];
+                p += 4;
+            }
+            break;
+        case LINKTYPE_LINUX_SLL:
+            if (len < 16)
+                return;
+            proto = (p[14] << 8) | p[15];
+            p += 16;
+            break;
+        case LINKTYPE_LINUX_SLL2:
+            if (len < 20)
+                return;
+            proto = (p[0] << 8) | p[1];
+            p += 20;
+            break;
+        case LINKTYPE_NULL:
+            p += 4;             /* host order AF_INET, not worth checking */
+            break;
+        case LINKTYPE_RAW:
+        case LINKTYPE_IPV4:
+            break;
+        default:
+            return;
+    }
+    if (proto != ETH_P_IP || p + 20 > end || (p[0] >> 4) != 4 || p[9] != IPPROTO_UDP)
+        return;
+
+    int ihl = (p[0] & 0x0f) * 4;
+    if ((((p[6] << 8) | p[7]) & 0x3fff) || p + ihl + 8 > end)
+        return;                 /* fragments */
+    const uint8_t *udp = p + ihl;
+    uint32_t daddr;
+    uint16_t dport;
+    memcpy(&daddr, p + 16, 4);
+    memcpy(&dport, udp + 2, 2);
+    thread_params *chan = lmtChanMapGet(&rp->map, daddr, dport);
+    if (!chan)
+    {
+        rp->unmatched++;
+        return;
+    }
+    int n = ((udp[4] << 8) | udp[5]) - 8;
+    if (n <= 0 || udp + 8 + n > end)
+        return;                 /* cut short by the snap length */
+    if (dport != htons(chan->port))
+        lmtFecDgram(chan, udp + 8, n);
+    else
+        lmtReplayDgram(rp, chan, udp + 8, n, arrival);
+}
+
+int lmtReplayPcap(lmtReplay *rp, const uint8_t *p, const uint8_t *end)
+{
+    uint32_t magic = lmtRd32(p, false);
+    bool swap = magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1;
+    bool nsec = magic == 0xa1b23c4d || magic == 0x4d3cb2a1;
+    int linkType = lmtRd32(p + 20, swap) & 0xffff;
+
+    for (p += 24; p + 16 <= end; )
+    {
+        uint32_t incl = lmtRd32(p + 8, swap);
+        long long arrival = (long long)lmtRd32(p, swap) * 1000000000LL + (long long)lmtRd32(p + 4, swap) * (nsec ? 1 : 1000);
+        if (p + 16 + incl > end)
+            break;
+        lmtReplayFrame(rp, linkType, p + 16, incl, arrival);
+        p += 16 + incl;
+    }
+    return 0;
+}
+
+/* Section header, interface description and enhanced packet blocks, which is what capture tools write */
+int lmtReplayPcapng(lmtReplay *rp, const uint8_t *p, const uint8_t *end)
+{
+    int linkType[PCAPNG_MAX_IFS];
+    long long tsDiv[PCAPNG_MAX_IFS], tsMul[PCAPNG_MAX_IFS];
+    int ifCnt = 0;
+    bool swap = false;
+
+    while (p + 12 <= end)
+    {
+        uint32_t type = lmtRd32(p, swap);
+        uint32_t blen;
+
+        if (type == 0x0a0d0d0a)
+        {
+            /* the byte order magic decides for the rest of the section */
+            swap = lmtRd32(p + 8, false) != 0x1a2b3c4d;
+            ifCnt = 0;
+        }
+        blen = lmtRd32(p + 4, swap);
+        if (blen < 12 || p + blen > end)
+            break;
+
+        if (type == 1 && ifCnt < PCAPNG_MAX_IFS)
+        {
+            /* microseconds unless an if_tsresol option says otherwise */
+            linkType[ifCnt] = lmtRd16(p + 8, swap);
+            tsDiv[ifCnt] = 1;
+            tsMul[ifCnt] = 1000;
+            for (const uint8_t *o = p + 16; o + 4 <= p + blen - 4; )
+            {
+                uint16_t code = lmtRd16(o, swap), olen = lmtRd16(o + 2, swap);
+                if (code == 0)
+                    break;
+                if (code == 9 && olen == 1)
+                {
+                    uint8_t res = o[4];
+                    long long units = 1;
+                    for (int i = 0; i < (res & 0x7f) && units < 1000000000000000000LL; ++i)
+                        units *= (res & 0x80) ? 2 : 10;
+                    tsMul[ifCnt] = units >= 1000000000LL ? 1 : 1000000000LL / units;
+                    tsDiv[ifCnt] = units >= 1000000000LL ? units / 1000000000LL : 1;
+                }
+                o += 4 + ((olen + 3) & ~3);
+            }
+            ifCnt++;
+        }
+        else if (type == 6 && blen >= 32)
+        {
+            uint32_t ifId = lmtRd32(p + 8, swap);
+            uint32_t incl = lmtRd32(p + 20, swap);
+            if (ifId < (uint32_t)ifCnt && 28 + incl <= blen)
+            {
+                unsigned long long ts = ((unsigned long long)lmtRd32(p + 12, swap) << 32) | lmtRd32(p + 16, swap);
+                lmtReplayFrame(rp, linkType[ifId], p + 28, incl, (long long)(ts * tsMul[ifId] / tsDiv[ifId]));
+            }
+        }
+        p += blen;
+    }
+    return 0;
+}
+
+/* Plain TS has no clock of its own, datagrams of 7 packets are timed to the -b bitrate */
+int lmtReplayTs(lmtReplay *rp, const uint8_t *p, const uint8_t *end, int tsSize)
+{
+    thread_params *chan = rp->chans[0];
+    int dgram = TS_PER_DGRAM * tsSize;
+    long long start = lmtNowNs();
+    unsigned long long sent = 0;
+
+    for (; p + tsSize <= end; p += dgram)
+    {
+        int len = end - p < dgram ? (end - p) / tsSize * tsSize : dgram;
+        lmtReplayDgram(rp, chan, p, len, start + (long long)(sent * 8e9 / rp->tsBitrate));
+        sent += len;
+    }
+    return 0;
+}
+
+void *lmtReplayLoop(void *arg)
+{
+    lmtReplay *rp = (lmtReplay*)arg;
+    const uint8_t *p = rp->data, *end = rp->data + rp->size;
+    uint32_t magic = rp->size >= 24 ? lmtRd32(p, false) : 0;
+    struct timespec t0, t1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (magic == 0xa1b2c3d4 || magic == 0xd4c3b2a1 || magic == 0xa1b23c4d || magic == 0x4d3cb2a1)
+        lmtReplayPcap(rp, p, end);
+    else if (magic == 0x0a0d0d0a)
+        lmtReplayPcapng(rp, p, end);
+    else if (rp->size > TS_SIZE_FEC && p[0] == 0x47 && (p[TS_SIZE] == 0x47 || p[TS_SIZE_FEC] == 0x47))
+        lmtReplayTs(rp, p, end, p[TS_SIZE] == 0x47 ? TS_SIZE : TS_SIZE_FEC);
+    else
+        logWithTime("[ERROR] replay %s: not a pcap, pcapng or TS file", rp->path);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    /* what's left of the last window */
+    for (int i = 0; i < rp->chanCount; ++i)
+        lmtPublish(rp->chans[i]);
+
+    double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    double capSecs = (rp->lastArr - rp->firstArr) / 1e9;
+    logWithTime("replay %s: %llu datagrams, %llu TS packets, %.1f MB in %.3f s: %.0f TS packets/s, %.1f Mbit/s, %.1fx real time, %llu datagrams for no channel",
+        rp->path, rp->dgrams, rp->tsPackets, rp->bytes / 1e6, secs, secs > 0 ? rp->tsPackets / secs : 0, secs > 0 ? rp->bytes * 8 / secs / 1e6 : 0,
+        secs > 0 ? capSecs / secs : 0, rp->unmatched);
+    __atomic_store_n(&rp->done, true, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+int lmtStartReplay(lmtReplay *rp, thread_params **chans, int chanCount)
+{
+    struct stat st;
+    int fd = open(rp->path, O_RDONLY);
+
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        logWithTime("[ERROR] replay %s: %s", rp->path, strerror(errno));
+        return -1;
+    }
+    /* private and writable so the parser's uint8_t * is honest, no page gets copied unless written */
+    rp->data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (rp->data == MAP_FAILED)
+    {
+        logWithTime("[ERROR] replay %s: mmap: %s", rp->path, strerror(errno));
+        return -1;
+    }
+    madvise(rp->data, st.st_size, MADV_SEQUENTIAL);
+    rp->size = st.st_size;
+    rp->chans = chans;
+    rp->chanCount = chanCount;
+    if (lmtChanMapInit(&rp->map, chanCount * 3) < 0)
+        return -1;
+    for (int i = 0; i < chanCount; ++i)
+    {
+        lmtChanMapPut(&rp->map, inet_addr(chans[i]->mcastAddr), htons(chans[i]->port), chans[i]);
+        if (chans[i]->fec)
+        {
+            lmtChanMapPut(&rp->map, inet_addr(chans[i]->mcastAddr), htons(chans[i]->port + FEC_PORT_COL), chans[i]);
+            lmtChanMapPut(&rp->map, inet_addr(chans[i]->mcastAddr), htons(chans[i]->port + FEC_PORT_ROW), chans[i]);
+        }
+    }
+
+    if (pthread_create(&rp->thread, NULL, lmtReplayLoop, rp))
+        return -1;
+    logWithTime("replaying %s (%lld bytes), %s", rp->path, (long long)st.st_size, rp->fast ? "as fast as possible" : "in real time");
+    return 0;
+}
+
+/*
+ * Prometheus endpoint. One thread, non blocking sockets on an epoll, connection
+ * slots and their output buffers are kept and reused, so once a buffer has grown
+ * to the size of a scrape nothing is allocated anymore. Channel state comes from
+ * the seqlock snapshots, a scrape never makes a parser wait.
+ */
+static bool lmtOutPrintf(lmtHttpConn *conn, const char *fmt, ...)
+{
+    va_list ap;
+
+    while (1)
+    {
+        size_t room = conn->outCap - conn->outLen;
+        va_start(ap, fmt);
+        int n = vsnprintf(conn->out + conn->outLen, room, fmt, ap);
+        va_end(ap);
+        if (n < 0)
+            return false;
+        if ((size_t)n < room)
+        {
+            conn->outLen += n;
+            return true;
+        }
+        size_t cap = conn->outCap ? conn->outCap * 2 : HTTP_OUT_SIZE;
+        char *out = realloc(conn->out, cap);
+        if (!out)
+            return false;
+        conn->out = out;
+        conn->outCap = cap;
+    }
+}
+
+/* One metric family: HELP, TYPE and a sample per channel */
+#define LMT_METRIC(name, type, help, valFmt, val) \
+    do { \
+        lmtOutPrintf(conn, "# HELP discont_" name " " help "\n# TYPE discont_" name " " type "\n"); \
+        for (int i = 0; i < http->chanCount; ++i) \
+        { \
+            const lmtChanSnap *snap = &http->snaps[i]; \
+            lmtOutPrintf(conn, "discont_" name "{channel=\"%d\",group=\"%s:%hu\"} " valFmt "\n", snap->id, \
+                http->chans[i]->mcastAddr, http->chans[i]->port, val); \
+        } \
+    } while (0)
+
+/* Called with the registry locked, so the channels stay put for the whole scrape */
+void lmtHttpMetrics(lmtHttp *http, lmtHttpConn *conn)
+{
+    http->chans = g_reg.chans;
+    http->chanCount = g_reg.count;
+    if (http->chanCount > http->snapsSize)
+    {
+        lmtChanSnap *snaps = realloc(http->snaps, http->chanCount * sizeof(lmtChanSnap));
+        if (!snaps)
+        {
+            http->chanCount = http->snapsSize;
+            logWithTime("[ERROR] metrics: out of memory, %d channels left out", g_reg.count - http->snapsSize);
+        }
+        else
+        {
+            http->snaps = snaps;
+            http->snapsSize = http->chanCount;
+        }
+    }
+    for (int i = 0; i < http->chanCount; ++i)
+        lmtSnapRead(http->chans[i], &http->snaps[i]);
+
+    LMT_METRIC("up", "gauge", "1 while the channel receives data", "%d", snap->isStream);
+    LMT_METRIC("bitrate_mbps", "gauge", "TS bitrate of the last 1 s window in Mbit/s", "%.3f", snap->chanInfo.sBitrate);
+    LMT_METRIC("bitrate_avg_mbps", "gauge", "Smoothed TS bitrate in Mbit/s", "%.3f", snap->chanInfo.sBitrateAvg);
+    LMT_METRIC("null_bitrate_mbps", "gauge", "Smoothed bitrate of null packets (PID 0x1FFF) in Mbit/s", "%.3f", snap->chanInfo.sNullBitrate);
+    LMT_METRIC("cc_errors_minute", "gauge", "CC and RTP sequence errors over the last minute", "%d", snap->oneMinuteCC);
+    LMT_METRIC("rtp_lost_datagrams_total", "counter", "RTP datagrams missing by sequence number", "%llu", snap->chanInfo.rtpLost);
+    LMT_METRIC("rtp_reordered_datagrams_total", "counter", "RTP datagrams that came in behind a later one, in time not to count as lost", "%llu", snap->rtp.reordered);
+    LMT_METRIC("rtp_late_datagrams_total", "counter", "RTP datagrams that came in after they were counted as lost", "%llu", snap->rtp.late);
+    LMT_METRIC("rtp_duplicate_datagrams_total", "counter", "RTP datagrams received twice", "%llu", snap->rtp.duplicates);
+    LMT_METRIC("rtp_jitter_us", "gauge", "RFC 3550 interarrival jitter", "%.1f", snap->rtp.jitterUs);
+    LMT_METRIC("fec_recoverable_datagrams_total", "counter", "Lost RTP datagrams the SMPTE 2022-1 FEC received could rebuild", "%llu", snap->rtp.fecRecoverable);
+    LMT_METRIC("fec_unrecoverable_datagrams_total", "counter", "Lost RTP datagrams the SMPTE 2022-1 FEC received could not rebuild", "%llu", snap->rtp.fecUnrecoverable);
+    LMT_METRIC("pat_parsed", "gauge", "1 once a PAT with the program was received", "%d", snap->chanInfo.sPatParsed);
+    LMT_METRIC("pmt_parsed", "gauge", "1 once the program's PMT was received", "%d", snap->chanInfo.pmtParsed);
+    LMT_METRIC("audio_tracks", "gauge", "Audio streams in the PMT", "%d", snap->chanInfo.aPidCnt);
+    LMT_METRIC("mdi_df_ms", "gauge", "RFC 4445 delay factor of the last 1 s window", "%.3f", snap->mdi.df);
+    LMT_METRIC("mdi_mlr", "gauge", "RFC 4445 media loss rate of the last 1 s window, packets per second", "%.3f", snap->mdi.mlr);
+    LMT_METRIC("pcr_jitter_p99_us", "gauge", "99th percentile PCR arrival jitter of the last 1 s window", "%lld", snap->pcr.jitterP99Us);
+    LMT_METRIC("pcr_drift_ppm", "gauge", "PCR clock against the probe's clock", "%.3f", snap->pcr.driftPpm);
+    LMT_METRIC("kernel_drops_total", "counter", "Datagrams the kernel dropped on the channel's socket (SO_RXQ_OVFL), 0 with capture shared or packet whose drops are logged per port or interface", "%llu", snap->probe.drops);
+    LMT_METRIC("truncated_total", "counter", "Datagrams larger than a receive slot", "%llu", snap->probe.truncated);
+    LMT_METRIC("rcvbuf_bytes", "gauge", "Socket receive buffer as the kernel reports it", "%d", snap->probe.rcvbuf);
+    LMT_METRIC("parse_p99_ns", "gauge", "99th percentile parse time per datagram of the last 1 s window", "%lld", snap->probe.parseP99Ns);
+    LMT_METRIC("queue_p99_us", "gauge", "99th percentile kernel timestamp to parse delay of the last 1 s window", "%lld", snap->probe.queueP99Us);
+    LMT_METRIC("rx_cpu", "gauge", "CPU the kernel last received the channel's packets on (SO_INCOMING_CPU, connected sockets only), -1 if unknown", "%d", snap->probe.rxCpu);
+    LMT_METRIC("rx_napi_id", "gauge", "NAPI id of the NIC receive queue the channel's packets came in on (SO_INCOMING_NAPI_ID), 0 if unknown", "%u", snap->probe.napiId);
+    LMT_METRIC("parse_cpu", "gauge", "CPU the channel was last parsed on, -1 before it was", "%d", snap->probe.parseCpu);
+
+    lmtOutPrintf(conn, "# HELP discont_cc_errors_total Continuity counter errors per PID\n# TYPE discont_cc_errors_total counter\n");
+    for (int i = 0; i < http->chanCount; ++i)
+    {
+        const lmtChanSnap *snap = &http->snaps[i];
+        for (int p = 0; p < snap->pidCnt; ++p)
+            lmtOutPrintf(conn, "discont_cc_errors_total{channel=\"%d\",group=\"%s:%hu\",pid=\"%hu\"} %u\n", snap->id,
+                http->chans[i]->mcastAddr, http->chans[i]->port, snap->pids[p].pid, snap->pids[p].ccErrors);
+    }
+
+    lmtOutPrintf(conn, "# HELP discont_pid_bitrate_mbps Smoothed bitrate per PID in Mbit/s\n# TYPE discont_pid_bitrate_mbps gauge\n");
+    for (int i = 0; i < http->chanCount; ++i)
+    {
+        const lmtChanSnap *snap = &http->snaps[i];
+        for (int p = 0; p < snap->pidCnt; ++p)
+            lmtOutPrintf(conn, "discont_pid_bitrate_mbps{channel=\"%d\",group=\"%s:%hu\",pid=\"%hu\"} %.3f\n", snap->id,
+                http->chans[i]->mcastAddr, http->chans[i]->port, snap->pids[p].pid, snap->pids[p].mbps);
+    }
+
+    lmtOutPrintf(conn, "# HELP discont_service_up 1 while packets of the program come in\n# TYPE discont_service_up gauge\n");
+    for (int i = 0; i < http->chanCount; ++i)
+    {
+        const lmtChanSnap *snap = &http->snaps[i];
+        for (int v = 0; v < snap->serviceCnt && v < SNAP_MAX_SERVICES; ++v)
+            lmtOutPrintf(conn, "discont_service_up{channel=\"%d\",group=\"%s:%hu\",sid=\"%hu\"} %d\n", snap->id,
+                http->chans[i]->mcastAddr, http->chans[i]->port, snap->services[v].sid, snap->services[v].present);
+    }
+
+    lmtOutPrintf(conn, "# HELP discont_service_bitrate_mbps Smoothed bitrate of the program's PMT and elementary PIDs in Mbit/s\n# TYPE discont_service_bitrate_mbps gauge\n");
+    for (int i = 0; i < http->chanCount; ++i)
+    {
+        const lmtChanSnap *snap = &http->snaps[i];
+        for (int v = 0; v < snap->serviceCnt && v < SNAP_MAX_SERVICES; ++v)
+            lmtOutPrintf(conn, "discont_service_bitrate_mbps{channel=\"%d\",group=\"%s:%hu\",sid=\"%hu\"} %.3f\n", snap->id,
+                http->chans[i]->mcastAddr, http->chans[i]->port, snap->services[v].sid, snap->services[v].mbps);
+    }
+
+    lmtOutPrintf(conn, "# HELP discont_service_cc_errors_total Continuity counter errors on the program's PMT and elementary PIDs\n# TYPE discont_service_cc_errors_total counter\n");
+    for (int i = 0; i < http->chanCount; ++i)
+    {
+        const lmtChanSnap *snap = &http->snaps[i];
+        for (int v = 0; v < snap->serviceCnt && v < SNAP_MAX_SERVICES; ++v)
+            lmtOutPrintf(conn, "discont_service_cc_errors_total{channel=\"%d\",group=\"%s:%hu\",sid=\"%hu\"} %u\n", snap->id,
+                http->chans[i]->mcastAddr, http->chans[i]->port, snap->services[v].sid, snap->services[v].ccErrors);
+    }
+
+    lmtOutPrintf(conn, "# HELP discont_service_pmt_changes_total PMT version changes of the program\n# TYPE discont_service_pmt_changes_total counter\n");
+    for (int i = 0; i < http->chanCount; ++i)
+    {
+        const lmtChanSnap *snap = &http->snaps[i];
+        for (int v = 0; v < snap->serviceCnt && v < SNAP_MAX_SERVICES; ++v)
+            lmtOutPrintf(conn, "discont_service_pmt_changes_total{channel=\"%d\",group=\"%s:%hu\",sid=\"%hu\"} %d\n", snap->id,
+                http->chans[i]->mcastAddr, http->chans[i]->port, snap->services[v].sid, snap->services[v].pmtChanges);
+    }
+
+    lmtOutPrintf(conn, "# HELP discont_tr101290_errors_total TR 101 290 indicator counts\n# TYPE discont_tr101290_errors_total counter\n");
+    for (int i = 0; i < http->chanCount; ++i)
+    {
+        for (int t = 0; t < TR_COUNT; ++t)
+            lmtOutPrintf(conn, "discont_tr101290_errors_total{channel=\"%d\",group=\"%s:%hu\",indicator=\"%s\"} %d\n", http->snaps[i].id,
+                http->chans[i]->mcastAddr, http->chans[i]->port, lmtTrNames[t], http->snaps[i].chanInfo.tr[t]);
+    }
+
+    lmtOutPrintf(conn, "# HELP discont_tr101290_active 1 while the TR 101 290 condition holds\n# TYPE discont_tr101290_active gauge\n");
+    for (int i = 0; i < http->chanCount; ++i)
+    {
+        for (int t = 0; t < TR_COUNT; ++t)
+            lmtOutPrintf(conn, "discont_tr101290_active{channel=\"%d\",group=\"%s:%hu\",indicator=\"%s\"} %d\n", http->snaps[i].id,
+                http->chans[i]->mcastAddr, http->chans[i]->port, lmtTrNames[t], !!(http->snaps[i].chanInfo.trActive & (1 << t)));
+    }
+
+    lmtOutPrintf(conn, "# HELP discont_alarm 1 while the alarm is raised\n# TYPE discont_alarm gauge\n");
+    for (int i = 0; i < http->chanCount; ++i)
+    {
+        for (int a = 0; a < ALARM_STATES; ++a)
+            lmtOutPrintf(conn, "discont_alarm{channel=\"%d\",group=\"%s:%hu\",alarm=\"%s\"} %d\n", http->snaps[i].id,
+                http->chans[i]->mcastAddr, http->chans[i]->port, lmtAlarmNames[a], !!(http->snaps[i].alarms & (1u << a)));
+    }
+}
+
+/* Builds the whole response in the connection's buffer, the header goes in the room left in front */
+void lmtHttpRespond(lmtHttp *http, lmtHttpConn *conn)
+{
+    char hdr[HTTP_HDR_ROOM];
+    const char *status = "200 OK";
+    const char *type = "text/plain; version=0.0.4; charset=utf-8";
+
+    if (!conn->out && !(conn->out = malloc(HTTP_OUT_SIZE)))
+        goto fail;
+    conn->outCap = conn->outCap ? conn->outCap : HTTP_OUT_SIZE;
+    conn->outLen = HTTP_HDR_ROOM;
+
+    if (!strncmp(conn->req, "GET /metrics ", 13) || !strncmp(conn->req, "GET /metrics?", 13))
+    {
+        pthread_mutex_lock(&g_reg.lock);
+        lmtHttpMetrics(http, conn);
+        pthread_mutex_unlock(&g_reg.lock);
+    }
+    else if (!strncmp(conn->req, "GET ", 4))
+    {
+        status = "404 Not Found";
+        lmtOutPrintf(conn, "try /metrics\n");
+    }
+    else
+    {
+        status = "405 Method Not Allowed";
+        lmtOutPrintf(conn, "GET only\n");
+    }
+
+    int hlen = snprintf(hdr, sizeof(hdr), "HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+        status, type, conn->outLen - HTTP_HDR_ROOM);
+    if (hlen >= (int)sizeof(hdr))
+        goto fail;
+    conn->outOff = HTTP_HDR_ROOM - hlen;
+    memcpy(conn->out + conn->outOff, hdr, hlen);
+    return;
+
+fail:
+    conn->outOff = conn->outLen = 0;
+}
+
+void lmtHttpClose(lmtHttp *http, lmtHttpConn *conn)
+{
+    epoll_ctl(http->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    conn->fd = -1;
+}
+
+void lmtHttpAccept(lmtHttp *http)
+{
+    int fd;
+
+    while ((fd = accept4(http->lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+    {
+        lmtHttpConn *conn = NULL;
+        for (int i = 0; i < HTTP_MAX_CONNS && !conn; ++i)
+        {
+            if (http->conns[i].fd < 0)
+                conn = &http->conns[i];
+        }
+        if (!conn)
+        {
+            close(fd);
+            continue;
+        }
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = conn };
+        conn->fd = fd;
+        conn->reqLen = 0;
+        conn->outLen = conn->outOff = 0;
+        conn->deadline = lmtMonoTick() + HTTP_TIMEOUT_TICKS;
+        if (epoll_ctl(http->epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        {
+            close(fd);
+            conn->fd = -1;
+        }
+    }
+}
+
+/* Reads until the end of the request headers, then switches the connection to writing */
+void lmtHttpRead(lmtHttp *http, lmtHttpConn *conn)
+{
+    while (1)
+    {
+        ssize_t n = recv(conn->fd, conn->req + conn->reqLen, HTTP_REQ_SIZE - 1 - conn->reqLen, 0);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+        {
+            lmtHttpClose(http, conn);
+            return;
+        }
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        conn->reqLen += n;
+        conn->req[conn->reqLen] = '\0';
+        if (strstr(conn->req, "\r\n\r\n") || strstr(conn->req, "\n\n") || conn->reqLen == HTTP_REQ_SIZE - 1)
+            break;
+    }
+
+    lmtHttpRespond(http, conn);
+    if (conn->outLen == 0)
+    {
+        lmtHttpClose(http, conn);
+        return;
+    }
+    struct epoll_event ev = { .events = EPOLLOUT, .data.ptr = conn };
+    epoll_ctl(http->epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+}
+
+void lmtHttpWrite(lmtHttp *http, lmtHttpConn *conn)
+{
+    while (conn->outOff < conn->outLen)
+    {
+        ssize_t n = send(conn->fd, conn->out + conn->outOff, conn->outLen - conn->outOff, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                lmtHttpClose(http, conn);
+            return;
+        }
+        conn->outOff += n;
+    }
+    lmtHttpClose(http, conn);
+}
+
+void *lmtHttpLoop(void *arg)
+{
+    lmtHttp *http = (lmtHttp*)arg;
+    struct epoll_event events[HTTP_MAX_CONNS + 1];
+
+    while (1)
+    {
+        int n = epoll_wait(http->epfd, events, HTTP_MAX_CONNS + 1, TIMER_TICK_MS * 10);
+        for (int i = 0; i < n; ++i)
+        {
+            lmtHttpConn *conn = events[i].data.ptr;
+            if (!conn)
+                lmtHttpAccept(http);
+            else if (events[i].events & (EPOLLERR | EPOLLHUP) && !(events[i].events & (EPOLLIN | EPOLLOUT)))
+                lmtHttpClose(http, conn);
+            else if (conn->outLen)
+                lmtHttpWrite(http, conn);
+            else
+                lmtHttpRead(http, conn);
+        }
+
+        /* clients that never finish their request or stop reading */
+        long long now = lmtMonoTick();
+        for (int i = 0; i < HTTP_MAX_CONNS; ++i)
+        {
+            if (http->conns[i].fd >= 0 && now > http->conns[i].deadline)
+                lmtHttpClose(http, &http->conns[i]);
+        }
+    }
+    return NULL;
+}
+
+/* bindAddr is "address:port", e.g. "127.0.0.1:9310" */
+int lmtStartHttp(const char *bindAddr)
+{
+    char addr[64];
+    const char *colon = strrchr(bindAddr, ':');
+    struct sockaddr_in sin;
+    int yes = 1;
+
+    if (!colon || colon - bindAddr >= (int)sizeof(addr))
+    {
+        logWithTime("[ERROR] metrics: \"%s\" is not address:port", bindAddr);
+        return -1;
+    }
+    memcpy(addr, bindAddr, colon - bindAddr);
+    addr[colon - bindAddr] = '\0';
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(atoi(colon + 1));
+    if (inet_pton(AF_INET, addr[0] ? addr : "0.0.0.0", &sin.sin_addr) != 1 || sin.sin_port == 0)
+    {
+        logWithTime("[ERROR] metrics: \"%s\" is not address:port", bindAddr);
+        return -1;
+    }
+
+    lmtHttp *http = calloc(1, sizeof(lmtHttp));
+    if (!http)
+        return -1;
+    for (int i = 0; i < HTTP_MAX_CONNS; ++i)
+        http->conns[i].fd = -1;
+
+    http->lfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    setsockopt(http->lfd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    if (http->lfd < 0 || bind(http->lfd, (struct sockaddr *)&sin, sizeof(sin)) < 0 || listen(http->lfd, HTTP_MAX_CONNS) < 0)
+    {
+        logWithTime("[ERROR] metrics: can't listen on %s: %s", bindAddr, strerror(errno));
+        return -1;
+    }
+    http->epfd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    if (http->epfd < 0 || epoll_ctl(http->epfd, EPOLL_CTL_ADD, http->lfd, &ev) < 0)
+        return -1;
+    if (pthread_create(&http->thread, NULL, lmtHttpLoop, http))
+        return -1;
+    logWithTime("metrics on http://%s/metrics", bindAddr);
+    return 0;
+}
+
+/* Non zero indicators as " name:count", a * marks the ones in error right now. Returns 0 if all are clear */
+int lmtFormatTr(char *out, size_t size, const lmtChanInfo *info)
+{
+    int len = 0;
+
+    out[0] = '\0';
+    for (int i = 0; i < TR_COUNT && len < (int)size; ++i)
+    {
+        if (info->tr[i] || (info->trActive & (1 << i)))
+            len += snprintf(out + len, size - len, " %s:%d%s", lmtTrNames[i], info->tr[i], (info->trActive & (1 << i)) ? "*" : "");
+    }
+    return len;
+}
+
+static inline const char *lmtStr(const char *str)
+{
+    return str ? str : "-";
+}
+
+/* The periodic report of one channel, from its snapshot only */
+void lmtReportChannel(thread_params *chan, bool final)
+{
+    lmtChanSnap snap;
+    char trLine[LOG_LINE_SIZE - 64];
+
+    lmtSnapRead(chan, &snap);
+    logWithTime("id: %d, hasData: %d, PAT: %d, SID: %hu, pmt: %hu, vPid: %hu, vFormat: %s, AudioCnt: %d, aPid: %hu, aFormat: %s, streamType: %s, Bitrate: %.2f, MDI: %.1f:%.1f (1 min %.1f:%.1f), Errors: %d", \
+            snap.id, snap.isStream, snap.chanInfo.sPatParsed, snap.chanInfo.sSid, snap.chanInfo.sPmt, snap.chanInfo.sVpid.pid, lmtStr(snap.chanInfo.sVpid.pFormat), \
+            snap.chanInfo.aPidCnt, snap.chanInfo.sApid[0].pid, lmtStr(snap.chanInfo.sApid[0].pFormat), lmtStr(snap.chanInfo.sStreamType), snap.chanInfo.sBitrate, \
+            snap.mdi.df, snap.mdi.mlr, snap.mdi.dfMinute, snap.mdi.mlrMinute, snap.oneMinuteCC);
+
+    if (snap.pcr.pid && snap.pcr.count)
+    {
+        logWithTime("id: %d, PCR pid: %hu, interval ms min/avg/max/p99: %.1f/%.1f/%.1f/%.1f, jitter us p50/p99/max: %lld/%lld/%lld, p2p: %lld, drift: %.1f ppm, discontinuities: %d", \
+            snap.id, snap.pcr.pid, snap.pcr.ivMinMs, snap.pcr.ivAvgMs, snap.pcr.ivMaxMs, snap.pcr.ivP99Ms, snap.pcr.jitterP50Us, snap.pcr.jitterP99Us, \
+            snap.pcr.jitterMaxUs, snap.pcr.jitterP2pUs, snap.pcr.driftPpm, snap.pcr.discontinuities);
+    }
+
+    if (snap.chanInfo.sStreamType && !strcmp(snap.chanInfo.sStreamType, "RTP"))
+    {
+        char fec[128] = "";
+        if (snap.rtp.fecPackets)
+            snprintf(fec, sizeof(fec), ", FEC: %llu datagrams, recoverable/unrecoverable: %llu/%llu", snap.rtp.fecPackets,
+                snap.rtp.fecRecoverable, snap.rtp.fecUnrecoverable);
+        logWithTime("id: %d, RTP ssrc: %#x, lost: %llu, reordered: %llu, late: %llu, duplicates: %llu, restarts: %llu, jitter: %.0f us%s", \
+            snap.id, snap.rtp.ssrc, snap.chanInfo.rtpLost, snap.rtp.reordered, snap.rtp.late, snap.rtp.duplicates, snap.rtp.restarts, \
+            snap.rtp.jitterUs, fec);
+    }
+
+    /* which part of the mux a drop hit: video, audio or stuffing */
+    if (snap.isStream && snap.pidCnt)
+    {
+        char pidRates[LOG_LINE_SIZE - 64];
+        int len = 0;
+        for (int p = 0; p < snap.pidCnt && len < (int)sizeof(pidRates) - 32; ++p)
+            len += sprintf(pidRates + len, " %hu:%.3f", snap.pids[p].pid, snap.pids[p].mbps);
+        logWithTime("id: %d, Mbit/s avg: %.3f, null: %.3f, per PID:%s", snap.id, snap.chanInfo.sBitrateAvg, snap.chanInfo.sNullBitrate, pidRates);
+    }
+
+    /* the probe's own health: slow parsing or a full socket means errors above may be ours */
+    if (snap.probe.dgrams || snap.probe.dropsWindow || snap.probe.truncated)
+    {
+        int rxNode = lmtCpuNode(snap.probe.rxCpu), parseNode = lmtCpuNode(snap.probe.parseCpu);
+        logWithTime("id: %d, probe: parse ns p50/p99/max: %lld/%lld/%lld, queue us p50/p99/max: %lld/%lld/%lld, kernel drops: %llu (%llu total), truncated: %llu, rcvbuf: %d, rx cpu/napi: %d/%u, parse cpu: %d%s", \
+            snap.id, snap.probe.parseP50Ns, snap.probe.parseP99Ns, snap.probe.parseMaxNs, snap.probe.queueP50Us, snap.probe.queueP99Us, \
+            snap.probe.queueMaxUs, snap.probe.dropsWindow, snap.probe.drops, snap.probe.truncated, snap.probe.rcvbuf, snap.probe.rxCpu, \
+            snap.probe.napiId, snap.probe.parseCpu, rxNode >= 0 && parseNode >= 0 && rxNode != parseNode ? " (different NUMA nodes)" : "");
+    }
+
+    if (lmtFormatTr(trLine, sizeof(trLine), &snap.chanInfo))
+    {
+        logWithTime("id: %d, TR 101 290:%s", snap.id, trLine);
+    }
+
+    if (snap.alarms)
+    {
+        char alarms[128];
+        int len = 0;
+        for (int a = 0; a < ALARM_STATES; ++a)
+        {
+            if (snap.alarms & (1u << a))
+                len += snprintf(alarms + len, sizeof(alarms) - len, " %s", lmtAlarmNames[a]);
+        }
+        logWithTime("id: %d, alarms:%s", snap.id, alarms);
+    }
+
+    if (snap.serviceCnt)
+    {
+        char svcs[LOG_LINE_SIZE - 64];
+        int len = 0;
+        for (int v = 0; v < snap.serviceCnt && v < SNAP_MAX_SERVICES && len < (int)sizeof(svcs) - 32; ++v)
+        {
+            const lmtServiceSnap *svc = &snap.services[v];
+            if (svc->present)
+                len += sprintf(svcs + len, " %hu:%.2f/%u", svc->sid, svc->mbps, svc->ccErrors);
+            else
+                len += sprintf(svcs + len, " %hu:-", svc->sid);
+        }
+        logWithTime("id: %d, services: %d, program:Mbit/s/CC errors:%s", snap.id, snap.serviceCnt, svcs);
+    }
+
+    /* the last report of a replay has the totals, whenever they happened */
+    if (snap.oneMinuteCC > 0 || (final && snap.chanInfo.tr[TR_CC]))
+    {
+        char pidErrs[LOG_LINE_SIZE - 64];
+        int len = 0;
+        for (int p = 0; p < snap.pidCnt && len < (int)sizeof(pidErrs) - 24; ++p)
+        {
+            if (snap.pids[p].ccErrors)
+                len += sprintf(pidErrs + len, " %hu:%u", snap.pids[p].pid, snap.pids[p].ccErrors);
+        }
+        logWithTime("id: %d, CC errors per PID:%s", snap.id, len ? pidErrs : " -");
+    }
+}
+
+/* Placement settings of a channel or the global defaults, whatever of them is there */
+void lmtReadPlacement(config_setting_t *set, lmtChanConf *conf)
+{
+    const char *cpus;
+    int preferBusyPoll = conf->preferBusyPoll;
+
+    if (config_setting_lookup_string(set, "cpus", &cpus))
+    {
+        cpu_set_t parsed;
+        if (lmtParseCpus(cpus, &parsed) < 0)
+            logWithTime("[WARNING] %s%.0d cpus \"%s\" is not a CPU list like \"0-3,8\", ignored", conf->id ? "Channel: " : "global", conf->id, cpus);
+        else
+            conf->cpus = parsed;
+    }
+    config_setting_lookup_int(set, "node", &conf->node);
+    config_setting_lookup_int(set, "busyPoll", &conf->busyPoll);
+    config_setting_lookup_bool(set, "preferBusyPoll", &preferBusyPoll);
+    conf->preferBusyPoll = preferBusyPoll;
+}
+
+/* A number whether it was written 3 or 3.0, libconfig keeps the two apart */
+int lmtLookupNumber(config_setting_t *set, const char *name, double *out)
+{
+    int val;
+
+    if (config_setting_lookup_float(set, name, out))
+        return 1;
+    if (!config_setting_lookup_int(set, name, &val))
+        return 0;
+    *out = val;
+    return 1;
+}
+
+/* The alarm settings, once at start */
+void lmtReadAlarms(config_t *cfg)
+{
+    config_setting_t *set = config_lookup(cfg, "alarms");
+    const char *sink;
+
+    if (!set)
+        return;
+    config_setting_lookup_int(set, "raise", &g_alarm.raiseSecs);
+    config_setting_lookup_int(set, "clear", &g_alarm.clearSecs);
+    config_setting_lookup_int(set, "ccRaise", &g_alarm.ccRaise);
+    config_setting_lookup_int(set, "ccClear", &g_alarm.ccClear);
+    lmtLookupNumber(set, "hysteresis", &g_alarm.hysteresis);
+    if (g_alarm.raiseSecs < 1)
+        g_alarm.raiseSecs = 1;
+    if (g_alarm.clearSecs < 1)
+        g_alarm.clearSecs = 1;
+    if (g_alarm.ccClear >= g_alarm.ccRaise && g_alarm.ccRaise > 0)
+    {
+        logWithTime("[WARNING] alarms ccClear %d isn't below ccRaise %d, using %d", g_alarm.ccClear, g_alarm.ccRaise, g_alarm.ccRaise - 1);
+        g_alarm.ccClear = g_alarm.ccRaise - 1;
+    }
+    if (config_setting_lookup_string(set, "sink", &sink) && sink[0])
+        lmtAlarmSinkOpen(sink);
+}
+
+/* The evidence settings, once at start. A replay keeps no rings, it is the evidence */
+void lmtReadEvidence(config_t *cfg, bool replay)
+{
+    config_setting_t *set = config_lookup(cfg, "evidence");
+    const char *triggers;
+    int all = 0, channelMB = g_evidence.channelBytes >> 20, totalMB = g_evidence.totalBytes >> 20;
+
+    if (replay)
+        g_evidence.totalBytes = 0;
+    if (!set || replay)
+        return;
+    config_setting_lookup_bool(set, "all", &all);
+    g_evidence.all = all;
+    config_setting_lookup_int(set, "pre", &g_evidence.pre);
+    config_setting_lookup_int(set, "post", &g_evidence.post);
+    config_setting_lookup_int(set, "holdoff", &g_evidence.holdoff);
+    config_setting_lookup_int(set, "channelMB", &channelMB);
+    config_setting_lookup_int(set, "totalMB", &totalMB);
+    if (g_evidence.pre < 0)
+        g_evidence.pre = 0;
+    if (g_evidence.post < 0)
+        g_evidence.post = 0;
+    if (g_evidence.holdoff < 0)
+        g_evidence.holdoff = 0;
+    g_evidence.channelBytes = channelMB > 0 ? (size_t)channelMB << 20 : 0;
+    g_evidence.totalBytes = totalMB > 0 ? (size_t)totalMB << 20 : 0;
+    if (config_setting_lookup_string(set, "triggers", &triggers))
+    {
+        char list[128];
+        g_evidence.triggers = 0;
+        snprintf(list, sizeof(list), "%s", triggers);
+        for (char *save, *name = strtok_r(list, ", ", &save); name; name = strtok_r(NULL, ", ", &save))
+        {
+            int r = 0;
+            while (r < EVIDENCE_REASONS && strcmp(name, lmtEvidenceNames[r]))
+                ++r;
+            if (r < EVIDENCE_REASONS)
+                g_evidence.triggers |= 1u << r;
+            else
+                logWithTime("[WARNING] evidence trigger \"%s\" isn't one of cc, rtp, pat, pmt, loss, ignored", name);
+        }
+    }
+}
 
-    config_lookup_string(&cfg, "outputFolder", &outputFolder);
-    config_lookup_bool(&cfg, "logToFile", &mLogTofile);
+/* services = true for every program of the PAT, or a list of program numbers to track */
+void lmtReadServices(config_setting_t *where, lmtChanConf *conf)
+{
+    config_setting_t *set = config_setting_get_member(where, "services");
 
-    /*Channel Config*/
+    if (!set)
+        return;
+    conf->serviceSidCnt = 0;
+    if (config_setting_type(set) == CONFIG_TYPE_BOOL)
+    {
+        conf->services = config_setting_get_bool(set);
+        return;
+    }
+    if (config_setting_type(set) != CONFIG_TYPE_ARRAY && config_setting_type(set) != CONFIG_TYPE_LIST)
+    {
+        logWithTime("[WARNING] Channel: %d services is neither true/false nor a list of program numbers, ignored", conf->id);
+        conf->services = false;
+        return;
+    }
+    int cnt = config_setting_length(set);
+    if (cnt > CONF_MAX_SIDS)
+    {
+        logWithTime("[WARNING] Channel: %d %d services listed, only the first %d are tracked", conf->id, cnt, CONF_MAX_SIDS);
+        cnt = CONF_MAX_SIDS;
+    }
+    for (int i = 0; i < cnt; ++i)
+    {
+        int sid = config_setting_get_int_elem(set, i);
+        if (sid > 0 && sid <= 0xffff)
+            conf->serviceSids[conf->serviceSidCnt++] = sid;
+        else
+            logWithTime("[WARNING] Channel: %d program number %d of services is out of range 1-65535, ignored", conf->id, sid);
+    }
+    conf->services = conf->serviceSidCnt > 0;
+}
 
-    channels = config_lookup(&cfg, "configs");
-    chanCount = config_setting_length(channels);
-    thread_params chanConfs[chanCount];
+/* The global settings channels inherit */
+void lmtReadDefaults(config_t *cfg, lmtChanConf *def)
+{
+    int fec = 0;
 
-    for (int i = 0; i < chanCount; ++i)
+    memset(def, 0, sizeof(lmtChanConf));
+    def->batch = DEFAULT_BATCH_SIZE;
+    def->node = -1;
+    config_lookup_int(cfg, "batch", &def->batch);
+    config_lookup_int(cfg, "rcvbuf", &def->rcvbuf);
+    lmtReadPlacement(config_root_setting(cfg), def);
+    lmtLookupNumber(config_root_setting(cfg), "bitrateMin", &def->bitrateMin);
+    lmtLookupNumber(config_root_setting(cfg), "bitrateMax", &def->bitrateMax);
+    def->evidence = g_evidence.all;
+    config_lookup_bool(cfg, "fec", &fec);
+    def->fec = fec;
+    lmtReadServices(config_root_setting(cfg), def);
+    if (def->serviceSidCnt)
     {
-        memset(&chanConfs[i], 0, sizeof(thread_params));
+        logWithTime("[WARNING] a services list is per channel, the global one is ignored");
+        def->services = false;
+        def->serviceSidCnt = 0;
     }
-    
-    for (int i = 0; i < chanCount; ++i)
+}
+
+/* workerCpus = ["0-3", "4-7"]: worker N runs on the (N mod count)th set. Returns the count */
+int lmtReadWorkerCpus(config_t *cfg, cpu_set_t **out)
+{
+    config_setting_t *list = config_lookup(cfg, "workerCpus");
+    int cnt = list ? config_setting_length(list) : 0;
+
+    *out = NULL;
+    if (cnt == 0 || !(*out = calloc(cnt, sizeof(cpu_set_t))))
+        return 0;
+    for (int i = 0; i < cnt; ++i)
+    {
+        const char *cpus = config_setting_get_string_elem(list, i);
+        if (!cpus || lmtParseCpus(cpus, &(*out)[i]) < 0)
+        {
+            logWithTime("[WARNING] workerCpus entry %d is not a CPU list like \"0-3,8\", that worker isn't pinned", i);
+            CPU_ZERO(&(*out)[i]);
+        }
+    }
+    return cnt;
+}
+
+/* Reads the channels of a parsed config, def has the global defaults. Ids must be unique */
+int lmtReadChannels(config_t *cfg, const lmtChanConf *def, lmtChanConf **out)
+{
+    config_setting_t *channels = config_lookup(cfg, "configs");
+    int total = channels ? config_setting_length(channels) : 0, cnt = 0;
+    lmtChanConf *confs = calloc(total ? total : 1, sizeof(lmtChanConf));
+
+    if (!confs)
+        return -1;
+    for (int i = 0; i < total; ++i)
     {
-        int id = 0, prt = 0;
+        int id = 0, prt = 0, evidence, fec;
         const char *mcast, *ifaddr;
-        
+        bool dup = false;
+
         config_setting_t *tmpConfStor = config_setting_get_elem(channels, i);
 
         if(!(config_setting_lookup_int(tmpConfStor, "id", &id) &&
@@ -662,76 +6301,659 @@ int main(int argc, char *argv[])
             config_setting_lookup_int(tmpConfStor, "port", &prt) &&
             config_setting_lookup_string(tmpConfStor, "interface", &ifaddr)))
             continue;
-        chanConfs[i].id = id;
-        chanConfs[i].mcastAddr = mcast;
-        chanConfs[i].port = prt;
-        chanConfs[i].ifAddr = ifaddr;
-        chanConfs[i].outFolder = outputFolder;
-        chanConfs[i].logToFile = mLogTofile;
-        parsedChanCount += 1;
+        for (int j = 0; j < cnt && !dup; ++j)
+            dup = confs[j].id == id;
+        if (dup || strlen(mcast) >= ADDR_SIZE || strlen(ifaddr) >= ADDR_SIZE)
+        {
+            logWithTime("[WARNING] Channel: %d %s, ignored", id, dup ? "is in the config twice" : "address too long");
+            continue;
+        }
+
+        lmtChanConf *conf = &confs[cnt++];
+        *conf = *def;
+        conf->id = id;
+        strcpy(conf->mcastAddr, mcast);
+        conf->port = prt;
+        strcpy(conf->ifAddr, ifaddr);
+        config_setting_lookup_int(tmpConfStor, "batch", &conf->batch);
+        config_setting_lookup_int(tmpConfStor, "rcvbuf", &conf->rcvbuf);
+        lmtReadPlacement(tmpConfStor, conf);
+        lmtLookupNumber(tmpConfStor, "bitrateMin", &conf->bitrateMin);
+        lmtLookupNumber(tmpConfStor, "bitrateMax", &conf->bitrateMax);
+        evidence = conf->evidence;
+        config_setting_lookup_bool(tmpConfStor, "evidence", &evidence);
+        conf->evidence = evidence;
+        fec = conf->fec;
+        config_setting_lookup_bool(tmpConfStor, "fec", &fec);
+        conf->fec = fec;
+        config_setting_lookup_int(tmpConfStor, "sid", &conf->sid);
+        if (conf->sid < 0 || conf->sid > 0xffff)
+        {
+            logWithTime("[WARNING] Channel: %d sid %d out of range 1-65535, the first program of the PAT is monitored", id, conf->sid);
+            conf->sid = 0;
+        }
+        lmtReadServices(tmpConfStor, conf);
+        if (conf->batch < 1 || conf->batch > MAX_BATCH_SIZE)
+        {
+            logWithTime("[WARNING] Channel: %d batch %d out of range 1-%d, using %d", id, conf->batch, MAX_BATCH_SIZE, DEFAULT_BATCH_SIZE);
+            conf->batch = DEFAULT_BATCH_SIZE;
+        }
+        /* the memory goes where the thread runs unless the config says otherwise */
+        if (conf->node < 0)
+            conf->node = lmtCpusNode(&conf->cpus);
+        else if (conf->node >= NODE_MAX || (g_nodeCnt && conf->node >= g_nodeCnt))
+        {
+            logWithTime("[WARNING] Channel: %d there is no NUMA node %d, ignored", id, conf->node);
+            conf->node = -1;
+        }
     }
+    *out = confs;
+    return cnt;
+}
 
-    /* End of config parsing */
-    #ifdef NDEBUG
-        for (int i = 0; i < chanCount; ++i)
+/* A ring for a new channel if the global budget has room for it, on the main thread */
+/*
+ * A ring for pre + post seconds at bitrateMax with room for bursts and the record
+ * headers, channelMB at most. Without bitrateMax it is channelMB. It is sized once,
+ * a reload that changes bitrateMax keeps the ring.
+ */
+lmtEvidence *lmtEvidenceNew(int id, int node, double bitrateMax)
+{
+    size_t bytes = g_evidence.channelBytes;
+
+    if (bitrateMax > 0)
+    {
+        double want = (g_evidence.pre + g_evidence.post) * bitrateMax * 1e6 / 8 * 1.125;
+        if (want > bytes)
+            logWithTime("[WARNING] Channel: %d evidence ring of channelMB holds %.1f s at bitrateMax, not the %d s pre + post", id,
+                bytes / (bitrateMax * 1e6 / 8 * 1.125), g_evidence.pre + g_evidence.post);
+        else
+            bytes = (size_t)want;
+        if (bytes < 4 * (sizeof(lmtEvidenceRec) + EVIDENCE_SNAP))
+            bytes = 4 * (sizeof(lmtEvidenceRec) + EVIDENCE_SNAP);
+    }
+    bytes &= ~(size_t)7;
+
+    if (!g_evidence.totalBytes)
+        return NULL;
+    if (bytes < sizeof(lmtEvidenceRec) + EVIDENCE_SNAP || g_evidence.used + bytes > g_evidence.totalBytes)
+    {
+        logWithTime("[WARNING] Channel: %d no evidence ring, totalMB of evidence is used up", id);
+        return NULL;
+    }
+    if (!g_evidence.started)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, lmtEvidenceLoop, NULL))
         {
-            logWithTime("config %d\n chan id is: %d\n multicast IP is: %s\n port is: %d\n receave interface is: %s", i, chanConfs[i].id, chanConfs[i].mcastAddr,\
-                chanConfs[i].port, chanConfs[i].ifAddr);
+            logWithTime("[WARNING] can't start the evidence writer, no evidence rings");
+            g_evidence.totalBytes = 0;
+            return NULL;
         }
-    #endif
+        pthread_detach(thread);
+        g_evidence.started = true;
+    }
+    lmtEvidence *ev = lmtNodeAlloc(sizeof(lmtEvidence), node);
+    if (ev && !(ev->buf = lmtNodeAlloc(bytes, node)))
+    {
+        lmtNodeFree(ev, sizeof(lmtEvidence), node);
+        ev = NULL;
+    }
+    if (!ev)
+    {
+        logWithTime("[WARNING] Channel: %d no memory for its evidence ring", id);
+        return NULL;
+    }
+    /* faulted in now rather than by the parser */
+    memset(ev->buf, 0, bytes);
+    ev->size = bytes;
+    g_evidence.used += bytes;
+    return ev;
+}
 
-    logWithTime("found %d channel in config file: %s with following ID's", parsedChanCount, cfg_file);
+void lmtEvidenceFree(lmtEvidence *ev, int node)
+{
+    if (!ev)
+        return;
+    g_evidence.used -= ev->size;
+    lmtNodeFree(ev->buf, ev->size, node);
+    lmtNodeFree(ev, sizeof(lmtEvidence), node);
+}
 
-    pthread_t lmtTrd[parsedChanCount];
+void lmtChanFree(thread_params *chan)
+{
+    int node = chan->node;
 
-    for (int i = 0; i < parsedChanCount; ++i)
+    free((char*)chan->mcastAddr);
+    free((char*)chan->ifAddr);
+    lmtHistoryClose(&chan->hist);
+    lmtEvidenceFree(chan->evidence, node);
+    lmtServicesFree(chan);
+    free(chan->serviceSids);
+    lmtNodeFree(chan->pids, sizeof(lmtPidTable), node);
+    lmtNodeFree(chan->psi, sizeof(lmtPsi), node);
+    lmtNodeFree(chan->pcr, sizeof(lmtPcrStats), node);
+    lmtNodeFree(chan->tr, sizeof(lmtTr), node);
+    lmtNodeFree(chan->mdi, sizeof(lmtMdi), node);
+    lmtNodeFree(chan->rtp, sizeof(lmtRtp), node);
+    lmtNodeFree(chan->probe, sizeof(lmtProbe), node);
+    lmtNodeFree(chan->meter, sizeof(lmtMeter), node);
+    lmtNodeFree(chan, sizeof(thread_params), node);
+}
+
+/* The channel's state goes on its node, the parser is the one that touches it */
+thread_params *lmtChanNew(const lmtChanConf *conf)
+{
+    thread_params *chan = lmtNodeAlloc(sizeof(thread_params), conf->node);
+
+    if (!chan)
+        return NULL;
+    chan->node = conf->node;
+    chan->cpus = conf->cpus;
+    chan->busyPoll = conf->busyPoll;
+    chan->preferBusyPoll = conf->preferBusyPoll;
+    chan->id = conf->id;
+    chan->mcastAddr = strdup(conf->mcastAddr);
+    chan->port = conf->port;
+    chan->ifAddr = strdup(conf->ifAddr);
+    chan->outFolder = g_reg.outFolder;
+    chan->batchSize = chan->nextBatch = conf->batch;
+    chan->rcvbuf = chan->nextRcvbuf = conf->rcvbuf;
+    chan->bitrateMin = chan->nextBitrateMin = conf->bitrateMin;
+    chan->bitrateMax = chan->nextBitrateMax = conf->bitrateMax;
+    chan->sok = -1;
+    chan->fec = conf->fec;
+    chan->fecSok[0] = chan->fecSok[1] = -1;
+    chan->sid = conf->sid;
+    chan->services = conf->services;
+    chan->serviceSidCnt = conf->serviceSidCnt;
+    if (conf->serviceSidCnt && (chan->serviceSids = malloc(conf->serviceSidCnt * sizeof(uint16_t))))
+        memcpy(chan->serviceSids, conf->serviceSids, conf->serviceSidCnt * sizeof(uint16_t));
+    chan->worker = -1;
+    chan->hist.fd = -1;
+    chan->hist.slots = g_reg.history > LMT_HISTORY_MIN_SLOTS ? g_reg.history : LMT_HISTORY_MIN_SLOTS;
+    chan->hist.path = g_reg.history > 0 ? lmtMakeHistoryFile(g_reg.outFolder, conf->id) : NULL;
+    chan->wantsEvidence = conf->evidence;
+    chan->evidence = conf->evidence ? lmtEvidenceNew(conf->id, conf->node, conf->bitrateMax) : NULL;
+    chan->pids = lmtNodeAlloc(sizeof(lmtPidTable), conf->node);
+    chan->psi = lmtNodeAlloc(sizeof(lmtPsi), conf->node);
+    chan->pcr = lmtNodeAlloc(sizeof(lmtPcrStats), conf->node);
+    chan->tr = lmtNodeAlloc(sizeof(lmtTr), conf->node);
+    chan->mdi = lmtNodeAlloc(sizeof(lmtMdi), conf->node);
+    chan->rtp = lmtNodeAlloc(sizeof(lmtRtp), conf->node);
+    chan->probe = lmtNodeAlloc(sizeof(lmtProbe), conf->node);
+    chan->meter = lmtNodeAlloc(sizeof(lmtMeter), conf->node);
+    if (!chan->mcastAddr || !chan->ifAddr || (chan->serviceSidCnt && !chan->serviceSids) || !chan->pids || !chan->psi || !chan->pcr || !chan->tr || !chan->mdi || !chan->rtp || !chan->probe || !chan->meter)
     {
-        thrd_created = pthread_create(&lmtTrd[i], NULL, lmtParseStream, &chanConfs[i]);
-        if (thrd_created)
+        logWithTime("[ERROR] Channel: %d can't allocate the PID tables", conf->id);
+        lmtChanFree(chan);
+        return NULL;
+    }
+    chan->probe->fd = -1;
+    chan->probe->snap.rxCpu = -1;
+    chan->probe->snap.parseCpu = -1;
+    lmtPublish(chan);
+    return chan;
+}
+
+int lmtRegAppend(thread_params *chan)
+{
+    pthread_mutex_lock(&g_reg.lock);
+    if (g_reg.count == g_reg.size)
+    {
+        int size = g_reg.size ? g_reg.size * 2 : 64;
+        thread_params **chans = realloc(g_reg.chans, size * sizeof(thread_params*));
+        if (!chans)
         {
-            logWithTime("ERROR Creating thread");
-            exit(-1);
+            pthread_mutex_unlock(&g_reg.lock);
+            logWithTime("[ERROR] Channel: %d no memory to register it", chan->id);
+            return -1;
         }
-        logWithTime("%d", chanConfs[i].id);
+        g_reg.chans = chans;
+        g_reg.size = size;
     }
+    g_reg.chans[g_reg.count++] = chan;
+    pthread_mutex_unlock(&g_reg.lock);
+    return 0;
+}
 
+/* Out of the registry, into retired until lmtReapChannels() sees the parser let go */
+void lmtRegRemove(int idx)
+{
+    thread_params *chan = g_reg.chans[idx];
 
-    logWithTime("===============================");
+    pthread_mutex_lock(&g_reg.lock);
+    memmove(&g_reg.chans[idx], &g_reg.chans[idx + 1], (g_reg.count - idx - 1) * sizeof(thread_params*));
+    g_reg.count--;
+    pthread_mutex_unlock(&g_reg.lock);
 
-    int clearCounters = 0;
+    if (g_reg.retiredCnt == g_reg.retiredSize)
+    {
+        int size = g_reg.retiredSize ? g_reg.retiredSize * 2 : 16;
+        thread_params **retired = realloc(g_reg.retired, size * sizeof(thread_params*));
+        if (!retired)
+            return;         /* never freed then, better than freed too early */
+        g_reg.retired = retired;
+        g_reg.retiredSize = size;
+    }
+    g_reg.retired[g_reg.retiredCnt++] = chan;
+}
 
-    usleep(2000000);
-    while(1)
+/* A parser thread of its own, detached: it says it's done through chan->exited */
+int lmtChanThread(thread_params *chan)
+{
+    if (lmtThreadCreate(&chan->thread, lmtParseStream, chan, &chan->cpus, "Channel thread"))
+    {
+        __atomic_store_n(&chan->exited, true, __ATOMIC_RELEASE);
+        return -1;
+    }
+    pthread_detach(chan->thread);
+    return 0;
+}
+
+/* Where a channel ended up, a worker's CPUs are the ones that count for its channels */
+void lmtLogPlacement(const thread_params *chan, const char *where)
+{
+    char list[256], worker[32];
+    const cpu_set_t *cpus = chan->worker >= 0 ? &g_reg.workers[chan->worker].cpus : &chan->cpus;
+
+    if (chan->worker >= 0)
+    {
+        snprintf(worker, sizeof(worker), "worker %d", chan->worker);
+        where = worker;
+    }
+    lmtFormatCpus(list, sizeof(list), cpus);
+    logWithTime("Channel: %d on %s, cpus %s, node %d, busy poll %d us%s", chan->id, where, list, chan->node, chan->busyPoll,
+        chan->preferBusyPoll ? " preferred" : "");
+}
+
+/* A channel a reload added, to the least busy worker that suits it or a thread of its own */
+void lmtChanStart(thread_params *chan)
+{
+    if (g_reg.stats)
+    {
+        lmtStatsAttach(g_reg.stats, chan);
+        lmtPublish(chan);
+    }
+    if (g_reg.workers)
+    {
+        lmtWorker *worker = lmtPickWorker(g_reg.workers, g_reg.workerCnt, chan);
+        chan->worker = worker->idx;
+        worker->chanCnt++;
+        lmtWorkerPost(worker, chan, LMT_CMD_ADD);
+    }
+    else if (lmtChanThread(chan) < 0)
+    {
+        logWithTime("[ERROR] Channel: %d can't create its thread", chan->id);
+        return;
+    }
+    lmtLogPlacement(chan, "its own thread");
+}
+
+void lmtChanStop(thread_params *chan)
+{
+    __atomic_store_n(&chan->stop, true, __ATOMIC_RELEASE);
+    if (chan->worker >= 0)
+    {
+        g_reg.workers[chan->worker].chanCnt--;
+        lmtWorkerPost(&g_reg.workers[chan->worker], chan, LMT_CMD_REMOVE);
+    }
+}
+
+void lmtReapChannels(void)
+{
+    for (int i = 0; i < g_reg.retiredCnt; )
+    {
+        thread_params *chan = g_reg.retired[i];
+        /* nor while the evidence writer still has its ring */
+        if (!__atomic_load_n(&chan->exited, __ATOMIC_ACQUIRE) || (chan->evidence && __atomic_load_n(&chan->evidence->frozen, __ATOMIC_ACQUIRE)))
+        {
+            ++i;
+            continue;
+        }
+        lmtStatsDetach(chan);
+        lmtAlarmRetire(chan);
+        lmtChanFree(chan);
+        g_reg.retired[i] = g_reg.retired[--g_reg.retiredCnt];
+    }
+}
+
+/* Whether a running channel can stay as it is for conf, batch and rcvbuf aside */
+static inline bool lmtSameChannel(const lmtChanConf *conf, const thread_params *chan)
+{
+    return !strcmp(conf->mcastAddr, chan->mcastAddr) && conf->port == chan->port && !strcmp(conf->ifAddr, chan->ifAddr) &&
+        CPU_EQUAL(&conf->cpus, &chan->cpus) && conf->node == chan->node && conf->busyPoll == chan->busyPoll &&
+        conf->preferBusyPoll == chan->preferBusyPoll && conf->evidence == chan->wantsEvidence && conf->fec == chan->fec &&
+        conf->sid == chan->sid && conf->services == chan->services && conf->serviceSidCnt == chan->serviceSidCnt &&
+        (!conf->serviceSidCnt || !memcmp(conf->serviceSids, chan->serviceSids, conf->serviceSidCnt * sizeof(uint16_t)));
+}
+
+/*
+ * SIGHUP: the config file is read again and only the difference is applied. Channels
+ * that are gone leave their group, new ones start, batch, rcvbuf and the bitrate range
+ * change in place. A channel whose group, port, interface or placement changed is a new
+ * channel, so is one whose evidence or fec setting changed. Everything else in the file (workers,
+ * capture, stats, metrics, outputFolder, history, alarms, the evidence group) needs a restart.
+ */
+void lmtReload(void)
+{
+    config_t cfg;
+    lmtChanConf *confs;
+    lmtChanConf def;
+    int added = 0, removed = 0, changed = 0;
+
+    config_init(&cfg);
+    if (!config_read_file(&cfg, g_reg.cfgFile))
+    {
+        logWithTime("[ERROR] reload %s:%d - %s, keeping the running config", g_reg.cfgFile, config_error_line(&cfg), config_error_text(&cfg));
+        config_destroy(&cfg);
+        return;
+    }
+    if (g_reg.fixed)
+    {
+        logWithTime("[WARNING] reload: channels can't change with capture = \"packet\" or \"shared\" or in a replay, restart to apply %s", g_reg.cfgFile);
+        config_destroy(&cfg);
+        return;
+    }
+    lmtReadDefaults(&cfg, &def);
+    int cnt = lmtReadChannels(&cfg, &def, &confs);
+    config_destroy(&cfg);
+    bool *kept = cnt >= 0 ? calloc(cnt ? cnt : 1, sizeof(bool)) : NULL;
+    if (!kept)
+    {
+        logWithTime("[ERROR] reload: out of memory, keeping the running config");
+        free(confs);
+        return;
+    }
+
+    for (int i = 0; i < g_reg.count; )
+    {
+        thread_params *chan = g_reg.chans[i];
+        int j = 0;
+        while (j < cnt && confs[j].id != chan->id)
+            ++j;
+
+        if (j < cnt && lmtSameChannel(&confs[j], chan))
+        {
+            kept[j] = true;
+            if (confs[j].batch != chan->nextBatch || confs[j].rcvbuf != chan->nextRcvbuf || confs[j].bitrateMin != chan->nextBitrateMin ||
+                confs[j].bitrateMax != chan->nextBitrateMax)
+            {
+                chan->nextBatch = confs[j].batch;
+                chan->nextRcvbuf = confs[j].rcvbuf;
+                chan->nextBitrateMin = confs[j].bitrateMin;
+                chan->nextBitrateMax = confs[j].bitrateMax;
+                __atomic_add_fetch(&chan->confGen, 1, __ATOMIC_RELEASE);
+                logWithTime("Channel: %d now batch %d, rcvbuf %d, bitrate %.2f-%.2f", chan->id, chan->nextBatch, chan->nextRcvbuf,
+                    chan->nextBitrateMin, chan->nextBitrateMax);
+                changed++;
+            }
+            ++i;
+            continue;
+        }
+        logWithTime("Channel: %d %s:%hu on %s removed", chan->id, chan->mcastAddr, chan->port, chan->ifAddr);
+        lmtRegRemove(i);
+        lmtChanStop(chan);
+        removed++;
+    }
+
+    for (int j = 0; j < cnt; ++j)
+    {
+        if (kept[j])
+            continue;
+        thread_params *chan = lmtChanNew(&confs[j]);
+        if (!chan || lmtRegAppend(chan) < 0)
+        {
+            if (chan)
+                lmtChanFree(chan);
+            continue;
+        }
+        lmtChanStart(chan);
+        logWithTime("Channel: %d %s:%hu on %s added", chan->id, chan->mcastAddr, chan->port, chan->ifAddr);
+        added++;
+    }
+    logWithTime("reload %s: %d added, %d removed, %d changed in place, %d channels", g_reg.cfgFile, added, removed, changed, g_reg.count);
+    free(kept);
+    free(confs);
+}
+
+void lmtOnSighup(int sig)
+{
+    (void)sig;
+    g_reload = 1;
+}
+
+/* Sleeps one report period, a finished replay cuts it short. Reloads and retired channels are seen to meanwhile */
+bool lmtReportWait(const lmtReplay *replay)
+{
+    for (int i = 0; i < REPORT_PERIOD_MS / 100; ++i)
+    {
+        if (replay->path && __atomic_load_n(&replay->done, __ATOMIC_ACQUIRE))
+            return false;
+        if (g_reload)
+        {
+            g_reload = 0;
+            lmtReload();
+        }
+        lmtReapChannels();
+        usleep(100000);
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    const char* cfg_file = DEFAULT_CONFIG_FILENAME;
+    lmtReplay replay = { .tsBitrate = 10e6 };
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:r:xb:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'c':
+                cfg_file = optarg;
+                break;
+            case 'r':
+                replay.path = optarg;
+                break;
+            case 'x':
+                replay.fast = true;
+                break;
+            case 'b':
+                replay.tsBitrate = atof(optarg) * 1e6;
+                if (replay.tsBitrate <= 0)
+                    usage(argv[0]);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (optind != argc)
+        usage(argv[0]);
+
+    greating();
+    const char* outputFolder = "./";
+    int mLogTofile = false;
+    lmtChanConf chanDefaults;
+    cpu_set_t *workerCpus = NULL;
+    int workerCpusCnt = 0;
+    int mWorkers = 0;
+    int mLogToStdout = true;
+    const char* mCapture = "socket";
+    const char* mStats = NULL;
+    const char* mMetrics = NULL;
+    int mHistory = 0;
+    int parsedChanCount;
+    lmtChanConf *chanConfs;
+
+    /* Config parse*/
+    config_t cfg;
+    // config_setting_t *global;
+
+    config_init(&cfg);
+
+    if (!config_read_file(&cfg, cfg_file))
+    {
+        fprintf(stderr, "%s:%d - %s\n", config_error_file(&cfg), config_error_line(&cfg), config_error_text(&cfg));
+        config_destroy(&cfg);
+        return(EXIT_FAILURE);
+    }
+
+    /*Global Config*/
+
+    config_lookup_string(&cfg, "outputFolder", &outputFolder);
+    config_lookup_bool(&cfg, "logToFile", &mLogTofile);
+    config_lookup_bool(&cfg, "logToStdout", &mLogToStdout);
+    config_lookup_int(&cfg, "workers", &mWorkers);
+    config_lookup_string(&cfg, "capture", &mCapture);
+    config_lookup_string(&cfg, "stats", &mStats);
+    config_lookup_string(&cfg, "metrics", &mMetrics);
+    config_lookup_int(&cfg, "history", &mHistory);
+    if (mWorkers < 0)
+        mWorkers = sysconf(_SC_NPROCESSORS_ONLN);
+
+    lmtLogStart(outputFolder, mLogTofile, mLogToStdout);
+    lmtCrc32Init();
+    lmtCpuNodesInit();
+    logWithTime("TS header kernel: %s", lmtTsHdrsInit());
+    lmtReadEvidence(&cfg, replay.path);
+    lmtReadDefaults(&cfg, &chanDefaults);
+    lmtReadAlarms(&cfg);
+    workerCpusCnt = lmtReadWorkerCpus(&cfg, &workerCpus);
+
+    /*Channel Config*/
+
+    g_reg.cfgFile = cfg_file;
+    g_reg.outFolder = strdup(outputFolder);
+    g_reg.history = replay.path ? 0 : mHistory;
+    g_reg.fixed = replay.path || !strcmp(mCapture, "packet") || !strcmp(mCapture, "shared");
+    parsedChanCount = lmtReadChannels(&cfg, &chanDefaults, &chanConfs);
+    if (parsedChanCount < 0 || !g_reg.outFolder)
+    {
+        logWithTime("[ERROR] out of memory reading %s", cfg_file);
+        exit(-1);
+    }
+    for (int i = 0; i < parsedChanCount; ++i)
     {
-        for (int i = 0; i < chanCount; ++i)
+        thread_params *chan = lmtChanNew(&chanConfs[i]);
+        if (!chan || lmtRegAppend(chan) < 0)
+            exit(-1);
+    }
+    free(chanConfs);
+
+    /* End of config parsing */
+    #ifdef NDEBUG
+        for (int i = 0; i < g_reg.count; ++i)
         {
-            // fprintf(stdout, "id: %d, hasData: %d, PAT: %d, SID: %hu, pmt: %hu, vPid: %hu, vFormat: %s, AudioCnt: %d, aPid: %hu, aFormat: %s, streamType: %s, Bitrate: %.2f, Errors: %d\n", \
-            //         chanConfs[i].id, chanConfs[i].isStream, chanConfs[i].chanInfo.sPatParsed, chanConfs[i].chanInfo.sSid ,chanConfs[i].chanInfo.sPmt, chanConfs[i].chanInfo.sVpid.pid, chanConfs[i].chanInfo.sVpid.pFormat, \
-            //         chanConfs[i].chanInfo.aPidCnt , chanConfs[i].chanInfo.sApid[0].pid, chanConfs[i].chanInfo.sApid[0].pFormat, chanConfs[i].chanInfo.sStreamType, chanConfs[i].chanInfo.sBitrate, getOneMinuteCC(&chanConfs[i].chanInfo));
-            logWithTime("id: %d, hasData: %d, PAT: %d, SID: %hu, pmt: %hu, vPid: %hu, vFormat: %s, AudioCnt: %d, aPid: %hu, aFormat: %s, streamType: %s, Bitrate: %.2f, Errors: %d", \
-                    chanConfs[i].id, chanConfs[i].isStream, chanConfs[i].chanInfo.sPatParsed, chanConfs[i].chanInfo.sSid ,chanConfs[i].chanInfo.sPmt, chanConfs[i].chanInfo.sVpid.pid, chanConfs[i].chanInfo.sVpid.pFormat, \
-                    chanConfs[i].chanInfo.aPidCnt , chanConfs[i].chanInfo.sApid[0].pid, chanConfs[i].chanInfo.sApid[0].pFormat, chanConfs[i].chanInfo.sStreamType, chanConfs[i].chanInfo.sBitrate, getOneMinuteCC(&chanConfs[i].chanInfo));
-            // for (int j = 0; j < 60; ++j)
-            // {
-            //     printf("[%d]", chanConfs[i].chanInfo.cCArray[j]);
-            // }            
+            logWithTime("config %d\n chan id is: %d\n multicast IP is: %s\n port is: %d\n receave interface is: %s", i, g_reg.chans[i]->id, g_reg.chans[i]->mcastAddr,\
+                g_reg.chans[i]->port, g_reg.chans[i]->ifAddr);
         }
+    #endif
 
+    logWithTime("found %d channel in config file: %s with following ID's", g_reg.count, cfg_file);
 
+    for (int i = 0; i < g_reg.count; ++i)
+    {
+        logWithTime("%d", g_reg.chans[i]->id);
+    }
+
+    if (mStats && mStats[0] && lmtStatsOpen(mStats, g_reg.chans, g_reg.count) < 0)
+    {
+        logWithTime("[WARNING] running without the stats segment");
+    }
+
+    if (mMetrics && mMetrics[0] && lmtStartHttp(mMetrics) < 0)
+    {
+        logWithTime("[WARNING] running without the metrics endpoint");
+    }
 
-        printf("\n");
-        usleep(2000000);
-        clearCounters++;
-        if (clearCounters == 30)
+    if (replay.path)
+    {
+        g_logLossless = true;
+        if (g_reg.count == 0 || lmtStartReplay(&replay, g_reg.chans, g_reg.count) < 0)
+        {
+            logWithTime("ERROR Starting the replay");
+            exit(-1);
+        }
+    }
+    else if (!strcmp(mCapture, "packet"))
+    {
+        if (lmtStartCapture(g_reg.chans, g_reg.count) < 0)
+        {
+            logWithTime("ERROR Starting packet capture");
+            exit(-1);
+        }
+    }
+    else if (!strcmp(mCapture, "shared"))
+    {
+        if (lmtStartShared(g_reg.chans, g_reg.count) < 0)
+        {
+            logWithTime("ERROR Starting shared sockets");
+            exit(-1);
+        }
+    }
+    else if (mWorkers > 0)
+    {
+        if (!(g_reg.workers = lmtStartWorkers(g_reg.chans, g_reg.count, mWorkers, workerCpus, workerCpusCnt)))
         {
-            for (int i = 0; i < chanCount; ++i)
+            logWithTime("ERROR Creating workers");
+            exit(-1);
+        }
+        g_reg.workerCnt = mWorkers;
+        logWithTime("%d channels on %d workers", g_reg.count, mWorkers);
+    }
+    else
+    {
+        for (int i = 0; i < g_reg.count; ++i)
+        {
+            if (lmtChanThread(g_reg.chans[i]) < 0)
             {
-                chanConfs[i].chanInfo.cCerrors = 0;
+                logWithTime("ERROR Creating thread");
+                exit(-1);
             }
-            clearCounters = 0;
         }
     }
     config_destroy(&cfg);
+    free(workerCpus);
+
+    if (!replay.path)
+    {
+        const char *where = !strcmp(mCapture, "packet") ? "the packet ring" : !strcmp(mCapture, "shared") ? "a shared socket" : "its own thread";
+        for (int i = 0; i < g_reg.count; ++i)
+        {
+            lmtLogPlacement(g_reg.chans[i], where);
+        }
+    }
+
+    if (!replay.path)
+    {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = lmtOnSighup;
+        sa.sa_flags = SA_RESTART;
+        sigaction(SIGHUP, &sa, NULL);
+    }
+
+    logWithTime("===============================");
+
+    bool more = true;
+
+    while(more)
+    {
+        more = lmtReportWait(&replay);
+        if (!more)
+            lmtLogFlush();      /* the replay's last events go before its final report */
+
+        pthread_mutex_lock(&g_reg.lock);
+        for (int i = 0; i < g_reg.count; ++i)
+        {
+            lmtReportChannel(g_reg.chans[i], !more);
+        }
+        pthread_mutex_unlock(&g_reg.lock);
+
+        lmtLogOutput("\n", 1);
+    }
     return EXIT_SUCCESS;
 }
 
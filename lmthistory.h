@@ -0,0 +1,124 @@
+/*
+ * Layout of the per channel history files, <outputFolder>/<id>.hist.
+ *
+ * One lmtHistoryHdr followed by slots records of recSize bytes, one record per
+ * second, the record of unix second s at slot s % slots. A slot whose sec isn't
+ * the second asked for is a second nobody wrote, the channel or discont was gone.
+ * The file is mapped by discont and written with plain stores as each 1 s window
+ * closes, so it outlives restarts and reloads and costs no syscall while running.
+ *
+ * The header keeps running sums over the last 1, 15 and 60 minutes up to lastSec,
+ * so those windows are O(1) to read. Header and records share one seqlock: seq is
+ * odd while discont writes a second, readers copy and retry if it moved, see
+ * lmtHistoryRead(). Readers use recSize rather than sizeof, fields may be appended.
+ */
+#ifndef LMT_HISTORY_H
+#define LMT_HISTORY_H
+
+#include <stdint.h>
+#include <string.h>
+#include <sched.h>
+
+#define LMT_HISTORY_MAGIC 0x48544d4cu       /* "LMTH" */
+#define LMT_HISTORY_VERSION 1
+#define LMT_HISTORY_WINDOWS 3
+#define LMT_HISTORY_MIN_SLOTS 3600          /* the longest window */
+
+/* lmtHistoryRec.flags */
+#define LMT_HIST_PRESENT 0x01               /* data came in that second */
+#define LMT_HIST_PAT 0x02
+#define LMT_HIST_PMT 0x04
+#define LMT_HIST_RTP 0x08
+#define LMT_HIST_PCR 0x10                   /* PCRs were seen */
+
+static const uint32_t g_lmtHistoryWindows[LMT_HISTORY_WINDOWS] = {60, 900, 3600};
+
+typedef struct lmtHistoryRec
+    {
+    uint32_t sec;               /* unix seconds */
+    uint32_t bitrateKbps;       /* TS packets */
+    uint32_t ccErrors;          /* continuity and RTP sequence errors */
+    uint32_t rtpLost;           /* datagrams missing by RTP sequence number */
+    float pcrJitterP99Us;
+    float mdiDf;                /* ms */
+    float mdiMlr;               /* lost packets per second */
+    uint16_t trActive;          /* 1 << lmtTrIndicator while it held */
+    uint8_t flags;              /* LMT_HIST_ */
+    uint8_t pcrDisc;            /* PCR discontinuities */
+    } lmtHistoryRec;
+
+/* Totals of the seconds in (lastSec - window, lastSec] */
+typedef struct lmtHistorySum
+    {
+    uint32_t window;            /* seconds */
+    uint32_t present;           /* seconds with data */
+    uint32_t errored;           /* seconds with CC errors or RTP loss */
+    uint32_t pcrDisc;
+    uint64_t ccErrors;
+    uint64_t rtpLost;
+    uint64_t kbps;              /* bitrateKbps of the present seconds, over present is the average */
+    } lmtHistorySum;
+
+typedef struct lmtHistoryHdr
+    {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t hdrSize;           /* offset of the first record */
+    uint32_t recSize;
+    uint32_t slots;             /* seconds kept */
+    int32_t id;
+    uint32_t mcastAddr;         /* network order */
+    uint16_t port;
+    uint16_t pad;
+    int64_t created;            /* unix seconds */
+    uint32_t seq;               /* odd while a second is being written */
+    uint32_t lastSec;           /* newest second written, 0 before any */
+    lmtHistorySum sums[LMT_HISTORY_WINDOWS];    /* by g_lmtHistoryWindows */
+    } __attribute__((aligned(64))) lmtHistoryHdr;
+
+static inline const lmtHistoryRec *lmtHistoryAt(const lmtHistoryHdr *hdr, uint32_t sec)
+{
+    return (const lmtHistoryRec *)((const char *)hdr + hdr->hdrSize + (size_t)(sec % hdr->slots) * hdr->recSize);
+}
+
+/*
+ * Consistent copy of the sums and of the records of the cnt seconds up to last,
+ * seconds nobody wrote come back zeroed with their sec set. Returns lastSec.
+ */
+static inline uint32_t lmtHistoryRead(const lmtHistoryHdr *hdr, lmtHistorySum *sums, uint32_t last, uint32_t cnt, lmtHistoryRec *out)
+{
+    size_t size = hdr->recSize < sizeof(lmtHistoryRec) ? hdr->recSize : sizeof(lmtHistoryRec);
+    uint32_t s1, s2, lastSec;
+
+    if (cnt > hdr->slots)
+        cnt = hdr->slots;
+    do
+    {
+        s1 = __atomic_load_n(&hdr->seq, __ATOMIC_ACQUIRE);
+        if (s1 & 1)
+        {
+            sched_yield();
+            continue;
+        }
+        lastSec = hdr->lastSec;
+        if (sums)
+            memcpy(sums, hdr->sums, sizeof(hdr->sums));
+        for (uint32_t i = 0; i < cnt; ++i)
+        {
+            uint32_t sec = last - cnt + 1 + i;
+            memset(&out[i], 0, sizeof(lmtHistoryRec));
+            memcpy(&out[i], lmtHistoryAt(hdr, sec), size);
+            if (out[i].sec != sec)
+            {
+                memset(&out[i], 0, sizeof(lmtHistoryRec));
+                out[i].sec = sec;
+            }
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        s2 = __atomic_load_n(&hdr->seq, __ATOMIC_RELAXED);
+        if (s1 == s2)
+            return lastSec;
+    } while(1);
+}
+
+#endif
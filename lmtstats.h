@@ -0,0 +1,193 @@
+/*
+ * Layout of the discont stats segment (the "stats" setting of discont.cfg).
+ *
+ * One lmtStatsHdr followed by chanCount records of recSize bytes, all little
+ * endian, fixed width and cache line aligned. Every record is a seqlock: the
+ * parser of the channel makes seq odd, rewrites the record in place and makes
+ * it even again, once a second. Readers copy a record and retry if seq moved,
+ * lmtStatsRead() does exactly that. Nothing here ever needs a syscall to read.
+ *
+ * Readers check magic and version, and use recSize rather than sizeof so that
+ * fields appended to the end of lmtStatRec don't break them.
+ *
+ * Channels can come and go while discont runs (SIGHUP). A record with mcastAddr 0
+ * is a free slot, chanCount only ever grows and never past capacity.
+ */
+#ifndef LMT_STATS_H
+#define LMT_STATS_H
+
+#include <stdint.h>
+#include <string.h>
+#include <sched.h>
+
+#define LMT_STATS_MAGIC 0x53544d4cu         /* "LMTS" */
+#define LMT_STATS_VERSION 1
+#define LMT_STATS_MAX_APIDS 8
+#define LMT_STATS_MAX_PIDS 16
+#define LMT_STATS_TR_COUNT 16
+#define LMT_STATS_NAME_SIZE 48
+#define LMT_STATS_MAX_SERVICES 32
+
+enum lmtStatStream
+    {
+    LMT_STREAM_NONE,
+    LMT_STREAM_UDP,
+    LMT_STREAM_RTP,
+    LMT_STREAM_ERROR
+    };
+
+/* TR 101 290 indicators, 1.x first and 2.x second priority, the index into lmtStatRec.tr */
+enum lmtTrIndicator
+    {
+    TR_SYNC_LOSS,               /* 1.1 */
+    TR_SYNC_BYTE,               /* 1.2 */
+    TR_PAT,                     /* 1.3 */
+    TR_CC,                      /* 1.4 */
+    TR_PMT,                     /* 1.5 */
+    TR_PID,                     /* 1.6 */
+    TR_TRANSPORT,               /* 2.1 */
+    TR_CRC,                     /* 2.2 */
+    TR_PCR_REP,                 /* 2.3 */
+    TR_PCR_DISC,                /* 2.3 */
+    TR_PTS,                     /* 2.5 */
+    TR_COUNT
+    };
+
+/* Alarms, the first ALARM_STATES are raised and cleared, the rest are one-off events; 1 << alarm in lmtStatRec.alarms */
+enum lmtAlarm
+    {
+    ALARM_NO_DATA,
+    ALARM_PAT,                  /* PAT missing */
+    ALARM_PMT,                  /* PMT missing */
+    ALARM_CC,                   /* CC errors in the last minute */
+    ALARM_BITRATE,              /* out of the channel's range */
+    ALARM_STATES,
+    ALARM_PAT_CHANGED = ALARM_STATES,
+    ALARM_PMT_CHANGED,
+    ALARM_AUDIO_TRACKS,         /* audio track count changed */
+    ALARM_COUNT
+    };
+
+typedef struct lmtStatsHdr
+    {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t hdrSize;           /* offset of the first record */
+    uint32_t recSize;
+    uint32_t chanCount;         /* records in use or used before, grows when channels are added */
+    int32_t writerPid;
+    int64_t startTime;          /* unix seconds the writer started */
+    uint32_t capacity;          /* records the segment has room for */
+    } __attribute__((aligned(64))) lmtStatsHdr;
+
+typedef struct lmtStatPid
+    {
+    uint16_t pid;
+    uint16_t pad;
+    uint32_t ccErrors;
+    } lmtStatPid;
+
+/* One program of the PAT, with the services setting */
+typedef struct lmtStatService
+    {
+    uint16_t sid;
+    uint16_t pmtPid;
+    uint16_t pcrPid;
+    uint16_t vPid;
+    uint8_t esCnt;
+    uint8_t present;            /* packets of it came in the last 1 s */
+    int8_t pmtVersion;          /* -1 before its PMT */
+    uint8_t pad;
+    uint32_t pmtChanges;
+    uint32_t ccErrors;          /* over its PMT and elementary PIDs */
+    float mbps;                 /* smoothed */
+    } lmtStatService;
+
+typedef struct lmtStatRec
+    {
+    uint32_t seq;               /* odd while the record is being written */
+    int32_t id;
+    uint32_t mcastAddr;         /* network order */
+    uint16_t port;
+    uint8_t isStream;
+    uint8_t streamType;         /* enum lmtStatStream */
+    int64_t updated;            /* unix ns of the last update */
+    double bitrate;             /* Mbit/s of TS packets, last 1 s */
+    uint32_t oneMinuteCC;
+    uint16_t tsPacketSize;
+    uint8_t patParsed;
+    uint8_t pmtParsed;
+    uint16_t sid;
+    uint16_t pmtPid;
+    uint16_t pcrPid;
+    uint16_t vPid;
+    int8_t patVersion;
+    int8_t pmtVersion;
+    uint8_t aPidCnt;
+    uint8_t pidCnt;
+    uint16_t aPids[LMT_STATS_MAX_APIDS];
+    char vFormat[LMT_STATS_NAME_SIZE];
+    char aFormat[LMT_STATS_MAX_APIDS][LMT_STATS_NAME_SIZE];
+    uint32_t patChanges;
+    uint32_t pmtChanges;
+    uint32_t tr[LMT_STATS_TR_COUNT];        /* by enum lmtTrIndicator */
+    uint32_t trActive;
+    float mdiDf;
+    float mdiMlr;
+    float pcrJitterP99Us;
+    float pcrDriftPpm;
+    lmtStatPid pids[LMT_STATS_MAX_PIDS];
+    uint64_t rtpLost;           /* datagrams missing by RTP sequence number */
+    uint64_t kernelDrops;       /* datagrams dropped on the channel's socket before discont read them, 0 with capture "shared" or "packet" */
+    uint64_t truncated;         /* datagrams larger than a receive slot */
+    int32_t rcvbuf;             /* socket receive buffer as the kernel reports it */
+    uint32_t parseP99Ns;        /* parse time per datagram, last 1 s */
+    uint32_t queueP99Us;        /* kernel receive timestamp to parse, last 1 s */
+    float bitrateAvg;           /* Mbit/s, smoothed */
+    float nullBitrate;          /* Mbit/s of PID 0x1FFF, smoothed */
+    float pidMbps[LMT_STATS_MAX_PIDS];      /* smoothed, same order as pids */
+    int16_t rxCpu;              /* CPU the kernel last received the channel's packets on, -1 if unknown */
+    int16_t parseCpu;           /* CPU the channel was last parsed on, -1 before it was */
+    uint32_t napiId;            /* NIC receive queue of the channel's packets, 0 if unknown */
+    uint32_t alarms;            /* 1 << lmtAlarm while raised */
+    float rtpJitterUs;          /* RFC 3550 interarrival jitter */
+    uint64_t rtpReordered;      /* datagrams that came in behind a later one, but in time */
+    uint64_t rtpLate;           /* came in after they were counted in rtpLost */
+    uint64_t rtpDuplicates;
+    uint64_t fecRecoverable;    /* of rtpLost, what the SMPTE 2022-1 FEC that came in could rebuild */
+    uint64_t fecUnrecoverable;
+    uint16_t serviceCnt;        /* programs tracked, the first LMT_STATS_MAX_SERVICES are in services */
+    uint16_t pad;
+    lmtStatService services[LMT_STATS_MAX_SERVICES];
+    } __attribute__((aligned(64))) lmtStatRec;
+
+static inline const lmtStatRec *lmtStatsRec(const lmtStatsHdr *hdr, uint32_t i)
+{
+    return (const lmtStatRec *)((const char *)hdr + hdr->hdrSize + (size_t)i * hdr->recSize);
+}
+
+/* Consistent copy of record i, as much of it as both sides know about */
+static inline void lmtStatsRead(const lmtStatsHdr *hdr, uint32_t i, lmtStatRec *out)
+{
+    const lmtStatRec *rec = lmtStatsRec(hdr, i);
+    size_t size = hdr->recSize < sizeof(lmtStatRec) ? hdr->recSize : sizeof(lmtStatRec);
+    uint32_t s1, s2;
+
+    memset(out, 0, sizeof(lmtStatRec));
+    do
+    {
+        s1 = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+        if (s1 & 1)
+        {
+            sched_yield();
+            continue;
+        }
+        memcpy(out, rec, size);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        s2 = __atomic_load_n(&rec->seq, __ATOMIC_RELAXED);
+        if (s1 == s2)
+            return;
+    } while(1);
+}
+
+#endif